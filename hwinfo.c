@@ -28,6 +28,8 @@ typedef struct {
 
 static int get_probe_flags(int, char **, hd_data_t *);
 static void progress2(char *, char *);
+static void log_sink(void *data, const char *buf, size_t len);
+static void log_done(hd_data_t *hd_data, FILE *f);
 
 static unsigned deb = 0;
 static char *log_file = "";
@@ -36,6 +38,7 @@ static int listplus = 0;
 
 static int test = 0;
 static int is_short = 0;
+static int log_started = 0;
 
 static char *showconfig = NULL;
 static char *saveconfig = NULL;
@@ -47,6 +50,7 @@ int x11_install_info(hd_data_t *hd_data);
 int oem_install_info(hd_data_t *hd_data);
 void dump_packages(hd_data_t *hd_data);
 
+int cached_scan(hd_data_t *hd_data);
 void do_hw(hd_data_t *hd_data, FILE *f, int hw_item);
 void do_hw_multi(hd_data_t *hd_data, FILE *f, hd_hw_item_t *hw_items);
 void do_short(hd_data_t *hd_data, hd_t *hd, FILE *f);
@@ -54,6 +58,7 @@ void do_test(hd_data_t *hd_data);
 void help(void);
 void dump_db_raw(hd_data_t *hd_data);
 void dump_db(hd_data_t *hd_data);
+void dump_timings(hd_data_t *hd_data, FILE *f);
 void do_chroot(hd_data_t *hd_data, char *dir);
 void ask_db(hd_data_t *hd_data, char *query);
 // void get_mapping(hd_data_t *hd_data);
@@ -70,6 +75,8 @@ struct {
   unsigned db_idx;
   unsigned separate:1;
   unsigned verbose:1;
+  unsigned timings:1;
+  unsigned cached:1;
   char *root;
 } opt;
 
@@ -101,6 +108,8 @@ struct option options[] = {
   { "nowpa", 0, NULL, 317 },
   { "map2", 0, NULL, 318 },
   { "hddb-dir-new", 1, NULL, 319 },
+  { "timings", 0, NULL, 320 },
+  { "cached", 0, NULL, 321 },
   { "cdrom", 0, NULL, 1000 + hw_cdrom },
   { "floppy", 0, NULL, 1000 + hw_floppy },
   { "disk", 0, NULL, 1000 + hw_disk },
@@ -318,6 +327,15 @@ int main(int argc, char **argv)
           if(*optarg) setenv("LIBHD_HDDB_DIR_NEW", optarg, 1);
           break;
 
+        case 320:
+          hd_data->flags.stats = 1;
+          opt.timings = 1;
+          break;
+
+        case 321:
+          opt.cached = 1;
+          break;
+
         case 400:
           printf("%s\n", hd_version());
 	  break;
@@ -342,6 +360,9 @@ int main(int argc, char **argv)
 
     if(!hw_items && is_short) hw_item[hw_items++] = 2000;	/* all */
 
+    /* log is only shown in log file (and with --showconfig --debug -1) */
+    if(!*log_file && !(showconfig && hd_data->debug == -1u)) hd_data->flags.nolog = 1;
+
     if(hw_items >= 0 || showconfig || saveconfig) {
       if(*log_file) {
         if(!strcmp(log_file, "-")) {
@@ -352,6 +373,9 @@ int main(int argc, char **argv)
         }
       }
 
+      /* write the log as we go instead of keeping it in memory */
+      if(f && (hd_data->debug & HD_DEB_SHOW_LOG)) hd_set_log_sink(hd_data, log_sink, f);
+
       if(opt.root) do_chroot(hd_data, opt.root);
 
       if(opt.separate || hw_items <= 1) {
@@ -368,8 +392,11 @@ int main(int argc, char **argv)
 #ifndef LIBHD_TINY
       if(showconfig) {
         hd = hd_read_config(hd_data, showconfig);
-        if(hd_data->debug == -1) {
-          fprintf(f ? f : stdout,
+        if(f) {
+          log_done(hd_data, f);
+        }
+        else if(hd_data->debug == -1) {
+          fprintf(stdout,
             "============ start debug info ============\n%s=========== end debug info ============\n",
             hd_data->log
           );
@@ -384,7 +411,12 @@ int main(int argc, char **argv)
       }
 #endif
 
-      if(f) fclose(f);
+      if(opt.timings) dump_timings(hd_data, f ? f : stdout);
+
+      if(f) {
+        hd_set_log_sink(hd_data, NULL, NULL);
+        fclose(f);
+      }
     }
 
     hd_free_hd_data(hd_data);
@@ -495,6 +527,42 @@ int main(int argc, char **argv)
 }
 
 
+/*
+ * Read hardware list from scan cache, or scan and update the cache.
+ *
+ * The scan covers all requested hardware items at once.
+ *
+ * Returns 1 if the hardware list is complete and no rescan is needed.
+ */
+int cached_scan(hd_data_t *hd_data)
+{
+  static int done = 0;
+  int i;
+
+  if(!opt.cached) return 0;
+
+  if(done) return 1;
+
+  hd_clear_probe_feature(hd_data, pr_all);
+  hd_set_probe_feature(hd_data, pr_default);
+  for(i = 0; i < hw_items; i++) {
+    if(hw_item[i] == 2001) {
+      hd_set_probe_feature(hd_data, pr_all);
+    }
+    else if(hw_item[i] < 2000) {
+      hd_set_probe_feature_hw(hd_data, hw_item[i]);
+    }
+  }
+
+  if(hd_cache_load(hd_data, NULL)) {
+    hd_scan(hd_data);
+    hd_cache_save(hd_data, NULL);
+  }
+
+  return done = 1;
+}
+
+
 /*
  * hw_item might be either a 'real' hd_hw_item_t or some number >= 2000 used
  * for some special probe runs.
@@ -523,7 +591,10 @@ void do_hw(hd_data_t *hd_data, FILE *f, int hw_item)
         case 2001: i = pr_all; break;
         case 2003: i = pr_cpu; break;
       }
-      if(i != -1) {
+      if(cached_scan(hd_data)) {
+        hd0 = hw_item == 2003 ? hd_list(hd_data, hw_cpu, 0, NULL) : hd_data->hd;
+      }
+      else if(i != -1) {
         hd_clear_probe_feature(hd_data, pr_all);
         hd_set_probe_feature(hd_data, i);
         hd_scan(hd_data);
@@ -540,7 +611,7 @@ void do_hw(hd_data_t *hd_data, FILE *f, int hw_item)
       break;
 
     default:
-      hd0 = hd_list(hd_data, hw_item, 1, NULL);
+      hd0 = hd_list(hd_data, hw_item, !cached_scan(hd_data), NULL);
   }
 
   if(hd_data->progress) {
@@ -549,15 +620,7 @@ void do_hw(hd_data_t *hd_data, FILE *f, int hw_item)
   }
 
   if(f) {
-    if((hd_data->debug & HD_DEB_SHOW_LOG) && hd_data->log) {
-      fprintf(f,
-        "============ start hardware log ============\n"
-      );
-      fprintf(f,
-        "============ start debug info ============\n%s=========== end debug info ============\n",
-        hd_data->log
-      );
-    }
+    log_done(hd_data, f);
 
     i = hd_data->debug;
     hd_data->debug = -1;
@@ -707,7 +770,7 @@ void do_hw_multi(hd_data_t *hd_data, FILE *f, hd_hw_item_t *hw_items)
   hd_t *hd, *hd0;
   int i;
 
-  hd0 = hd_list2(hd_data, hw_items, 1);
+  hd0 = hd_list2(hd_data, hw_items, !cached_scan(hd_data));
 
   if(hd_data->progress) {
     printf("\r%64s\r", "");
@@ -715,15 +778,7 @@ void do_hw_multi(hd_data_t *hd_data, FILE *f, hd_hw_item_t *hw_items)
   }
 
   if(f) {
-    if((hd_data->debug & HD_DEB_SHOW_LOG) && hd_data->log) {
-      fprintf(f,
-        "============ start hardware log ============\n"
-      );
-      fprintf(f,
-        "============ start debug info ============\n%s=========== end debug info ============\n",
-        hd_data->log
-      );
-    }
+    log_done(hd_data, f);
 
     i = hd_data->debug;
     hd_data->debug = -1;
@@ -753,6 +808,39 @@ void do_hw_multi(hd_data_t *hd_data, FILE *f, hd_hw_item_t *hw_items)
 }
 
 
+/*
+ * Write log messages to log file; start a new debug info section if needed.
+ */
+void log_sink(void *data, const char *buf, size_t len)
+{
+  FILE *f = data;
+
+  if(!log_started) {
+    fprintf(f,
+      "============ start hardware log ============\n"
+      "============ start debug info ============\n"
+    );
+    log_started = 1;
+  }
+
+  fwrite(buf, 1, len, f);
+}
+
+
+/*
+ * Write remaining log messages and close debug info section.
+ */
+void log_done(hd_data_t *hd_data, FILE *f)
+{
+  hd_log_flush(hd_data);
+
+  if(log_started) {
+    fprintf(f, "=========== end debug info ============\n");
+    log_started = 0;
+  }
+}
+
+
 void do_short(hd_data_t *hd_data, hd_t *hd, FILE *f)
 {
 #ifndef LIBHD_TINY
@@ -842,8 +930,18 @@ void help()
     "        Set debug level to N. The debug info is shown only in the log\n"
     "        file. If you specify a log file, the debug level is implicitly\n"
     "        set to a reasonable value (N is a bitmask of individual flags).\n"
+    "        With flag 0x1000000 set, only probing modules whose flag is also\n"
+    "        set are logged (e.g. 0x1000010: pci).\n"
     "    --verbose\n"
     "        Increase verbosity. Only together with --map.\n"
+    "    --timings\n"
+    "        Show time and resources used by each probing module and step.\n"
+    "        Use this option in addition to a hardware probing option.\n"
+    "    --cached\n"
+    "        Use the result of the last scan from " HD_CACHE_FILE " if\n"
+    "        nothing has changed since (no reboot, kernel, data base, or hotplug\n"
+    "        event). Otherwise scan and update the cache.\n"
+    "        Use this option in addition to a hardware probing option.\n"
     "    --log FILE\n"
     "        Write log info to FILE.\n"
     "        Don't forget to also specify --<HARDWARE_ITEM> to trigger any\n"
@@ -1370,6 +1468,36 @@ void dump_db_raw(hd_data_t *hd_data)
 }
 
 
+/*
+ * Show probing statistics, grouped by probing module.
+ */
+void dump_timings(hd_data_t *hd_data, FILE *f)
+{
+  hd_probe_stats_t *st, *st2;
+  char buf[64];
+
+  fprintf(f, "\n%-36s %9s %9s %6s %10s %5s %4s\n",
+    "module/step", "wall ms", "cpu ms", "files", "bytes", "procs", "runs"
+  );
+
+  for(st = hd_probe_stats(hd_data); st; st = st->next) {
+    if(st->info) continue;
+    fprintf(f, "%-36s %9.3f %9.3f %6u %10"PRIu64" %5u %4u\n",
+      st->name, st->wall_time / 1000., st->cpu_time / 1000., st->files,
+      st->bytes, st->children, st->runs
+    );
+    for(st2 = hd_probe_stats(hd_data); st2; st2 = st2->next) {
+      if(!st2->info || st2->module != st->module) continue;
+      snprintf(buf, sizeof buf, "  %-12s %s", st2->name, st2->info);
+      fprintf(f, "%-36.36s %9.3f %9.3f %6u %10"PRIu64" %5u %4u\n",
+        buf, st2->wall_time / 1000., st2->cpu_time / 1000., st2->files,
+        st2->bytes, st2->children, st2->runs
+      );
+    }
+  }
+}
+
+
 void dump_db(hd_data_t *hd_data)
 {
   hd_data->progress = NULL;
@@ -22,6 +22,7 @@ struct option options[] = {
   { "boot", 0, NULL, 508 },
   { "active", 1, NULL, 509 },
   { "only", 1, NULL, 510 },
+  { "import", 0, NULL, 511 },
   { "sys", 0, NULL, 1000 + hw_sys },
   { "cpu", 0, NULL, 1000 + hw_cpu },
   { "keyboard", 0, NULL, 1000 + hw_keyboard },
@@ -99,6 +100,7 @@ struct {
   unsigned fast:1;
   unsigned silent:1;
   unsigned boot:1;
+  unsigned import:1;
   str_list_t *only;
 } opt;
 
@@ -107,7 +109,9 @@ int do_scan(hd_hw_item_t *items);
 int do_show(char *id);
 int do_list(hd_hw_item_t *items);
 int do_config(int type, char *val, char *id);
+int do_import(void);
 int fast_ok(hd_hw_item_t *items);
+int scope_ok(hd_hw_item_t *items);
 int has_item(hd_hw_item_t *items, hd_hw_item_t item);
 int has_hw_class(hd_t *hd, hd_hw_item_t *items);
 
@@ -189,6 +193,10 @@ int main(int argc, char **argv)
         if(*optarg) add_str_list(&opt.only, optarg);
         break;
 
+      case 511:
+        opt.import = 1;
+        break;
+
       case 1000 ... 1100:
         opt.scan = 1;
         if(scan_items + 1 < sizeof scan_item / sizeof *scan_item) {
@@ -204,6 +212,11 @@ int main(int argc, char **argv)
 
   scan_item[scan_items] = 0;
 
+  if(opt.import) {
+    rc = do_import();
+    ok = 1;
+  }
+
   if(opt.scan && !opt.list) {
     if(argv[optind] || !scan_items) return help(), 1;
     rc = do_scan(scan_item);
@@ -271,6 +284,7 @@ void help()
     "  --avail=state id  change 'available' status\n"
     "  --need=state id   change 'needed' status\n"
     "  --active=state id change 'active' status\n"
+    "  --import          move config status into a single file (" HARDWARE_DIR "/" HD_CONFIG_DB ")\n"
     "  --hw_item         probe for hw_item and update status info\n"
     "  hw_item is one of:\n"
     "    all, bios, block, bluetooth, braille, bridge, camera, cdrom, chipcard, cpu,\n"
@@ -289,6 +303,7 @@ int do_scan(hd_hw_item_t *items)
   hd_status_t status = { };
   hd_data_t *hd_data;
   hd_t *hd, *hd1;
+  str_list_t *sl;
   int err = 0;
 
   if(opt.fast) opt.fast = fast_ok(items);
@@ -313,12 +328,27 @@ int do_scan(hd_hw_item_t *items)
   hd_data->flags.list_all = 1;
   hd_data->flags.fast = opt.fast;
 
-  hd = hd_list2(hd_data, items, 1);
+  /* only some sysfs devices: just probe them */
+  for(sl = hd_data->only; sl; sl = sl->next) {
+    if(strncmp(sl->str, "/devices/", sizeof "/devices/" - 1)) break;
+  }
+
+  if(hd_data->only && !sl && scope_ok(items)) {
+    for(sl = hd_data->only; sl; sl = sl->next) {
+      hd_free_hd_list(hd_scan_sysfs_path(hd_data, sl->str));
+    }
+    hd = hd_list2(hd_data, items, 0);
+  }
+  else {
+    hd = hd_list2(hd_data, items, 1);
+  }
 
   if(hd) found_items = 1;
 
+  /* all at once: fewer writes and no half-updated config after a crash */
+  err = hd_write_config_list(hd_data, hd);
+
   for(hd1 = hd; hd1; hd1 = hd1->next) {
-    err = hd_write_config(hd_data, hd1);
     if(verbose >= 2) {
       printf(
         "write=%d %s: (cfg=%s, avail=%s, need=%s, active=%s",
@@ -338,15 +368,10 @@ int do_scan(hd_hw_item_t *items)
       );
 
     }
-    if(err) break;
   }
 
   if(err) {
-    fprintf(stderr,
-      "Error writing configuration for %s (%s)\n",
-      hd1->unique_id,
-      hd1->model
-    );
+    fprintf(stderr, "Error writing configuration\n");
     exit(1);
   }
 
@@ -496,65 +521,21 @@ int do_list(hd_hw_item_t *items)
 int do_config(int type, char *val, char *id)
 {
   hd_data_t *hd_data;
-  hd_t *hd;
-  hd_status_value_t status = 0;
-  int i;
-  char *s;
 
   hd_data = calloc(1, sizeof *hd_data);
 
-  if ( id[0] == '/' ){
-     int nr=0;
-     char *_id = 0;
-     hd_t *hd_manual;
+  switch(hd_set_config_status(hd_data, id, type, val)) {
+    case 1:
+      printf("invalid status: %s\n", val);
+      break;
 
-     hd_manual = hd_list(hd_data, hw_manual, 1, NULL);
-     for(hd = hd_manual; hd; hd = hd->next) {
-        if(hd->status.available != status_yes) continue;
-        if(!search_str_list(hd->unix_dev_names, id)) continue;
-	_id = hd->unique_id;
-        nr++;
-     }
-     if ( nr == 1 )
-        hd = hd_read_config(hd_data, _id);
-  }else
-    hd = hd_read_config(hd_data, id);
+    case 2:
+      printf("no such hardware item: %s\n", id);
+      break;
 
-  if(hd) {
-    for(i = 1; i < 8; i++) {
-      s = hd_status_value_name(i);
-      if(s && !strcmp(val, s)) {
-        status = i;
-        break;
-      }
-    }
-    if(!status) {
-      printf("invalid status: %s\n", val);
-    }
-    else {
-      switch(type) {
-        case 1:
-          hd->status.configured = status;
-          break;
-
-        case 2:
-          hd->status.available = status;
-          break;
-
-        case 3:
-          hd->status.needed = status;
-          break;
-
-        case 4:
-          hd->status.active = status;
-          break;
-      }
-      hd_write_config(hd_data, hd);
-    }
-    hd = hd_free_hd_list(hd);
-  }
-  else {
-    printf("no such hardware item: %s\n", id);
+    case 3:
+      fprintf(stderr, "hwscan: %s: can't write config\n", id);
+      break;
   }
 
   hd_free_hd_data(hd_data);
@@ -564,6 +545,28 @@ int do_config(int type, char *val, char *id)
 }
 
 
+/*
+ * Copy config status from the udi/ and unique-keys/ directories into the
+ * config store.
+ */
+int do_import()
+{
+  hd_data_t *hd_data;
+  int err;
+
+  hd_data = calloc(1, sizeof *hd_data);
+
+  if((err = hd_config_import(hd_data))) {
+    fprintf(stderr, "hwscan: import failed\n");
+  }
+
+  hd_free_hd_data(hd_data);
+  free(hd_data);
+
+  return err ? 1 : 0;
+}
+
+
 /*
  * Check whether a 'fast' scan would suffice to re-check the presence
  * of all known hardware.
@@ -604,6 +607,37 @@ int fast_ok(hd_hw_item_t *items)
 }
 
 
+/*
+ * Check if hd_scan_sysfs_path() runs all probing modules items need.
+ */
+int scope_ok(hd_hw_item_t *items)
+{
+  static hd_probe_feature_t scope_features[] = {
+    pr_int, pr_pci, pr_usb, pr_block, pr_block_cdrom, pr_block_part,
+    pr_block_mods, pr_scsi, pr_net
+  };
+  hd_data_t *hd_data;
+  unsigned u;
+  int ok = 1;
+
+  hd_data = calloc(1, sizeof *hd_data);
+
+  for(; *items; items++) hd_set_probe_feature_hw(hd_data, *items);
+
+  for(u = 0; u < sizeof scope_features / sizeof *scope_features; u++) {
+    hd_clear_probe_feature(hd_data, scope_features[u]);
+  }
+
+  for(u = 1; u < pr_max && ok; u++) {
+    if(hd_probe_feature(hd_data, u)) ok = 0;
+  }
+
+  free(hd_data);
+
+  return ok;
+}
+
+
 /* check if item is in items */
 int has_item(hd_hw_item_t *items, hd_hw_item_t item)
 {
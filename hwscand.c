@@ -2,42 +2,633 @@
 /* hwscan front end
    Copyright 2004 by SUSE (<adrian@suse.de>) */
 
+#define _GNU_SOURCE
+
 #include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
-#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <sys/stat.h>
+#include <linux/netlink.h>
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+
+#include "hd.h"
+#include "hd_int.h"
 
 #include "init_message.h"
 
 #define TIMEOUT 2
 #define LONG_TIMEOUT 0
-#define BUFFERS 1024
+// max. number of queued requests
+#define MAX_PENDING 65536
+// media check interval if there are no uevents
+#define POLL_INTERVAL 6
+
+// a set of names (hash table, linear probing)
+typedef struct {
+	char *name;
+	char *real;		// devices: resolved path
+	time_t last;		// scan requests: last scan, 0: pending
+	int state;		// devices: medium present
+} entry_t;
+
+typedef struct {
+	entry_t *entry;
+	unsigned size;		// power of 2
+	unsigned used;
+} name_set_t;
+
+// scan requests, per command
+static name_set_t command_device[NR_COMMANDS];
+static time_t command_last[NR_COMMANDS];	// commands without device
+static unsigned command_pending[NR_COMMANDS];
+
+// devices to check for media changes, by name and by resolved path
+static name_set_t devices;
+static name_set_t devices_real;
+
+static int lines = 0;
+static int lines_max = 0;
+static char **commands;
+
+static unsigned pending = 0;
+
+// event counters, cf. 'hwscanqueue --stats'
+static struct {
+	unsigned long received;
+	unsigned long coalesced;
+	unsigned long dropped;
+	unsigned long scans;
+} stats;
+
+static int timer_fd = -1;
+static int poll_fd = -1;
+static int uevent_fd = -1;
+
+static unsigned name_hash( const char *s )
+{
+	unsigned h = 2166136261u;
+
+	while ( *s )
+		h = (h ^ (unsigned char) *s++) * 16777619u;
+
+	return h;
+}
+
+// the slot holding name or the free slot where it would go
+static entry_t *set_slot( name_set_t *set, const char *name )
+{
+	unsigned i, mask = set->size - 1;
+
+	for ( i = name_hash(name) & mask; set->entry[i].name; i = (i + 1) & mask )
+		if ( !strcmp(set->entry[i].name, name) )
+			break;
+
+	return set->entry + i;
+}
+
+static entry_t *set_find( name_set_t *set, const char *name )
+{
+	entry_t *e;
+
+	if ( !set->size )
+		return NULL;
+
+	e = set_slot( set, name );
+
+	return e->name ? e : NULL;
+}
+
+// new entries are zeroed; the returned pointer is valid until the next set_add()/set_del()
+static entry_t *set_add( name_set_t *set, const char *name )
+{
+	entry_t *e, *old = set->entry;
+	unsigned i, old_size = set->size;
+
+	if ( (e = set_find(set, name)) )
+		return e;
+
+	if ( (set->used + 1) * 4 > set->size * 3 ){
+		set->size = set->size ? set->size * 2 : 16;
+		set->entry = calloc( set->size, sizeof *set->entry );
+		for ( i=0; i<old_size; i++ )
+			if ( old[i].name )
+				*set_slot( set, old[i].name ) = old[i];
+		free( old );
+	}
+
+	e = set_slot( set, name );
+	e->name = strdup(name);
+	set->used++;
+
+	return e;
+}
+
+static void set_del( name_set_t *set, const char *name )
+{
+	entry_t *e = set_find( set, name );
+	unsigned i, j, k, mask = set->size - 1;
+
+	if ( !e )
+		return;
+
+	free( e->name );
+	free( e->real );
+	set->used--;
+
+	// move up entries that would no longer be found
+	for ( i = j = e - set->entry; ; ){
+		memset( set->entry + i, 0, sizeof *set->entry );
+		do {
+			j = (j + 1) & mask;
+			if ( !set->entry[j].name )
+				return;
+			k = name_hash(set->entry[j].name) & mask;
+		} while ( i <= j ? (i < k && k <= j) : (i < k || k <= j) );
+		set->entry[i] = set->entry[j];
+		i = j;
+	}
+}
+
+// forget about scans that are not pending, to make room
+static void set_purge( name_set_t *set )
+{
+	unsigned i;
+
+	for ( i=0; i<set->size; i++ ){
+		while ( set->entry[i].name && set->entry[i].last ){
+			char *name = strdup(set->entry[i].name);
+			set_del( set, name );
+			free( name );
+		}
+	}
+}
+
+// hw items matching command_args[]
+static const hd_hw_item_t command_items[NR_COMMANDS] = {
+	hw_block, hw_partition, hw_usb, hw_ieee1394, hw_pci, hw_pcmcia, hw_bluetooth
+};
+
+// we keep libhd and its databases loaded between scans
+static hd_data_t *hd_data;
+static int scan_disabled = 0;
+
+static void log_discard( void *data, const char *buf, size_t len )
+{
+}
+
+static void hd_init( void )
+{
+	hd_data = calloc(1, sizeof *hd_data);
+	hd_set_log_sink( hd_data, log_discard, NULL );
+
+	// look if we have been disabled (hwscan --boot)
+	hd_clear_probe_feature( hd_data, pr_all );
+	hd_scan( hd_data );
+	hd_set_probe_feature( hd_data, pr_scan );
+	if ( !hd_probe_feature(hd_data, pr_scan) )
+		scan_disabled = 1;
+}
+
+// cf. fast_ok() in hwscan.c
+static int fast_ok( hd_hw_item_t *items )
+{
+	hd_data_t *hd_manual;
+	hd_t *hd, *hd1;
+	int i, ok = 1;
+
+	for ( i=0; items[i]; i++ )
+		if ( items[i] == hw_mouse || items[i] == hw_storage_ctrl )
+			break;
+	if ( !items[i] )
+		return 1;
+
+	// not in hd_data: the manual entries would pile up there
+	hd_manual = calloc(1, sizeof *hd_manual);
+	hd_set_log_sink( hd_manual, log_discard, NULL );
+	hd_manual->flags.list_all = 1;
+
+	hd = hd_list( hd_manual, hw_manual, 1, NULL );
+	for ( hd1 = hd; hd1; hd1 = hd1->next ){
+		if (
+			(hd1->hw_class == hw_mouse && hd1->bus.id == bus_serial) ||
+			(hd1->hw_class == hw_storage_ctrl && hd1->bus.id == bus_parallel)
+		){
+			ok = 0;
+			break;
+		}
+	}
+	hd_free_hd_list( hd );
+	hd_free_hd_data( hd_manual );
+	free( hd_manual );
+
+	return ok;
+}
+
+// 'hwscan --fast --boot --silent' without forking; takes over only
+static void scan( hd_hw_item_t *items, str_list_t *only )
+{
+	hd_t *hd;
+	str_list_t *sl;
+	FILE *f;
+
+	if ( scan_disabled ){
+		free_str_list( only );
+		return;
+	}
+
+#if DEBUG
+	printf("SCAN");
+	for ( sl = only; sl; sl = sl->next )
+		printf(" %s", sl->str);
+	printf("\n");
+#endif
+
+	hd_data->flags.list_all = 1;
+	hd_data->flags.fast = fast_ok( items );
+	hd_data->only = only;
+
+	// only some sysfs devices: just probe them
+	for ( sl = only; sl; sl = sl->next )
+		if ( strncmp(sl->str, "/devices/", sizeof "/devices/" - 1) )
+			break;
+
+	if ( only && !sl ){
+		for ( sl = only; sl; sl = sl->next )
+			hd_free_hd_list( hd_scan_sysfs_path(hd_data, sl->str) );
+		hd = hd_list2( hd_data, items, 0 );
+	}else
+		hd = hd_list2( hd_data, items, 1 );
+
+	if ( hd_write_config_list(hd_data, hd) )
+		fprintf( stderr, "hwscand: error writing configuration\n" );
+
+	if ( hd ){
+		unlink(HARDWARE_DIR "/.update");		/* the old file */
+		unlink(HARDWARE_UNIQUE_KEYS "/.update");	/* so we trigger a rescan */
+		if ( (f = fopen(HARDWARE_UNIQUE_KEYS "/.update", "a")) )
+			fclose(f);
+	}
+
+	hd_free_hd_list( hd );
+
+	hd_data->only = free_str_list( hd_data->only );
+	hd_data->flags.fast = 0;
+
+	// nothing refers to entries from earlier scans any more
+	hd_free_old_hd_entries( hd_data );
+}
+
+// 'hwscan --cfg=state id' etc., cf. do_config() in hwscan.c
+static int config( char *cmd )
+{
+	static const char *args[] = { "--cfg=", "--avail=", "--need=", "--active=" };
+	char *val, *id;
+	int type;
+
+	if ( strncmp(cmd, "/sbin/hwscan ", 13) )
+		return 0;
+	cmd += 13;
+	for ( type=0; type<4; type++ )
+		if ( !strncmp(cmd, args[type], strlen(args[type])) )
+			break;
+	if ( type >= 4 || !(id = strchr(cmd, ' ')) )
+		return 0;
+
+	val = strndup( cmd + strlen(args[type]), id - cmd - strlen(args[type]) );
+	id++;
+
+	if ( hd_set_config_status(hd_data, id, type + 1, val) == 3 )
+		fprintf( stderr, "hwscand: %s: error writing configuration\n", id );
+
+	free( val );
+
+	return 1;
+}
+
+static void set_timer( int fd, int sec, int interval )
+{
+	struct itimerspec t;
+
+	memset( &t, 0, sizeof t );
+	t.it_value.tv_sec = sec;
+	t.it_interval.tv_sec = interval;
+	timerfd_settime( fd, 0, &t, NULL );
+}
+
+// start debounce window; commands run when it expires
+static void trigger( void )
+{
+	set_timer( timer_fd, TIMEOUT, 0 );
+}
+
+// poll media state only if the kernel doesn't tell us
+static void update_poll_timer( void )
+{
+	if ( uevent_fd >= 0 )
+		return;
+	if ( devices.used )
+		set_timer( poll_fd, POLL_INTERVAL, POLL_INTERVAL );
+	else
+		set_timer( poll_fd, 0, 0 );
+}
+
+// run hwscan if device e has got or lost its medium
+static void check_device( entry_t *e )
+{
+	int fd;
+	int state;
+	hd_hw_item_t items[] = { hw_partition, 0 };
+	str_list_t *only = NULL;
+
+	fd = open( e->name, O_RDONLY );
+	state = fd >= 0;
+	if ( fd >= 0 )
+		close(fd);
+
+	if ( state != e->state ){
+		add_str_list( &only, e->name );
+		stats.scans++;
+		scan( items, only );
+	}
+	e->state = state;
+}
+
+// queue a scan for command c (and device dev)
+static void queue_scan( int c, char *dev )
+{
+	entry_t *e;
+	time_t now = time(0L);
+
+	trigger();
+
+	if ( ! command_with_device[c] ){
+		if ( command_pending[c] || LONG_TIMEOUT+command_last[c] >= now ){
+			stats.coalesced++;
+		}else{
+			command_last[c] = 0;
+			command_pending[c] = 1;
+			pending++;
+		}
+		return;
+	}
+
+	if ( !(e = set_find(&command_device[c], dev)) ){
+		if ( command_device[c].used >= MAX_PENDING )
+			set_purge( &command_device[c] );
+		if ( pending >= MAX_PENDING || command_device[c].used >= MAX_PENDING ){
+			stats.dropped++;
+			return;
+		}
+		e = set_add( &command_device[c], dev );
+	}else if ( e->last == 0 || LONG_TIMEOUT+e->last >= now ){
+		stats.coalesced++;
+		return;
+	}
+
+	e->last = 0;
+	command_pending[c]++;
+	pending++;
+}
+
+static void handle_message( char *p )
+{
+	entry_t *e;
+	char *real;
+
+#if DEBUG
+	printf("CALL RECEIVED %s\n", p);
+#endif
+
+	stats.received++;
+
+	if ( p[0] == 'S' && strlen(p) > 1 ){
+		// scan calls
+		char z[2];
+		int c;
+		z[0] = *(p+1);
+		z[1] = '\0';
+		c = atoi(z);
+		if ( c < NR_COMMANDS )
+			queue_scan( c, p+2 );
+		else
+			stats.dropped++;
+	}
+	else if ( p[0] == 'C' ){
+		if ( pending >= MAX_PENDING ){
+			stats.dropped++;
+			return;
+		}
+		trigger();
+		// config calls
+		if ( lines >= lines_max ){
+			lines_max = lines_max ? lines_max * 2 : 16;
+			commands = realloc( commands, lines_max * sizeof *commands );
+		}
+		commands[lines++] = strdup(p+1);
+		pending++;
+	}
+	else if ( p[0] == 'A' ){
+		// add scan devices
+		if ( set_find(&devices, p+1) ){
+			stats.coalesced++;
+			return;
+		}
+		if ( devices.used >= MAX_PENDING ){
+			stats.dropped++;
+			return;
+		}
+		if ( (real = realpath(p+1, NULL)) ){
+			e = set_add( &devices_real, real );
+			free( e->real );
+			e->real = strdup(p+1);
+		}
+		e = set_add( &devices, p+1 );
+		e->real = real;
+		update_poll_timer();
+		check_device( e );
+	}
+	else if ( p[0] == 'R' ){
+		if ( (e = set_find(&devices, p+1)) && e->real )
+			set_del( &devices_real, e->real );
+		set_del( &devices, p+1 );
+		update_poll_timer();
+	}
+	else
+		stats.dropped++;
+}
+
+// answer 'hwscanqueue --stats'
+static void send_stats( int sock, struct sockaddr_un *addr, socklen_t addr_len )
+{
+	char buf[256];
+
+	snprintf( buf, sizeof buf,
+		"received: %lu\ncoalesced: %lu\ndropped: %lu\nscans: %lu\npending: %u\n",
+		stats.received, stats.coalesced, stats.dropped, stats.scans, pending
+	);
+	sendto( sock, buf, strlen(buf) + 1, MSG_DONTWAIT, (struct sockaddr *) addr, addr_len );
+}
+
+// check all watched devices, e.g. after uevents got lost
+static void check_all_devices( void )
+{
+	unsigned j;
+
+	for ( j=0; j<devices.size; j++ )
+		if ( devices.entry[j].name )
+			check_device( devices.entry + j );
+}
+
+// receive a uevent; only the kernel (port 0, uid 0) may send them
+static ssize_t recv_uevent( int fd, char *buf, size_t size )
+{
+	struct sockaddr_nl nl;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct ucred *cred = NULL;
+	char control[CMSG_SPACE(sizeof (struct ucred))];
+	ssize_t len;
+
+	iov.iov_base = buf;
+	iov.iov_len = size;
+	memset( &msg, 0, sizeof msg );
+	msg.msg_name = &nl;
+	msg.msg_namelen = sizeof nl;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof control;
+
+	len = recvmsg( fd, &msg, 0 );
+	if ( len <= 0 )
+		return len;
+
+	for ( cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg) )
+		if ( cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_CREDENTIALS )
+			cred = (struct ucred *) CMSG_DATA(cmsg);
+
+	if (
+		msg.msg_namelen != sizeof nl || nl.nl_pid != 0 ||
+		!cred || cred->uid != 0 || (msg.msg_flags & MSG_TRUNC)
+	){
+		stats.dropped++;
+		return 0;
+	}
+
+	return len;
+}
+
+// a block device uevent: check the device if we watch it
+static void handle_uevent( char *buf, ssize_t len )
+{
+	char *p, *name = NULL;
+	char dev[PATH_MAX];
+	entry_t *e;
+
+	for ( p = buf; p < buf + len; p += strlen(p) + 1 ){
+		if ( !strncmp(p, "DEVNAME=", 8) )
+			name = p + 8;
+	}
+	if ( !name )
+		return;
+
+	snprintf( dev, sizeof dev, "%s%s", *name == '/' ? "" : "/dev/", name );
+
+#if DEBUG
+	printf("UEVENT %s %s\n", buf, dev);
+#endif
+
+	if ( (e = set_find(&devices, dev)) )
+		check_device( e );
+	else if ( (e = set_find(&devices_real, dev)) && (e = set_find(&devices, e->real)) )
+		check_device( e );
+}
+
+static void run_commands( void )
+{
+	hd_hw_item_t items[NR_COMMANDS + 1];
+	str_list_t *only = NULL;
+	int items_nr = 0;
+	unsigned j;
+	int i;
+
+	// all queued requests go into one scan
+	for ( i=0; i<NR_COMMANDS; i++ ){
+		if ( !command_pending[i] )
+			continue;
+		items[items_nr++] = command_items[i];
+		if ( command_with_device[i] ){
+			for ( j=0; j<command_device[i].size; j++ ){
+				entry_t *e = command_device[i].entry + j;
+				if ( e->name && e->last == 0 ){
+					add_str_list( &only, e->name );
+					e->last = time(0L);
+				}
+			}
+		}else
+			command_last[i] = time(0L);
+		pending -= command_pending[i];
+		command_pending[i] = 0;
+	}
+	items[items_nr] = 0;
+
+	if ( items_nr ){
+		stats.scans++;
+		scan( items, only );
+	}
+
+	if ( lines ){
+		for (i=0; i<lines; i++){
+#if DEBUG
+			printf("CALL DIRECT %s\n", commands[i]);
+#endif
+			if ( !config(commands[i]) )
+				system(commands[i]);
+#if DEBUG
+			printf("CALL quit %s\n", commands[i]);
+#endif
+			free(commands[i]);
+		}
+		pending -= lines;
+		lines=0;
+	}
+}
+
+static int watch( int epfd, int fd )
+{
+	struct epoll_event ev;
+
+	memset( &ev, 0, sizeof ev );
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+
+	return epoll_ctl( epfd, EPOLL_CTL_ADD, fd, &ev );
+}
 
 int main( int argc, char **argv )
 {
-        int ret, i;
-	key_t key = KEY;
-	int msgid;
-	int mode = 0;
-	int dev_nr = 0;
-	int lines = 0;
-	int block, usb, firewire, pci;
-	int dev_last_state[BUFFERS];
-	int dev_counter[BUFFERS];
-	char * command_device[NR_COMMANDS][BUFFERS];
-	time_t command_device_last[NR_COMMANDS][BUFFERS];
-	time_t last;
-	char **commands;
-	char **devices;
+        int ret, i, n;
+	int sock, epfd;
+	struct sockaddr_un addr, from;
+	socklen_t from_len;
+	struct sockaddr_nl nl;
+	struct epoll_event ev[4];
 	char buffer[32];
-	message m;
+	char m[MESSAGE_BUFFER+1];
+	char uevent[8192];
+	uint64_t expired;
+	ssize_t len;
 
 	// are we running already, maybe ?
 	{
@@ -72,183 +663,96 @@ int main( int argc, char **argv )
 	}
 
 	// initialize ...
-	for ( i=0; i<NR_COMMANDS; i++ ){
-		command_device[i][0] = 0;
-		command_device_last[i][0] = 1;
-	}
+	for ( i=0; i<NR_COMMANDS; i++ )
+		command_last[i] = 1;
 
-	last=block=usb=firewire=pci=0;
-	commands = (char**) malloc( BUFFERS * sizeof(char*) );
-	devices  = (char**) malloc( BUFFERS * sizeof(char*) );
+	hd_init();
 
-	msgid = msgget(key, IPC_CREAT | 0600);
-        if (msgid < 0) {
-		perror("msgget");
+	sock = socket( AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0 );
+	memset( &addr, 0, sizeof addr );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, SOCKET_FILE );
+	unlink( SOCKET_FILE );
+	if ( sock < 0 || bind( sock, (struct sockaddr *) &addr, sizeof addr ) ){
+		perror("hwscand: "SOCKET_FILE);
 		exit(1);
-        }
+	}
+	chmod( SOCKET_FILE, S_IRUSR|S_IWUSR );
+
+	epfd     = epoll_create1( EPOLL_CLOEXEC );
+	timer_fd = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC );
+	poll_fd  = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC );
+	if ( epfd < 0 || timer_fd < 0 || poll_fd < 0 ){
+		perror("hwscand");
+		exit(1);
+	}
+
+	// kernel uevents tell us about media changes
+	uevent_fd = socket( AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT );
+	memset( &nl, 0, sizeof nl );
+	nl.nl_family = AF_NETLINK;
+	nl.nl_groups = 1;
+	i = 1;
+	if (
+		uevent_fd >= 0 &&
+		(
+			setsockopt( uevent_fd, SOL_SOCKET, SO_PASSCRED, &i, sizeof i ) ||
+			bind( uevent_fd, (struct sockaddr *) &nl, sizeof nl )
+		)
+	){
+		close( uevent_fd );
+		uevent_fd = -1;
+	}
+
+	watch( epfd, sock );
+	watch( epfd, timer_fd );
+	watch( epfd, poll_fd );
+	if ( uevent_fd >= 0 )
+		watch( epfd, uevent_fd );
 
 	while (1) {
-		if ( last || dev_nr )
-			mode = IPC_NOWAIT;
-		else
-			mode = 0;
-
-		if( msgrcv(msgid, &m, MESSAGE_BUFFER, 1, mode) >= 0 ){
-			char *p = m.mtext;
-
-			if ( p == 0 ){
-				fprintf( stderr, "hwscand: error, zero sized message\n" );
-			}else{
-				if ( p[0] == 'S' && strlen(p) > 1 ){
-					// scan calls
-					char z[2];
-					int c;
-					z[0] = *(p+1);
-					z[1] = '\0';
-					c = atoi(z);
-					if ( c < NR_COMMANDS ){
-						if ( ! command_with_device[c] ){
-							last = time(0L);
-							if ( LONG_TIMEOUT+command_device_last[c][0] < time(0L) )
-								command_device_last[c][0] = 0;
-						}else
-						for ( i=0; i<BUFFERS; i++ ){
-							if ( !command_device[c][i] ){
-								last = time(0L);
-								command_device[c][i] = strdup(p+2);
-								command_device[c][i+1] = 0;
-								command_device_last[c][i] = 0;
-								break;
-							}else if ( !strcmp(command_device[c][i], p+2) ){
-								last = time(0L);
-								if ( LONG_TIMEOUT+command_device_last[c][i] < time(0L) )
-									command_device_last[c][i] = 0;
-								break;
-							}
-						}
-					}
-				}
-				if ( p[0] == 'C' && lines < BUFFERS ){
-					last = time(0L);
-					// config calls
-					commands[lines] = strdup(p+1);
-					lines++;
-				}
-				if ( p[0] == 'A' && dev_nr < BUFFERS ){
-					// add scan devices
-					devices[dev_nr]        = strdup(p+1);
-					dev_last_state[dev_nr] = 0;
-					dev_counter[dev_nr]    = 0;
-					dev_nr++;
-				}
-				if ( p[0] == 'R' && dev_nr < BUFFERS ){
-					for ( i=0; i<dev_nr; i++ ){
-						if ( !strcmp(p+1, devices[i]) ){
-							int j;
-							free(devices[i]);
-							for ( j=i; j+1<dev_nr; j++ ){
-								devices[j]        = devices[j+1];
-								dev_last_state[j] = dev_last_state[j+1];
-								dev_counter[j]    = dev_counter[j+1];
-							}
-							dev_nr--;
-						}
-					}
-				}
-			}
-#if DEBUG
-				printf("CALL RECEIVED %s\n", p);
-#endif
-		}else{
-			// we do this only in scanning mode ...
-
-			sleep(1);
-			for ( i=0; i<dev_nr; i++ ){
-				if (dev_counter[i]<0) continue;
-				dev_counter[i]++;
-				if ( dev_counter[i] > 5 ){
-					int fd;
-					char buf[MESSAGE_BUFFER];
-					dev_counter[i] = 0;
-					fd = open( devices[i], O_RDONLY );
-					strcpy( buf, "/sbin/hwscan --fast --partition --only=");
-					strcat( buf, devices[i] );
-					if ( fd < 0 ){
-						if ( dev_last_state[i] )
-							system(buf);
-						dev_last_state[i] = 0;
-					}else{
-						if ( dev_last_state[i] == 0)
-							system(buf);
-						dev_last_state[i] = 1;
-						close(fd);
-					}
-				}
-			}
+		n = epoll_wait( epfd, ev, sizeof ev / sizeof *ev, -1 );
+		if ( n < 0 ){
+			if ( errno == EINTR )
+				continue;
+			perror("hwscand: epoll_wait");
+			exit(1);
 		}
 
-		if ( last && (last+TIMEOUT <= time(0L)) ){
-			char buf[MESSAGE_BUFFER * NR_COMMANDS];
-			int run_really = 0;
-
-			last=0;
-			strcpy( buf, "/sbin/hwscan --fast --boot --silent" );
-			for ( i=0; i<NR_COMMANDS; i++ ){
-				if ( command_with_device[i] == 0 &&
-				     command_device_last[i][0] == 0 ){
-					command_device_last[i][0] = time(0L);
-					strcat( buf, " --");
-					strcat( buf, command_args[i] );
-				 	run_really = 1;
-				} else {
-					int j;
-					int commappended = 0;
-
-					for ( j=0; j<BUFFERS; j++ ){
-						if ( !command_device[i][j] )
-							break;
-						if ( command_device_last[i][j] == 0 ){
-							if (!commappended) {
-								strcat( buf, " --");
-								strcat( buf, command_args[i] );
-								commappended = 1;
-						        }
-							strcat( buf, " --only=" );
-							strcat( buf, command_device[i][j] );
-							command_device_last[i][j] = time(0L);
-							run_really = 1;
-							if (strlen(buf) > sizeof(buf) - MESSAGE_BUFFER)
-								break;
-						}
-					}
+		for ( i=0; i<n; i++ ){
+			if ( ev[i].data.fd == sock ){
+				from_len = sizeof from;
+				len = recvfrom( sock, m, MESSAGE_BUFFER, 0, (struct sockaddr *) &from, &from_len );
+				if ( len <= 0 ){
+					fprintf( stderr, "hwscand: error, zero sized message\n" );
+					stats.dropped++;
+					continue;
+				}
+				m[len] = '\0';
+				if ( m[0] == 'Q' )
+					send_stats( sock, &from, from_len );
+				else
+					handle_message( m );
+			}
+			else if ( ev[i].data.fd == uevent_fd ){
+				len = recv_uevent( uevent_fd, uevent, sizeof uevent - 1 );
+				if ( len > 0 ){
+					uevent[len] = '\0';
+					handle_uevent( uevent, len );
 				}
-				if (strlen(buf) > sizeof(buf) - MESSAGE_BUFFER) {
-					last = time(0L);	/* call me again */
-					break;
+				else if ( len < 0 && errno == ENOBUFS ){
+					// socket buffer overflowed, events are lost: recheck everything
+					stats.dropped++;
+					check_all_devices();
 				}
 			}
-
-			if ( run_really ){
-#if DEBUG
-				printf("RUN %s\n", buf);
-#endif
-				system(buf);
-#if DEBUG
-				printf("RUN quit %s\n", buf);
-#endif
+			else if ( ev[i].data.fd == poll_fd ){
+				if ( read( poll_fd, &expired, sizeof expired ) > 0 )
+					check_all_devices();
 			}
-			if ( lines ){
-				for (i=0; i<lines; i++){
-#if DEBUG
-				printf("CALL DIRECT %s\n", commands[i]);
-#endif
-					system(commands[i]);
-#if DEBUG
-				printf("CALL quit %s\n", commands[i]);
-#endif
-					free(commands[i]);
-				}
-				lines=0;
+			else if ( ev[i].data.fd == timer_fd ){
+				if ( read( timer_fd, &expired, sizeof expired ) > 0 )
+					run_commands();
 			}
 		}
 	}
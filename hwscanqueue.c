@@ -4,9 +4,12 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -15,13 +18,91 @@
 
 #include "init_message.h"
 
+// is hwscand running ?
+static int hwscand_running( void )
+{
+	ssize_t r;
+	char buffer[1024];
+	char link[1024];
+	int fd = open( PID_FILE, O_RDONLY );
+	if ( fd >= 0 && (r=read(fd,buffer,1023)) > 0 ){
+		close(fd);
+		buffer[r]='\0';
+		snprintf(link, 1023, "/proc/%s/exe", buffer);
+		if ( (r=readlink( link, buffer, 1023 )) > 0 ){
+			buffer[r]='\0';
+			if ( r<8 )
+				fd=-1;
+			else if ( strcmp("/hwscand", buffer+strlen(buffer)-8) )
+				fd=-1;
+		}else
+			fd=-1;
+	}else
+		fd=-1;
+
+	return fd >= 0;
+}
+
+static void start_hwscand( void )
+{
+	pid_t pid;
+	char *args[] = { "/sbin/hwscand", NULL };
+	signal(SIGCHLD,SIG_IGN);
+	pid=fork();
+	if (pid==0){
+		/* Change directory to allow clean shut-down */
+		chdir("/");
+		/* Close std fds */
+		close(0);
+		close(1);
+		close(2);
+		/* Start hwscand */
+		execve(args[0], args, 0);
+		_exit(1);
+	}
+}
+
+// ask hwscand for its event counters
+static int show_stats( void )
+{
+	int sock;
+	ssize_t len;
+	struct sockaddr_un addr;
+	struct timeval timeout = { 2, 0 };
+	char buf[MESSAGE_BUFFER+1];
+
+	sock = socket( AF_UNIX, SOCK_DGRAM, 0 );
+	memset( &addr, 0, sizeof addr );
+	addr.sun_family = AF_UNIX;
+	// autobind, so hwscand can answer
+	if ( sock < 0 || bind( sock, (struct sockaddr *) &addr, sizeof addr.sun_family ) ){
+		perror("unable to init.");
+		return 1;
+	}
+	setsockopt( sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout );
+
+	strcpy( addr.sun_path, SOCKET_FILE );
+	if ( sendto( sock, "Q", 2, 0, (struct sockaddr *) &addr, sizeof addr ) < 0 ){
+		perror("hwscand not running");
+		return 1;
+	}
+	if ( (len = recv( sock, buf, MESSAGE_BUFFER, 0 )) <= 0 ){
+		perror("no answer from hwscand");
+		return 1;
+	}
+	buf[len] = '\0';
+	fputs( buf, stdout );
+
+	return 0;
+}
+
 int main( int argc, char **argv )
 {
-	int ret;
+	int ret, sock, tries;
 	unsigned short i;
-        key_t key = KEY;
-        int msgid;
-	message m;
+	struct sockaddr_un addr;
+	struct timespec wait = { 0, 10*1000000 };
+	struct { char mtext[MESSAGE_BUFFER+1]; } m;
 	char *device = argv[2];
 
 	if ( argc < 2 ){
@@ -36,9 +117,13 @@ int main( int argc, char **argv )
 		fprintf( stderr, "      --avail=yes/no id\n" );
 		fprintf( stderr, "      --scan=device\n" );
 		fprintf( stderr, "      --stop=device\n" );
+		fprintf( stderr, "      --stats\n" );
 		exit(1);
 	}
 
+	if ( !strcmp("--stats", argv[1]) )
+		exit(show_stats());
+
 	if ( !strncmp("--cfg=", argv[1], 6) && argc>2 )
 		snprintf( m.mtext, MESSAGE_BUFFER, "C/sbin/hwscan %s %s", argv[1], argv[2]  );
 	else if ( !strncmp("--avail=", argv[1], 8) && argc>2 )
@@ -71,56 +156,32 @@ int main( int argc, char **argv )
 	}else
 		exit(1);
 
-        if ( (msgid = msgget(key, IPC_CREAT | 0600)) < 0 ){
+	if ( (sock = socket( AF_UNIX, SOCK_DGRAM, 0 )) < 0 ){
 		perror("unable to init.");
-                exit(1);
-        }
-	m.mtype = 1;
-	ret = msgsnd( msgid, &m, MESSAGE_BUFFER, IPC_NOWAIT);
+		exit(1);
+	}
+	memset( &addr, 0, sizeof addr );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, SOCKET_FILE );
+
+	// start hwscand, if it is not yet running, and give it 2s to come up
+	for ( tries = 0; ; tries++ ){
+		ret = sendto( sock, m.mtext, strlen(m.mtext) + 1, 0, (struct sockaddr *) &addr, sizeof addr );
+		if ( ret >= 0 || (errno != ENOENT && errno != ECONNREFUSED) || tries >= 200 )
+			break;
+		if ( !tries && !hwscand_running() )
+			start_hwscand();
+		nanosleep( &wait, NULL );
+	}
 #if DEBUG
 	printf("SEND %s, return %d\n", m.mtext, ret );
 #endif
 
-	if ( ret < 0 )
+	if ( ret < 0 ){
 		perror("message send failed");
-	else{
-		// success ... start hwscand, if it is not yet running
-		ssize_t r;
-		char buffer[1024];
-		char link[1024];
-		int fd = open( PID_FILE, O_RDONLY );
-        	if ( fd >= 0 && (r=read(fd,buffer,1023)) > 0 ){
-			close(fd);
-			buffer[r]='\0';
-			snprintf(link, 1023, "/proc/%s/exe", buffer);
-			if ( (r=readlink( link, buffer, 1023 )) > 0 ){
-				buffer[r]='\0';
-				if ( r<8 )
-					fd=-1;
-				else if ( strcmp("/hwscand", buffer+strlen(buffer)-8) )
-					fd=-1;
-			}else
-				fd=-1;
-		}else
-			fd=-1;
-
-		if ( fd < 0 ){
-			pid_t pid;
-			signal(SIGCHLD,SIG_IGN);
-			pid=fork();
-			if (pid==0){
-				/* Change directory to allow clean shut-down */
-				chdir("/");
-				/* Close std fds */
-				close(0);
-				close(1);
-				close(2);
-				/* Start hwscand */
-				execve("/sbin/hwscand", 0, 0);
-			}
-		}
+		exit(ret);
 	}
 
-	exit(ret);
+	exit(0);
 }
 
@@ -616,7 +616,7 @@ void smbios_get_info(hd_data_t *hd_data, memory_range_t *mem, bios_info_t *bt)
   unsigned use_sysfs = 0;
   char *s;
   memory_range_t memory, memory_sysfs;
-  hd_smbios_t *sm;
+  hd_smbios_t *sm, **sm_next;
 
   // looking for smbios data in 3 places:
 
@@ -749,11 +749,14 @@ void smbios_get_info(hd_data_t *hd_data, memory_range_t *mem, bios_info_t *bt)
     dump_memory(hd_data, &memory, 0, "SMBIOS Structure Table");
   }
 
+  sm_next = &hd_data->smbios;
+
   for(type = 0, u = 0, ofs = 0; (!structs || u < structs) && ofs + 3 < len; u++) {
     type = memory.data[ofs];
     slen = memory.data[ofs + 1];
     if(ofs + slen > len || slen < 4) break;
-    sm = smbios_add_entry(&hd_data->smbios, new_mem(sizeof *sm));
+    sm = smbios_add_entry(sm_next, new_mem(sizeof *sm));
+    sm_next = &sm->next;
     sm->any.type = type;
     sm->any.data_len = slen;
     sm->any.data = new_mem(slen);
@@ -32,6 +32,7 @@ static void add_cdrom_info(hd_data_t *hd_data, hd_t *hd);
 static void add_other_sysfs_info(hd_data_t *hd_data, hd_t *hd);
 static void add_ide_sysfs_info(hd_data_t *hd_data, hd_t *hd);
 static void add_scsi_sysfs_info(hd_data_t *hd_data, hd_t *hd, char *sf_dev);
+static int get_fc_port(char *scsi_id, uint64_t *port_name, unsigned *port_id);
 static void read_partitions(hd_data_t *hd_data);
 static void read_cdroms(hd_data_t *hd_data);
 static cdrom_info_t *new_cdrom_entry(cdrom_info_t **ci);
@@ -102,15 +103,6 @@ void get_block_devs(hd_data_t *hd_data)
   str_list_t *sf_bus, *sf_bus_e;
   char *sf_block_dir;
 
-  hd_data->lsscsi = free_str_list(hd_data->lsscsi);
-  hd_data->lsscsi = read_file("|/usr/bin/lsscsi -t 2>/dev/null", 0, 0);
-
-  ADD2LOG("-----  lsscsi -----\n");
-  for(sl = hd_data->lsscsi; sl; sl = sl->next) {
-    ADD2LOG("  %s", sl->str);
-  }
-  ADD2LOG("-----  lsscsi end -----\n");
-
   sf_bus = read_dir("/sys/bus/ide/devices", 'l');
 
   if(sf_bus) {
@@ -144,6 +136,8 @@ void get_block_devs(hd_data_t *hd_data)
   }
 
   for(sf_class_e = sf_class; sf_class_e; sf_class_e = sf_class_e->next) {
+    if(!hd_sysfs_in_scope(hd_data, hd_read_sysfs_link(sf_block_dir, sf_class_e->str))) continue;
+
     str_printf(&sf_cdev, 0, "%s/%s", sf_block_dir, sf_class_e->str);
     ADD2LOG(
       "  block: name = %s, path = %s\n",
@@ -766,8 +760,6 @@ void add_scsi_sysfs_info(hd_data_t *hd_data, hd_t *hd, char *sf_dev)
   scsi_t *scsi;
   hd_res_t *geo, *size;
   uint64_t ul0;
-  str_list_t *sl;
-  char buf[16];
   hd_res_t *res;
 
   if(!hd_report_this(hd_data, hd)) return;
@@ -909,20 +901,13 @@ void add_scsi_sysfs_info(hd_data_t *hd_data, hd_t *hd, char *sf_dev)
   res = new_mem(sizeof *res);
   res->any.type = res_fc;
 
-  if(hd->sysfs_bus_id) {
-    for(sl = hd_data->lsscsi; sl; sl = sl->next) {
-      if(
-        sscanf(sl->str, "[%15[^]]] %*s fc:%"SCNx64" , %x ", buf, &ul0, &u0) == 3 &&
-        !strcmp(hd->sysfs_bus_id, buf)
-      ) {
-        ADD2LOG("    lsscsi: wwpn = 0x%"PRIx64", port_id = 0x%x\n", ul0, u0);
-        res->fc.wwpn = ul0;
-        res->fc.wwpn_ok = 1;
-        res->fc.port_id = u0;
-        res->fc.port_id_ok = 1;
-        if(hd->sysfs_device_link && strstr(hd->sysfs_device_link, "/net/")) hd->is.fcoe = 1;
-      }
-    }
+  if(hd->sysfs_bus_id && get_fc_port(hd->sysfs_bus_id, &ul0, &u0)) {
+    ADD2LOG("    fc_transport: wwpn = 0x%"PRIx64", port_id = 0x%x\n", ul0, u0);
+    res->fc.wwpn = ul0;
+    res->fc.wwpn_ok = 1;
+    res->fc.port_id = u0;
+    res->fc.port_id_ok = 1;
+    if(hd->sysfs_device_link && strstr(hd->sysfs_device_link, "/net/")) hd->is.fcoe = 1;
   }
 
   /* s390: wwpn & fcp lun */
@@ -1209,6 +1194,37 @@ void add_scsi_sysfs_info(hd_data_t *hd_data, hd_t *hd, char *sf_dev)
 }
 
 
+/*
+ * Get FC port name & id of the target a SCSI device (host:channel:target:lun)
+ * belongs to (what 'lsscsi -t' reports as 'fc:<port_name>,<port_id>').
+ *
+ * Return 1 if found.
+ */
+int get_fc_port(char *scsi_id, uint64_t *port_name, unsigned *port_id)
+{
+  unsigned host, channel, target;
+  uint64_t ul0;
+  char *dir = NULL;
+  int ok = 0;
+
+  if(sscanf(scsi_id, "%u:%u:%u:", &host, &channel, &target) != 3) return 0;
+
+  str_printf(&dir, 0, "/sys/class/fc_transport/target%u:%u:%u", host, channel, target);
+
+  if(
+    hd_attr_uint(get_sysfs_attr_by_path(dir, "port_name"), port_name, 16) &&
+    hd_attr_uint(get_sysfs_attr_by_path(dir, "port_id"), &ul0, 16)
+  ) {
+    *port_id = ul0;
+    ok = 1;
+  }
+
+  free_mem(dir);
+
+  return ok;
+}
+
+
 void read_partitions(hd_data_t *hd_data)
 {
   str_list_t *sl, *sl0, *pl0 = NULL;
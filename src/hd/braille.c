@@ -30,7 +30,7 @@ void hd_scan_braille(hd_data_t *hd_data)
 {
   hd_t *hd, *hd_tmp;
   int cnt = 0;
-  unsigned *dev, *vend;
+  unsigned *dev, *vend, dev0, vend0;
 
   if(!hd_probe_feature(hd_data, pr_braille)) return;
 
@@ -42,9 +42,16 @@ void hd_scan_braille(hd_data_t *hd_data)
   dev = hd_shm_add(hd_data, NULL, sizeof *dev);
   vend = hd_shm_add(hd_data, NULL, sizeof *vend);
 
-  if(!dev || !vend) return;
+  /* no shm: not forking */
+  if(!dev || !vend) {
+    if(!hd_data->flags.nofork) return;
+    dev = &dev0;
+    vend = &vend0;
+  }
 
   for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(hd_timed_out(hd_data)) break;
+
     if(
       hd->base_class.id == bc_comm &&
       hd->sub_class.id == sc_com_ser &&
@@ -126,6 +133,9 @@ void hd_scan_braille(hd_data_t *hd_data)
 /* Communication codes */
 #define BRL_ID	"\033ID="
 
+/* max. time to wait until a write is accepted (in ms) */
+#define WAIT_WRITE	1000
+
 
 #define WAIT_DTR	700000
 #define WAIT_FLUSH	200
@@ -141,7 +151,7 @@ unsigned do_alva(hd_data_t *hd_data, char *dev_name, int cnt)
   PROGRESS(2, cnt, "alva open");
 
   /* Open the Braille display device for random access */
-  fd = open(dev_name, O_RDWR | O_NOCTTY);
+  fd = open(dev_name, O_RDWR | O_NOCTTY | (hd_watched(hd_data) ? O_NONBLOCK : 0));
   if(fd < 0) return 0;
 
   tcgetattr(fd, &oldtio);	/* save current settings */
@@ -174,9 +184,8 @@ unsigned do_alva(hd_data_t *hd_data, char *dev_name, int cnt)
   cfsetispeed(&newtio, B9600);
   cfsetospeed(&newtio, B9600);
   tcsetattr(fd, TCSANOW, &newtio);	/* activate new settings */
-  usleep(WAIT_DTR);			/* give time to send ID string */
-
-  if((i = read(fd, buffer, sizeof buffer)) == sizeof buffer) {
+  /* give time to send ID string */
+  if((i = hd_read_timeout(hd_data, fd, buffer, sizeof buffer, WAIT_DTR / 1000)) == sizeof buffer) {
     if(!strncmp(buffer, BRL_ID, sizeof BRL_ID - 1)) {
       /* Find out which model we are connected to... */
       switch(model = buffer[sizeof buffer - 1])
@@ -201,7 +210,7 @@ unsigned do_alva(hd_data_t *hd_data, char *dev_name, int cnt)
 
   /* reset serial lines */
   tcflush(fd, TCIOFLUSH);
-  tcsetattr(fd, TCSAFLUSH, &oldtio);
+  tcsetattr(fd, hd_watched(hd_data) ? TCSANOW : TCSAFLUSH, &oldtio);
   close(fd);
 
   return dev;
@@ -229,7 +238,7 @@ unsigned do_fhp(hd_data_t *hd_data, char *dev_name, unsigned baud, int cnt)
   PROGRESS(2, cnt, "fhp open");
 
   /* Now open the Braille display device for random access */
-  fd = open(dev_name, O_RDWR | O_NOCTTY);
+  fd = open(dev_name, O_RDWR | O_NOCTTY | (hd_watched(hd_data) ? O_NONBLOCK : 0));
   if(fd < 0) return 0;
 
   tcgetattr(fd, &oldtio);	/* save current settings */
@@ -253,23 +262,21 @@ unsigned do_fhp(hd_data_t *hd_data, char *dev_name, unsigned baud, int cnt)
   crash[3] = 0x200 & 0xff;
   crash[5] = (7+10) & 0xff;
 
-  write(fd, crash, sizeof crash);
-  write(fd, "1111111111",10);
-  write(fd, "\03", 1);
+  hd_write_timeout(hd_data, fd, crash, sizeof crash, WAIT_WRITE);
+  hd_write_timeout(hd_data, fd, "1111111111", 10, WAIT_WRITE);
+  hd_write_timeout(hd_data, fd, "\03", 1, WAIT_WRITE);
 
   crash[2] = 0x0 >> 8;
   crash[3] = 0x0 & 0xff;
   crash[5] = 5 & 0xff;
 
-  write(fd, crash, sizeof crash);
-  write(fd, "1111111111", 10);
-  write(fd, "\03", 1);
-
-  usleep(500000);		/* 100000 should be enough */
+  hd_write_timeout(hd_data, fd, crash, sizeof crash, WAIT_WRITE);
+  hd_write_timeout(hd_data, fd, "1111111111", 10, WAIT_WRITE);
+  hd_write_timeout(hd_data, fd, "\03", 1, WAIT_WRITE);
 
   PROGRESS(4, cnt, "fhp write ok");
 
-  i = read(fd, &buf, 10);
+  i = hd_read_timeout(hd_data, fd, buf, 10, 500);	/* 100 ms should be enough */
 
   PROGRESS(5, cnt, "fhp read done");
 
@@ -297,7 +304,7 @@ unsigned do_fhp(hd_data_t *hd_data, char *dev_name, unsigned baud, int cnt)
 
   /* reset serial lines */
   tcflush(fd, TCIOFLUSH);
-  tcsetattr(fd, TCSAFLUSH, &oldtio);
+  tcsetattr(fd, hd_watched(hd_data) ? TCSANOW : TCSAFLUSH, &oldtio);
   close(fd);
 
   return dev;
@@ -323,7 +330,7 @@ unsigned do_ht(hd_data_t *hd_data, char *dev_name, int cnt)
 
   PROGRESS(2, cnt, "ht open");
 
-  fd = open(dev_name, O_RDWR | O_NOCTTY);
+  fd = open(dev_name, O_RDWR | O_NOCTTY | (hd_watched(hd_data) ? O_NONBLOCK : 0));
   if(fd < 0) return 0;
 
   tcgetattr(fd, &oldtio);
@@ -357,19 +364,17 @@ unsigned do_ht(hd_data_t *hd_data, char *dev_name, int cnt)
 
     PROGRESS(3, cnt, "ht init ok");
 
-    write(fd, &code, 1);	/* reset brl */
-    usleep(40 * 1000);		/* wait for reset */
+    hd_write_timeout(hd_data, fd, &code, 1, WAIT_WRITE);	/* reset brl */
 
     PROGRESS(4, cnt, "ht write ok");
 
-    read(fd, buf, 1);
+    hd_read_timeout(hd_data, fd, buf, 1, 40);	/* wait for reset */
     i = 1;
 
     PROGRESS(5, cnt, "ht read done");
 
     if(buf[0] == 0xfe) {	/* resetok now read id */
-      usleep(80 * 1000);
-      read(fd, buf + 1, 1);
+      hd_read_timeout(hd_data, fd, buf + 1, 1, 80);
       i = 2;
 
       PROGRESS(6, cnt, "ht read done");
@@ -402,7 +407,7 @@ unsigned do_ht(hd_data_t *hd_data, char *dev_name, int cnt)
 
   /* reset serial lines */
   tcflush(fd, TCIOFLUSH);
-  tcsetattr(fd, TCSAFLUSH, &oldtio);
+  tcsetattr(fd, hd_watched(hd_data) ? TCSANOW : TCSAFLUSH, &oldtio);
   close(fd);
 
   return dev;
@@ -432,7 +437,7 @@ unsigned do_baum(hd_data_t *hd_data, char *dev_name, int cnt)
 
   PROGRESS(2, cnt, "baum open");
 
-  fd = open(dev_name, O_RDWR | O_NOCTTY);
+  fd = open(dev_name, O_RDWR | O_NOCTTY | (hd_watched(hd_data) ? O_NONBLOCK : 0));
   if(fd < 0) return 0;
 
   tcgetattr(fd, &curtio);
@@ -452,14 +457,12 @@ unsigned do_baum(hd_data_t *hd_data, char *dev_name, int cnt)
   tcsetattr(fd, TCSAFLUSH, &curtio);
 
   /* write ID-request */
-  write(fd, device_id, sizeof device_id);
-
-  /* wait for response */
-  usleep(250000);
+  hd_write_timeout(hd_data, fd, device_id, sizeof device_id, WAIT_WRITE);
 
   PROGRESS(3, cnt, "baum write ok");
 
-  i = read(fd, buf, sizeof buf - 1);
+  /* wait for response */
+  i = hd_read_timeout(hd_data, fd, buf, sizeof buf - 1, 250);
   buf[sizeof buf - 1] = 0;
 
   PROGRESS(4, cnt, "baum read done");
@@ -470,7 +473,7 @@ unsigned do_baum(hd_data_t *hd_data, char *dev_name, int cnt)
 
   /* reset serial lines */
   tcflush(fd, TCIOFLUSH);
-  tcsetattr(fd, TCSAFLUSH, &oldtio);
+  tcsetattr(fd, hd_watched(hd_data) ? TCSANOW : TCSAFLUSH, &oldtio);
   close(fd);
 
   if(!strcmp(buf + 2, "Baum Vario40")) return MAKE_ID(TAG_SPECIAL, 1);
@@ -493,7 +496,7 @@ unsigned do_fhp_new(hd_data_t *hd_data, char *dev_name, int cnt)
   fd = open(dev_name, O_RDWR | O_NONBLOCK | O_NOCTTY);
   if(fd < 0) return 0;
 
-  fcntl(fd, F_SETFL, 0);	// remove O_NONBLOCK
+  if(!hd_watched(hd_data)) fcntl(fd, F_SETFL, 0);	// remove O_NONBLOCK
 
   tcgetattr(fd, &oldtio);
 
@@ -516,7 +519,7 @@ unsigned do_fhp_new(hd_data_t *hd_data, char *dev_name, int cnt)
      /* init error */
 
     tcflush(fd, TCIOFLUSH);
-    tcsetattr(fd, TCSAFLUSH, &oldtio);
+    tcsetattr(fd, hd_watched(hd_data) ? TCSANOW : TCSAFLUSH, &oldtio);
     close(fd);
 
     return 0;
@@ -536,13 +539,11 @@ unsigned do_fhp_new(hd_data_t *hd_data, char *dev_name, int cnt)
 
   usleep(100 * 1000);
 
-  write(fd, brlauto, sizeof brlauto);
+  hd_write_timeout(hd_data, fd, brlauto, sizeof brlauto, WAIT_WRITE);
 
   PROGRESS(3, cnt, "fhp2 write ok");
 
-  usleep(100 * 1000);
-
-  i = read(fd, retstr, 20);
+  i = hd_read_timeout(hd_data, fd, retstr, 20, 100);
 
   PROGRESS(4, cnt, "fhp2 read done");
 
@@ -571,7 +572,7 @@ unsigned do_fhp_new(hd_data_t *hd_data, char *dev_name, int cnt)
 
   /* reset serial lines */
   tcflush(fd, TCIOFLUSH);
-  tcsetattr(fd, TCSAFLUSH, &oldtio);
+  tcsetattr(fd, hd_watched(hd_data) ? TCSANOW : TCSAFLUSH, &oldtio);
   close(fd);
 
   return id;
@@ -41,12 +41,10 @@ static void link_hal_tree(hd_data_t *hd_data);
 
 static int hal_match_str(hal_prop_t *prop, const char *key, const char *val);
 
-static int check_udi(const char *udi);
-static FILE *hd_open_properties(const char *udi, const char *mode);
+static char *properties_file(const char *udi);
 static char *skip_space(char *s);
 static char *skip_non_eq_or_space(char *s);
 static char *skip_nonquote(char *s);
-static void parse_property(hal_prop_t *prop, char *str);
 
 static void find_udi(hd_data_t *hd_data, hd_t *hd, int match);
 
@@ -500,12 +498,48 @@ int check_udi(const char *udi)
 
 API_SYM int hd_write_properties(const char *udi, hal_prop_t *prop)
 {
-  FILE *f;
-  char *s;
+#ifndef LIBHD_TINY
+  int err;
+
+  if(udi && (err = config_db_write(NULL, udi, prop)) >= 0) return err;
+
+  /* an unfinished list write must not overwrite this one later */
+  config_journal_replay(NULL);
+#endif
+
+  return write_properties_file(udi, prop);
+}
+
+
+/*
+ * Write properties to udi/ directory.
+ *
+ * The file is replaced atomically: it's written to a temporary file that
+ * is synced and then renamed.
+ *
+ * Returns 0 on success.
+ */
+int write_properties_file(const char *udi, hal_prop_t *prop)
+{
+  char *file, *tmp = NULL, *s;
+  FILE *f = NULL;
+  int fd, err;
 
-  f = hd_open_properties(udi, "w");
+  if(!(file = properties_file(udi))) return 1;
 
-  if(!f) return 1;
+  str_printf(&tmp, 0, "%s.XXXXXX", file);
+
+  if((fd = mkstemp(tmp)) == -1 || !(f = fdopen(fd, "w"))) {
+    if(fd != -1) {
+      close(fd);
+      unlink(tmp);
+    }
+    free_mem(tmp);
+    free_mem(file);
+    return 1;
+  }
+
+  fchmod(fd, 0644);
 
   for(; prop; prop = prop->next) {
     if(prop->type == p_invalid) continue;
@@ -513,13 +547,62 @@ API_SYM int hd_write_properties(const char *udi, hal_prop_t *prop)
     if(s) fprintf(f, "%s\n", s);
   }
 
-  fclose(f);
+  err = ferror(f) || fflush(f) || fsync(fd);
+  if(fclose(f)) err = 1;
+
+  if(err || rename(tmp, file)) {
+    unlink(tmp);
+    err = 1;
+  }
+  else {
+    sync_parent_dir(file);
+  }
+
+  free_mem(tmp);
+  free_mem(file);
+
+  return err;
+}
+
+
+/*
+ * Sync the directory containing file, making a rename() durable.
+ */
+void sync_parent_dir(const char *file)
+{
+  char *dir, *s;
+  int fd;
+
+  dir = new_str(file);
+  if((s = strrchr(dir, '/'))) *s = 0;
 
-  return 0;
+  if((fd = open(*dir ? dir : "/", O_RDONLY | O_CLOEXEC)) != -1) {
+    fsync(fd);
+    close(fd);
+  }
+
+  free_mem(dir);
 }
 
 
 API_SYM hal_prop_t *hd_read_properties(const char *udi)
+{
+#ifndef LIBHD_TINY
+  hal_prop_t *prop;
+
+  if(udi && config_db_read(NULL, udi, &prop)) return prop;
+
+  config_journal_replay(NULL);
+#endif
+
+  return read_properties_file(udi);
+}
+
+
+/*
+ * Read properties from udi/ directory.
+ */
+hal_prop_t *read_properties_file(const char *udi)
 {
   char *path = NULL;
   str_list_t *sl0, *sl;
@@ -561,22 +644,27 @@ API_SYM hal_prop_t *hd_read_properties(const char *udi)
 }
 
 
-FILE *hd_open_properties(const char *udi, const char *mode)
+/*
+ * Path of the properties file in udi/ directory; missing subdirectories
+ * are created.
+ *
+ * Returns NULL on failure; free it with free_mem().
+ */
+char *properties_file(const char *udi)
 {
   str_list_t *path, *sl;
   struct stat sbuf;
   char *dir = NULL;
   int err, i;
-  FILE *f = NULL;
 
-  if(!udi) return f;
+  if(!udi) return NULL;
   while(*udi == '/') udi++;
 
-  if(!check_udi(udi)) return f;
+  if(!check_udi(udi)) return NULL;
 
   path = hd_split('/', udi);
 
-  if(!path) return f;
+  if(!path) return NULL;
 
   dir = new_str(hd_get_hddb_path("udi"));
 
@@ -595,12 +683,14 @@ FILE *hd_open_properties(const char *udi, const char *mode)
 
   if(!err) {
     str_printf(&dir, -1, "/%s", sl->str);
-    f = fopen(dir, mode);
+  }
+  else {
+    dir = free_mem(dir);
   }
 
-  free_mem(dir);
+  free_str_list(path);
 
-  return f;
+  return dir;
 }
 
 
@@ -14,11 +14,15 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 #include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <poll.h>
+#include <pthread.h>
 #include <linux/pci.h>
 #include <linux/hdreg.h>
 #define _LINUX_AUDIT_H_
@@ -179,19 +183,80 @@ typedef struct {
 } pr_flags_t;
 
 static pr_flags_t *pr_flags_by_name(char *name);
+
+/*
+ * Lookup tables for hd_data->hd, see hd_index_update().
+ */
+#define HD_INDEX_IDX		0
+#define HD_INDEX_UNIQUE_ID	1
+#define HD_INDEX_SYSFS_ID	2
+#define HD_INDEX_DEV_NAME	3
+#define HD_INDEX_TABLES		4
+
+typedef struct {
+  hd_t *hd;
+  char *key[HD_INDEX_TABLES];		/* string keys at the time they were indexed (NULL: not in table) */
+  unsigned hash[HD_INDEX_TABLES];	/* hash of the key values at that time */
+  unsigned next[HD_INDEX_TABLES];	/* next record in hash chain */
+} hd_index_rec_t;
+
+struct hd_index_s {
+  unsigned size;			/* hash buckets per table, a power of 2 */
+  unsigned count;			/* records; rec[0] is unused */
+  unsigned max;				/* allocated records */
+  enum mod_idx module;			/* probing module the index was built for */
+  hd_t *last;				/* last indexed list entry */
+  hd_t *tail;				/* list tail, not indexed */
+  unsigned *bucket;			/* HD_INDEX_TABLES * size hash chains */
+  hd_index_rec_t *rec;
+};
+
+/*
+ * Entries of hd_data->hd by hw class, see hd_class_index_build().
+ */
+struct hd_class_index_s {
+  unsigned count;			/* entries */
+  unsigned words;			/* bitmap size per hw class */
+  hd_t *first;				/* list head when the index was built */
+  hd_t *last;				/* last list entry when the index was built */
+  hd_t **hd;				/* entries in list order */
+  uint64_t *bits;			/* hw_all * words; bit n set: hd[n] has hw class */
+};
+
+/*
+ * hd_data->udevinfo by sysfs path and by device name, see udev_index_add().
+ */
+#define UDEV_INDEX_SYSFS	0
+#define UDEV_INDEX_NAME		1
+struct hd_udev_index_s {
+  unsigned size;			/* slots per table, a power of 2 */
+  unsigned count;			/* entries */
+  hd_udevinfo_t **slot[2];		/* open addressing, by UDEV_INDEX_SYSFS, UDEV_INDEX_NAME */
+};
 static pr_flags_t *pr_flags_by_id(enum probe_feature feature);
 static int set_probe_val(hd_data_t *hd_data, enum probe_feature feature, char *val);
 static void fix_probe_features(hd_data_t *hd_data);
 static void set_probe_feature(hd_data_t *hd_data, enum probe_feature feature, unsigned val);
-static void free_old_hd_entries(hd_data_t *hd_data);
 static hd_t *free_hd_entry(hd_t *hd);
 static hd_t *add_hd_entry2(hd_t **hd, hd_t *new_hd);
 static void timeout_alarm_handler(int signal);
 static void get_probe_env(hd_data_t *hd_data);
 static void hd_scan_xtra(hd_data_t *hd_data);
-static hd_t *hd_get_device_by_id(hd_data_t *hd_data, char *id);
+static char *hd_index_key(hd_t *hd, int table);
+static unsigned hd_index_hash(int table, unsigned idx, char *key);
+static int hd_index_match(hd_t *hd, int table, unsigned idx, char *key);
+static unsigned *hd_index_chain(struct hd_index_s *index, int table, unsigned idx, char *key);
+static void hd_index_link(struct hd_index_s *index, unsigned n, int table);
+static void hd_index_unlink(struct hd_index_s *index, unsigned n, int table);
+static void hd_index_rehash(struct hd_index_s *index);
+static struct hd_index_s *hd_index_update(hd_data_t *hd_data);
+static hd_t *hd_index_find(hd_data_t *hd_data, int table, unsigned idx, char *key, hd_t *after);
 static int has_item(hd_hw_item_t *items, hd_hw_item_t item);
 static int has_hw_class(hd_t *hd, hd_hw_item_t *items);
+static void hd_class_index_build(hd_data_t *hd_data);
+static void hd_class_index_free(hd_data_t *hd_data);
+static int hd_class_index_ok(hd_data_t *hd_data);
+static int hd_iter_match(hd_data_t *hd_data, hd_iter_t *iter, hd_t *hd);
 static void hd_scan_with_hal(hd_data_t *hd_data);
 static void hd_scan_no_hal(hd_data_t *hd_data);
 
@@ -203,6 +268,7 @@ static int is_pppoe(hd_data_t *hd_data, hd_t *hd);
 static void assign_hw_class(hd_data_t *hd_data, hd_t *hd);
 static void short_vendor(char *vendor);
 static void create_model_name(hd_data_t *hd_data, hd_t *hd);
+static void report_devices(hd_data_t *hd_data, int final);
 
 static void copy_log2shm(hd_data_t *hd_data);
 static void sigchld_handler(int);
@@ -212,11 +278,67 @@ static volatile pid_t child;
 static char *hd_shm_add_str(hd_data_t *hd_data, char *str);
 static str_list_t *hd_shm_add_str_list(hd_data_t *hd_data, str_list_t *sl);
 
-static hd_udevinfo_t *hd_free_udevinfo(hd_udevinfo_t *ui);
-static hd_sysfsdrv_t *hd_free_sysfsdrv(hd_sysfsdrv_t *sf);
+static void read_udevinfo(hd_data_t *hd_data);
+static hd_udevinfo_t *read_udevinfo_dev(hd_data_t *hd_data, char *sysfs_id);
+static void check_udev_links(hd_data_t *hd_data, hd_udevinfo_t *ui);
+static hd_udevinfo_t **udev_index_slot(struct hd_udev_index_s *index, int table, char *key);
+static void udev_index_add(hd_data_t *hd_data, hd_udevinfo_t *ui);
+static void udev_index_free(hd_data_t *hd_data);
+static void hd_free_sysfsdrv(hd_data_t *hd_data);
+static int sysfs_scope_check(hd_data_t *hd_data, char *path, int parents);
 
 static hd_data_t *hd_data_sig;
 
+/*
+ * Result buffers of some helper functions. They are per thread as probing
+ * modules may run concurrently (cf. hd_scan_threaded()).
+ */
+static __thread struct {
+  char *sysfs_link;		/* hd_read_sysfs_link() */
+  char *sysfs_attr;		/* get_sysfs_attr_by_path2() */
+  char *hddb_path;		/* hd_get_hddb_path() */
+  str_list_t *attr_list;	/* hd_attr_list() */
+  char *name2_dev;		/* hd_sysfs_name2_dev() */
+  char *dev2_name;		/* hd_sysfs_dev2_name() */
+} tls_buf;
+
+static pthread_mutex_t progress_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Probing statistics: resource usage is sampled at every progress() call
+ * and accounted to the current probing module and step.
+ */
+struct probe_stats_mark_s {
+  hd_probe_stats_t *mod, *step;	/* what the current interval is accounted to */
+  uint64_t wall, cpu, bytes;
+  unsigned files, children;
+};
+
+/* files opened and child processes started by the file helpers below */
+static __thread struct {
+  unsigned files;
+  unsigned children;
+  uint64_t children_cpu;	/* CPU time of the child processes reaped, in us */
+  uint64_t stats_bytes;		/* bytes read to get the statistics itself */
+} probe_count;
+
+/*
+ * Child processes are reaped with this lock held, so the change of the
+ * process-wide RUSAGE_CHILDREN meanwhile is the CPU time of that child
+ * alone (cf. reap_start()).
+ */
+static pthread_mutex_t reap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void probe_stats_mark(hd_data_t *hd_data, char *step, char *info);
+static void probe_stats_sample(struct probe_stats_mark_s *m);
+static hd_probe_stats_t *probe_stats_get(hd_probe_stats_t **list, char *name, char *info, unsigned module);
+static void probe_stats_add(hd_probe_stats_t *st, hd_probe_stats_t *st_add);
+static void probe_stats_merge(hd_probe_stats_t **list, hd_probe_stats_t *list_add);
+static hd_probe_stats_t *free_probe_stats(hd_probe_stats_t *st);
+static uint64_t reap_start(void);
+static void reap_end(uint64_t cpu);
+static uint64_t children_cpu(void);
+
 /*
  * Names of the probing modules.
  * Cf. enum mod_idx in hd_int.h.
@@ -359,6 +481,8 @@ static pr_flags_t pr_flags[] = {
   { pr_hal,           0,                  0, "hal",          p_bool },
   { pr_modules_pata,  0,                  0, "modules.pata", p_bool },
   { pr_x86emu,        0,                  0, "x86emu",       p_list },
+  { pr_threads,       0,                  0, "threads",      p_bool },
+  { pr_watchdog,      0,                  0, "watchdog",     p_bool },
 };
 
 
@@ -984,6 +1108,9 @@ API_SYM hd_data_t *hd_free_hd_data(hd_data_t *hd_data)
   unsigned u;
 
   add_hd_entry2(&hd_data->old_hd, hd_data->hd); hd_data->hd = NULL;
+  hd_data->last_hd = NULL;
+  hd_index_reset(hd_data);
+  hd_log_flush(hd_data);
   hd_data->log = free_mem(hd_data->log);
   free_old_hd_entries(hd_data);		/* hd_data->old_hd */
   /* hd_data->pci is always NULL */
@@ -1010,15 +1137,22 @@ API_SYM hd_data_t *hd_free_hd_data(hd_data_t *hd_data)
     }
   }
   hd_data->modinfo = free_mem(hd_data->modinfo);
+  hd_data->modinfo_index = free_mem(hd_data->modinfo_index);
   if((p = hd_data->modinfo_ext)) {
     for(; p->type; p++) free_mem(p->module);
   }
   hd_data->modinfo = free_mem(hd_data->modinfo_ext);
 
   if(hd_data->hddb2[0]) {
-    free_mem(hd_data->hddb2[0]->list);
-    free_mem(hd_data->hddb2[0]->ids); 
-    free_mem(hd_data->hddb2[0]->strings);
+    if(hd_data->hddb2[0]->map) {
+      munmap(hd_data->hddb2[0]->map, hd_data->hddb2[0]->map_size);
+    }
+    else {
+      free_mem(hd_data->hddb2[0]->list);
+      free_mem(hd_data->hddb2[0]->ids);
+      free_mem(hd_data->hddb2[0]->strings);
+    }
+    free_mem(hd_data->hddb2[0]->index);
     hd_data->hddb2[0] = free_mem(hd_data->hddb2[0]);
   }
   /* hddb2[1] is the static internal database; don't try to free it! */
@@ -1048,8 +1182,11 @@ API_SYM hd_data_t *hd_free_hd_data(hd_data_t *hd_data)
 
   hd_data->smbios = smbios_free(hd_data->smbios);
 
-  hd_data->udevinfo = hd_free_udevinfo(hd_data->udevinfo);
-  hd_data->sysfsdrv = hd_free_sysfsdrv(hd_data->sysfsdrv);
+  hd_data->udevinfo = NULL;
+  hd_data->udev_db = 0;
+  udev_index_free(hd_data);
+  hd_data->arena = arena_free(hd_data->arena);
+  hd_free_sysfsdrv(hd_data);
 
   hd_data->only = free_str_list(hd_data->only);
   hd_data->scanner_db = free_str_list(hd_data->scanner_db);
@@ -1060,10 +1197,15 @@ API_SYM hd_data_t *hd_free_hd_data(hd_data_t *hd_data)
 
   hd_data->hal = hd_free_hal_devices(hd_data->hal);
 
-  hd_data->lsscsi = free_str_list(hd_data->lsscsi);
-
   hd_data->probe_val = hd_free_hal_properties(hd_data->probe_val);
 
+  hd_data->stats = free_probe_stats(hd_data->stats);
+  hd_data->stats_mark = free_mem(hd_data->stats_mark);
+  hd_data->probe_fp = free_mem(hd_data->probe_fp);
+#ifndef LIBHD_TINY
+  hd_data->config_db = config_db_free(hd_data->config_db);
+#endif
+
   hd_data->last_idx = 0;
 
   hd_shm_done(hd_data);
@@ -1525,8 +1667,11 @@ API_SYM hd_manual_t *hd_free_manual(hd_manual_t *manual)
 
 /*
  * Removes all hd_data->old_hd entries and frees their memory.
+ *
+ * Entries end up there when a rescan replaces them; lists returned by
+ * hd_list() may still point to them.
  */
-void free_old_hd_entries(hd_data_t *hd_data)
+API_SYM void free_old_hd_entries(hd_data_t *hd_data)
 {
   hd_t *hd, *next;
 
@@ -1560,6 +1705,133 @@ void *new_mem(size_t size)
   return 0;
 }
 
+/*
+ * Memory arena: many small objects with a common lifetime.
+ *
+ * Memory is handed out from HD_ARENA_BLOCK sized blocks and released all
+ * at once with arena_free(). Never free_mem() or realloc anything you got
+ * from here.
+ *
+ * hd_t entries and their strings and resources stay on malloc: they are
+ * removed one by one (remove_hd_entries(), hd_free_hd_list()) and may be
+ * kept and freed by library users. So do short-lived temporaries like
+ * read_dir() and read_file() lists or sysfs path strings: they are freed
+ * right after use and would only pile up in an arena until the next scan.
+ */
+struct hd_arena_s {
+  struct hd_arena_s *next;	/* further blocks */
+  size_t size;			/* usable size */
+  size_t used;
+  unsigned char *data;
+};
+
+
+/*
+ * Allocate size bytes (zeroed) from *arena; *arena may be NULL.
+ */
+void *arena_alloc(hd_arena_t **arena, size_t size)
+{
+  hd_arena_t *a = *arena;
+  size_t block;
+  void *p;
+
+  size = (size + 15) & ~(size_t) 15;
+
+  if(!a || a->used + size > a->size) {
+    block = size > HD_ARENA_BLOCK / 4 ? size : HD_ARENA_BLOCK;
+    a = new_mem(sizeof *a + block);
+    a->size = block;
+    a->data = (unsigned char *) (a + 1);
+
+    if(*arena && block != HD_ARENA_BLOCK) {
+      /* large object: keep using the current block */
+      a->next = (*arena)->next;
+      (*arena)->next = a;
+    }
+    else {
+      a->next = *arena;
+      *arena = a;
+    }
+  }
+
+  p = a->data + a->used;
+  a->used += size;
+
+  return p;
+}
+
+
+/*
+ * Copy string to *arena.
+ */
+char *arena_str(hd_arena_t **arena, const char *s)
+{
+  size_t len;
+
+  if(!s) return NULL;
+
+  len = strlen(s) + 1;
+
+  return memcpy(arena_alloc(arena, len), s, len);
+}
+
+
+/*
+ * Like add_str_list(), but list entry and string are allocated from *arena.
+ *
+ * *last points to the 'next' pointer of the last list entry (or to the
+ * list head if the list is empty) and is advanced to the new entry.
+ */
+str_list_t *arena_add_str_list(hd_arena_t **arena, str_list_t ***last, char *str)
+{
+  str_list_t *sl;
+
+  sl = **last = arena_alloc(arena, sizeof *sl);
+  sl->str = arena_str(arena, str);
+  *last = &sl->next;
+
+  return sl;
+}
+
+
+/*
+ * Release all memory of arena.
+ */
+hd_arena_t *arena_free(hd_arena_t *arena)
+{
+  hd_arena_t *next;
+
+  for(; arena; arena = next) {
+    next = arena->next;
+    free_mem(arena);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Move all memory of arena2 to *arena.
+ */
+void arena_join(hd_arena_t **arena, hd_arena_t *arena2)
+{
+  hd_arena_t *a;
+
+  if(!arena2) return;
+
+  if(!*arena) {
+    *arena = arena2;
+
+    return;
+  }
+
+  /* keep allocating from the current block */
+  for(a = arena2; a->next; a = a->next);
+  a->next = (*arena)->next;
+  (*arena)->next = arena2;
+}
+
+
 void *resize_mem(void *p, size_t n)
 {
   p = realloc(p, n);
@@ -1790,7 +2062,12 @@ API_SYM hd_t *hd_add_hd_entry(hd_data_t *hd_data, unsigned line, unsigned count)
 {
   hd_t *hd;
 
-  hd = add_hd_entry2(&hd_data->hd, new_mem(sizeof *hd));
+  /* entries are appended; start at the last one we added */
+  hd = add_hd_entry2(
+    hd_data->hd && hd_data->last_hd ? &hd_data->last_hd->next : &hd_data->hd,
+    new_mem(sizeof *hd)
+  );
+  hd_data->last_hd = hd;
 
   hd->idx = ++(hd_data->last_idx);
   hd->module = hd_data->module;
@@ -1818,6 +2095,13 @@ API_SYM void hd_scan(hd_data_t *hd_data)
   str_list_t *sl, *sl0;
   pr_flags_t *pf;
 
+  /* data from the last scan */
+  hd_data->udevinfo = NULL;
+  hd_data->udev_db = 0;
+  udev_index_free(hd_data);
+  hd_data->arena = arena_free(hd_data->arena);
+  hd_class_index_free(hd_data);
+
   if(!hd_data->flags.internal) {
   /* log debug & probe flags */
     if(hd_data->debug) {
@@ -1841,6 +2125,8 @@ API_SYM void hd_scan(hd_data_t *hd_data)
   if(hd_data->last_idx == 0) {
     hd_set_probe_feature(hd_data, pr_fork);
     if(!hd_probe_feature(hd_data, pr_fork)) hd_data->flags.nofork = 1;
+    /* hd_scan_watched() runs the steps that used to fork */
+    if(hd_probe_feature(hd_data, pr_watchdog)) hd_data->flags.nofork = 1;
 //    hd_set_probe_feature(hd_data, pr_sysfs);
     if(!hd_probe_feature(hd_data, pr_sysfs)) hd_data->flags.nosysfs = 1;
     hd_set_probe_feature(hd_data, pr_cpuemu);
@@ -1929,6 +2215,9 @@ API_SYM void hd_scan(hd_data_t *hd_data)
   /* and again... */
   for(hd = hd_data->hd; hd; hd = hd->next) hd_add_id(hd_data, hd);
 
+  /* unique ids have changed */
+  hd_index_reset(hd_data);
+
   /* assign parent & child ids */
   for(hd = hd_data->hd; hd; hd = hd->next) {
     hd->child_ids = free_str_list(hd->child_ids);
@@ -1944,12 +2233,20 @@ API_SYM void hd_scan(hd_data_t *hd_data)
     }
   }
 
+  /* prepend and reverse afterwards; children can be many */
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if((hd2 = hd_get_device_by_idx(hd_data, hd->attached_to))) {
-      add_str_list(&hd2->child_ids, hd->unique_id);
+      sl = new_mem(sizeof *sl);
+      sl->str = new_str(hd->unique_id);
+      sl->next = hd2->child_ids;
+      hd2->child_ids = sl;
     }
   }
 
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    hd->child_ids = reverse_str_list(hd->child_ids);
+  }
+
   /* assign a hw_class & build a useful model string */
   for(hd = hd_data->hd; hd; hd = hd->next) {
     assign_hw_class(hd_data, hd);
@@ -1968,6 +2265,10 @@ API_SYM void hd_scan(hd_data_t *hd_data)
 
   hd_data->module = mod_none;
 
+  hd_class_index_build(hd_data);
+
+  report_devices(hd_data, 1);
+
   if(hd_data->debug && !hd_data->flags.internal && hd_data->klog) {
     dump_klog(hd_data);
   }
@@ -2003,6 +2304,10 @@ API_SYM void hd_scan(hd_data_t *hd_data)
     }
     ADD2LOG("\n");
   }
+
+  if(hd_data->flags.stats) probe_stats_mark(hd_data, NULL, NULL);
+
+  hd_log_flush(hd_data);
 }
 
 
@@ -2021,109 +2326,271 @@ void hd_scan_with_hal(hd_data_t *hd_data)
 }
 
 
-void hd_scan_no_hal(hd_data_t *hd_data)
-{
-  hd_t *hd;
+/*
+ * Probing steps of hd_scan_no_hal().
+ * Cf. probe_steps[].
+ */
+enum probe_step {
+  ps_floppy, ps_bios, ps_sys, ps_misc, ps_cpu, ps_memory, ps_pci, ps_prom,
+  ps_s390disks, ps_s390, ps_monitor, ps_isapnp, ps_isa, ps_pcmcia, ps_serial,
+  ps_misc2, ps_parallel, ps_block, ps_scsi, ps_usb, ps_edd, ps_braille,
+  ps_modem, ps_mouse, ps_sbus, ps_input, ps_kbd, ps_fb, ps_net, ps_pppoe,
+  ps_wlan
+};
 
-  /*
-   * for various reasons, do it befor scan_misc()
-   */
-  hd_scan_floppy(hd_data);
+#define PS(a)	(1ull << ps_##a)
 
-  /*
-   * to be able to read the right parport io,
-   * we have to do this before scan_misc()
-   */
-#if defined(__i386__) || defined (__x86_64__) || defined (__ia64__)
-  hd_scan_bios(hd_data);
+#ifndef LIBHD_TINY
+static void scan_parallel(hd_data_t *hd_data);
 #endif
-  
-  /* before hd_scan_misc(): we need some ppc info later */
-  hd_scan_sys(hd_data);
-
-  /* get basic system info */
-  hd_scan_misc(hd_data);
-
-  /* hd_scan_cpu() after hd_scan_misc(): klog needed */
-  hd_scan_cpu(hd_data);
-  hd_scan_memory(hd_data);
 
-  hd_scan_sysfs_pci(hd_data);
-
-  /* do it _after_ hd_scan_sysfs_pci() */
+/*
+ * The probing modules in the order they are run.
+ *
+ * deps: the steps that must have finished before this one may start.
+ *
+ * threads: the step may run concurrently with other steps (cf.
+ *   hd_scan_threaded()). It works on copies of the existing entries: it
+ *   may change their fields (new strings, lists, etc. get attached to the
+ *   entry and the old ones are left alone), but must not change or free
+ *   anything they point to. hd_data->flags.worker is set then.
+ *
+ * link: with threads, the part of the step that does change data of
+ *   other entries in place; it is run in the main thread once the step
+ *   has been merged.
+ *
+ * timeout, total_timeout: the step may hang; with the 'watchdog' probe
+ *   feature it runs in-process and its serial I/O gives up after
+ *   total_timeout seconds or if there is no progress for timeout
+ *   seconds (cf. hd_scan_watched()).
+ */
+static struct probe_step_s {
+  enum probe_step step;
+  enum mod_idx mod;
+  void (*scan)(hd_data_t *hd_data);
+  uint64_t deps;
+  unsigned threads:1;
+  unsigned timeout;
+  unsigned total_timeout;
+  void (*link)(hd_data_t *hd_data);
+} probe_steps[] = {
+  { ps_floppy, mod_floppy, hd_scan_floppy, 0, 1 },
+#if defined(__i386__) || defined (__x86_64__) || defined (__ia64__)
+  { ps_bios, mod_bios, hd_scan_bios, 0, 1 },
+#endif
+  { ps_sys, mod_sys, hd_scan_sys, 0, 1 },
+  /* for various reasons, after floppy; needs parport io from bios & ppc info from sys */
+  { ps_misc, mod_misc, hd_scan_misc, PS(floppy) | PS(bios) | PS(sys), 0 },
+  /* klog needed */
+  { ps_cpu, mod_cpu, hd_scan_cpu, PS(misc), 1 },
+  { ps_memory, mod_memory, hd_scan_memory, PS(misc), 1 },
+  { ps_pci, mod_pci, hd_scan_sysfs_pci, PS(misc), 1 },
 #if defined(__PPC__)
-  hd_scan_prom(hd_data);
+  { ps_prom, mod_prom, hd_scan_prom, PS(pci), 0 },
 #endif
-
 #if defined(__s390__) || defined(__s390x__)
-  hd_scan_s390disks(hd_data);
-  hd_scan_s390(hd_data);
+  { ps_s390disks, mod_s390, hd_scan_s390disks, PS(pci), 0 },
+  { ps_s390, mod_s390, hd_scan_s390, PS(s390disks), 0 },
 #endif
-
-  /* after hd_scan_prom() and hd_scan_bios() */
-  hd_scan_monitor(hd_data);
-
+  { ps_monitor, mod_monitor, hd_scan_monitor, PS(prom) | PS(bios), 0 },
 #ifndef LIBHD_TINY
 #if defined(__i386__) || defined(__alpha__)
-  hd_scan_isapnp(hd_data);
+  { ps_isapnp, mod_isapnp, hd_scan_isapnp, PS(pci), 0 },
 #endif
-#endif
-
-#ifndef LIBHD_TINY
 #if defined(__i386__)
-  hd_scan_isa(hd_data);
+  { ps_isa, mod_isa, hd_scan_isa, PS(isapnp), 0 },
 #endif
 #endif
-
-  /* after pci & isa */
-  hd_scan_pcmcia(hd_data);
-
-  /* after pci */
-  hd_scan_serial(hd_data);
-
+  { ps_pcmcia, mod_pcmcia, hd_scan_pcmcia, PS(pci) | PS(isa), 0 },
+  { ps_serial, mod_serial, hd_scan_serial, PS(pci), 0 },
   /* merge basic system info & the easy stuff */
-  hd_scan_misc2(hd_data);
-
+  { ps_misc2, mod_misc, hd_scan_misc2, PS(misc) | PS(serial) | PS(pcmcia), 0 },
 #ifndef LIBHD_TINY
-  if(!hd_data->flags.no_parport) {
-    hd_scan_parallel(hd_data);	/* after hd_scan_misc*() */
-  }
+  { ps_parallel, mod_parallel, scan_parallel, PS(misc2), 0 },
 #endif
-
-  hd_scan_sysfs_block(hd_data);
-  hd_scan_sysfs_scsi(hd_data);
-  hd_scan_sysfs_usb(hd_data);
+  { ps_block, mod_block, hd_scan_sysfs_block, PS(pci), 1 },
+  { ps_scsi, mod_scsi, hd_scan_sysfs_scsi, PS(block), 1 },
+  { ps_usb, mod_usb, hd_scan_sysfs_usb, PS(pci), 1, .link = hd_scan_sysfs_usb_link },
 #if defined(__i386__) || defined(__x86_64__)
-  hd_scan_sysfs_edd(hd_data);
+  { ps_edd, mod_edd, hd_scan_sysfs_edd, PS(block) | PS(bios), 1 },
 #endif
-
 #ifndef LIBHD_TINY
 #if !defined(__sparc__)
-  hd_scan_braille(hd_data);
+  { ps_braille, mod_braille, hd_scan_braille, PS(serial), 0, 10, 60 },
 #endif
-  hd_scan_modem(hd_data);	/* do it before hd_scan_mouse() */
-  hd_scan_mouse(hd_data);
+  /* before mouse */
+  { ps_modem, mod_modem, hd_scan_modem, PS(serial) | PS(usb), 0, 15, 120 },
+  { ps_mouse, mod_mouse, hd_scan_mouse, PS(modem) | PS(usb), 0, 20, 20 },
 #endif
-  hd_scan_sbus(hd_data);
-
-  hd_scan_input(hd_data);
-
+  { ps_sbus, mod_sbus, hd_scan_sbus, PS(misc), 0 },
+  { ps_input, mod_input, hd_scan_input, PS(usb), 1, .link = hd_scan_input_link },
 #if !defined(__s390__) && !defined(__s390x__)
-  hd_scan_kbd(hd_data);
+  { ps_kbd, mod_kbd, hd_scan_kbd, PS(serial) | PS(usb), 1 },
+#endif
+  /* after monitor */
+  { ps_fb, mod_fb, hd_scan_fb, PS(monitor), 1 },
+  /* keep these at the end of the list */
+  { ps_net, mod_net, hd_scan_net, PS(pci) | PS(usb) | PS(pcmcia), 1, .link = hd_scan_net_link },
+  { ps_pppoe, mod_pppoe, hd_scan_pppoe, PS(net), 0 },
+#ifndef LIBHD_TINY
+  { ps_wlan, mod_wlan, hd_scan_wlan, PS(net), 0 },
 #endif
+};
 
-  /* must be after hd_scan_monitor() */
-  hd_scan_fb(hd_data);
 
-  /* keep these at the end of the list */
-  hd_scan_net(hd_data);
+/*
+ * What the sysfs based probing modules look at (cf. flags.incremental).
+ *
+ * A module is not run again if none of these have changed since its last
+ * run: the entries in dirs (including link target, driver and attr), the
+ * content of files, /proc/modules and the probe features.
+ *
+ * deps: steps that change entries of this one (and vice versa); if one of
+ *   them is run, this one has to be run, too.
+ */
+struct probe_fp_s {
+  uint64_t valid;			/* steps with a fingerprint */
+  uint64_t fp[64];			/* indexed by enum probe_step */
+};
+
+static struct probe_fp_src_s {
+  enum probe_step step;
+  enum probe_feature feature;
+  uint64_t deps;
+  char *attr;
+  char **dirs;
+  char **files;
+} probe_fp_src[] = {
+  {
+    ps_pci, pr_pci, 0, "status",
+    (char *[]) {
+      "/sys/bus/pci/devices", "/sys/bus/macio/devices", "/sys/bus/vio/devices",
+      "/sys/bus/xen/devices", "/sys/bus/ps3_system_bus/devices", "/sys/bus/platform/devices",
+      "/sys/bus/of_platform/devices", "/sys/bus/vmbus/devices", "/sys/bus/virtio/devices",
+      "/sys/bus/ibmebus/devices", "/sys/bus/uisvirtpci/devices", "/sys/bus/mmc/devices",
+      "/sys/bus/sdio/devices", "/sys/bus/nd/devices", "/sys/bus/visorbus/devices",
+      "/sys/bus/mdio_bus/devices", "/sys/class/drm", NULL
+    },
+    (char *[]) { NULL }
+  },
+  {
+    ps_block, pr_block, PS(pci) | PS(scsi) | PS(usb), "size",
+    (char *[]) { "/sys/class/block", "/sys/bus/ide/devices", NULL },
+    (char *[]) { PROC_PARTITIONS, PROC_CDROM_INFO, NULL }
+  },
+  {
+    ps_scsi, pr_scsi, PS(pci) | PS(block) | PS(usb), NULL,
+    (char *[]) { "/sys/class/scsi_tape", "/sys/class/scsi_generic", NULL },
+    (char *[]) { NULL }
+  },
+  {
+    ps_usb, pr_usb, PS(pci) | PS(block) | PS(scsi), NULL,
+    (char *[]) { "/sys/bus/usb/devices", "/sys/class/usb", "/sys/class/usb_endpoint", "/sys/class/input", "/sys/class/tty", NULL },
+    (char *[]) { NULL }
+  },
+  {
+    ps_input, pr_input, PS(pci) | PS(usb), NULL,
+    (char *[]) { NULL },
+    (char *[]) { "/proc/bus/input/devices", NULL }
+  },
+  {
+    ps_net, pr_net, PS(pci) | PS(usb), "carrier",
+    (char *[]) { "/sys/class/net", NULL },
+    (char *[]) { NULL }
+  },
+};
+
+static uint64_t probe_fp_update(hd_data_t *hd_data);
+static void probe_fp_dir(uint64_t *id, char *dir, char *attr);
+static void probe_fp_file(uint64_t *id, char *name);
+
+
+/*
+ * A probing step run in a separate thread.
+ *
+ * The thread works on a copy of hd_data; its view of the device list
+ * is a private copy of the entries known at dispatch time.
+ */
+typedef struct {
+  struct probe_step_s *step;
+  pthread_t thread;
+  unsigned started:1;
+  unsigned joined:1;
+  unsigned own_kmods:1;
+  unsigned own_udev:1;
+  unsigned hd_cnt;
+  hd_t **hd_orig;		/* entries at dispatch time */
+  hd_t *hd_copy;		/* hd_cnt copies of them, used by the thread */
+  hd_t *hd_base;		/* hd_cnt copies of them, left unchanged */
+  hd_data_t base;		/* hd_data at dispatch time */
+  hd_data_t data;		/* the thread's hd_data */
+} probe_worker_t;
+
+/*
+ * The threads that have been started but not yet merged, in table order.
+ */
+typedef struct {
+  probe_worker_t *list[sizeof probe_steps / sizeof *probe_steps];
+  unsigned first, last;
+  uint64_t steps;		/* steps in list[first .. last - 1] */
+} probe_queue_t;
+
+static probe_worker_t *probe_worker_start(hd_data_t *hd_data, struct probe_step_s *ps);
+static void *probe_worker(void *arg);
+static void probe_worker_join(probe_worker_t *pw);
+static int probe_worker_merge(hd_data_t *hd_data, probe_worker_t *pw);
+static void probe_worker_free(probe_worker_t *pw);
+static int merge3(void *cur, void *base, void *new, size_t size, const size_t *bits, int apply);
+static void probe_queue_merge(hd_data_t *hd_data, probe_queue_t *queue);
+static void hd_scan_threaded(hd_data_t *hd_data, uint64_t skip);
+static void hd_scan_step(hd_data_t *hd_data, struct probe_step_s *ps);
+static void hd_scan_watched(hd_data_t *hd_data, struct probe_step_s *ps);
+static uint64_t io_clock(void);
+static int io_wait(hd_data_t *hd_data, int fd, short events, int ms);
 
-  hd_scan_pppoe(hd_data);
 
 #ifndef LIBHD_TINY
-  hd_scan_wlan(hd_data);
+void scan_parallel(hd_data_t *hd_data)
+{
+  if(!hd_data->flags.no_parport) {
+    hd_scan_parallel(hd_data);	/* after hd_scan_misc*() */
+  }
+}
 #endif
 
+
+void hd_scan_no_hal(hd_data_t *hd_data)
+{
+  hd_t *hd;
+  unsigned u, last_idx = hd_data->last_idx;
+  uint64_t skip = 0;
+
+  if(hd_data->flags.incremental && !hd_data->sysfs_scope) {
+    skip = probe_fp_update(hd_data);
+  }
+  else if(hd_data->probe_fp) {
+    hd_data->probe_fp->valid = 0;
+  }
+
+  if(hd_probe_feature(hd_data, pr_threads)) {
+    hd_scan_threaded(hd_data, skip);
+  }
+  else {
+    for(u = 0; u < sizeof probe_steps / sizeof *probe_steps; u++) {
+      if(skip & (1ull << probe_steps[u].step)) continue;
+      hd_scan_step(hd_data, probe_steps + u);
+      report_devices(hd_data, 0);
+    }
+  }
+
+  /* hd_scan_sysfs_path(): drop new entries outside the subtree and its parents */
+  if(hd_data->sysfs_scope) {
+    for(hd = hd_data->hd; hd; hd = hd->next) {
+      if(hd->idx > last_idx && !hd_entry_in_scope(hd_data, hd, 1)) hd->tag.remove = 1;
+    }
+    remove_tagged_hd_entries(hd_data);
+  }
+
   for(hd = hd_data->hd; hd; hd = hd->next) hd_add_id(hd_data, hd);
 
   hd_scan_hal_assign_udi(hd_data);
@@ -2145,69 +2612,651 @@ void hd_scan_no_hal(hd_data_t *hd_data)
 
 
 /*
- * Note: due to byte order problems decoding the id is really a mess...
- * And, we use upper case for hex numbers!
+ * Run probe_steps[], using threads where possible.
+ *
+ * A step that may run in a thread is started as soon as the steps it
+ * depends on have been merged; all other steps run alone. Results are
+ * merged in table order, so the device list and the entry numbering come
+ * out as if the steps had run one after another.
  */
-char *isa_id2str(unsigned id)
+void hd_scan_threaded(hd_data_t *hd_data, uint64_t skip)
 {
-  char *s = new_mem(8);
-  unsigned u = ((id & 0xff) << 8) + ((id >> 8) & 0xff);
-  unsigned v = ((id >> 8) & 0xff00) + ((id >> 24) & 0xff);
-
-  s[0] = ((u >> 10) & 0x1f) + 'A' - 1;
-  s[1] = ((u >>  5) & 0x1f) + 'A' - 1;
-  s[2] = ( u        & 0x1f) + 'A' - 1;
+  probe_queue_t queue = {};
+  struct probe_step_s *ps;
+  unsigned u;
+  hd_t *hd;
 
-  sprintf(s + 3, "%04X", v);
+  for(u = 0; u < sizeof probe_steps / sizeof *probe_steps; u++) {
+    ps = probe_steps + u;
 
-  return s;
-}
+    if(skip & (1ull << ps->step)) continue;
 
-char *eisa_vendor_str(unsigned v)
-{
-  static char s[4];
+    /* when rescanning, the step removes its old entries; leave that to the serial code */
+    hd = NULL;
+    if(ps->threads) {
+      for(hd = hd_data->hd; hd; hd = hd->next) if(hd->module == ps->mod) break;
+    }
 
-  s[0] = ((v >> 10) & 0x1f) + 'A' - 1;
-  s[1] = ((v >>  5) & 0x1f) + 'A' - 1;
-  s[2] = ( v        & 0x1f) + 'A' - 1;
-  s[3] = 0;
+    if(ps->threads && !hd) {
+      while(ps->deps & queue.steps) probe_queue_merge(hd_data, &queue);
 
-  return s;
-}
+      if(queue.first == queue.last) {
+        /* set up shared data the steps would otherwise read on demand */
+        if(!hd_data->klog) read_klog(hd_data);
+        hd_sysfs_driver_list(hd_data);
+        hd_get_udevinfo(hd_data, NULL);
+      }
 
+      /* the threads keep their own statistics */
+      if(hd_data->flags.stats) probe_stats_mark(hd_data, NULL, NULL);
 
-/*
- *  Must _not_ check that s is exactly 3 chars.
- */
-API_SYM unsigned hd_name2eisa_id(char *s)
-{
-  int i;
-  unsigned u = 0;
+      queue.list[queue.last++] = probe_worker_start(hd_data, ps);
+      queue.steps |= 1ull << ps->step;
+    }
+    else {
+      while(queue.first < queue.last) probe_queue_merge(hd_data, &queue);
 
-  for(i = 0; i < 3; i++) {
-    u <<= 5;
-    if(s[i] < 'A' - 1 || s[i] > 'A' - 1 + 0x1f) return 0;
-    u += s[i] - 'A' + 1;
+      hd_scan_step(hd_data, ps);
+      report_devices(hd_data, 0);
+    }
   }
 
-  return MAKE_ID(TAG_EISA, u);
+  while(queue.first < queue.last) probe_queue_merge(hd_data, &queue);
 }
 
 
 /*
- * Create a 'canonical' version, i.e. no spaces at start and end.
+ * Merge the oldest thread in queue.
  *
- * Note: removes chars >= 0x80 as well (due to (char *))! This
- * is currently considered a feature.
+ * If the results can't be merged, the step is run again in the main
+ * thread. A step's link function (cf. probe_steps[]) is run in the main
+ * thread after the merge.
+ *
+ * In both cases, all other threads must have finished before.
  */
-char *canon_str(char *s, int len)
+void probe_queue_merge(hd_data_t *hd_data, probe_queue_t *queue)
 {
-  char *m2, *m1, *m0;
-  int i;
+  probe_worker_t *pw = queue->list[queue->first++];
+  struct probe_step_s *ps = pw->step;
+  int conflict;
+  unsigned u;
 
-  if(len < 0) len = 0;		/* just to be safe */
+  queue->steps &= ~(1ull << ps->step);
 
-  m0 = new_mem(len + 1);
+  probe_worker_join(pw);
+
+  conflict = probe_worker_merge(hd_data, pw);
+
+  probe_worker_free(pw);
+
+  if(conflict || ps->link) {
+    for(u = queue->first; u < queue->last; u++) probe_worker_join(queue->list[u]);
+  }
+
+  if(conflict) {
+    ADD2LOG("  %s: conflicting changes, running it again\n", mod_name_by_idx(ps->mod));
+    hd_scan_step(hd_data, ps);
+  }
+  else if(ps->link) {
+    ps->link(hd_data);
+  }
+
+  report_devices(hd_data, 0);
+}
+
+
+/*
+ * Run a single probing step.
+ */
+void hd_scan_step(hd_data_t *hd_data, struct probe_step_s *ps)
+{
+  if(ps->timeout && hd_probe_feature(hd_data, pr_watchdog)) {
+    hd_scan_watched(hd_data, ps);
+  }
+  else {
+    ps->scan(hd_data);
+  }
+}
+
+
+/*
+ * Run a step that may hang with a deadline.
+ *
+ * This replaces hd_fork() (cf. 'watchdog' probe feature): the step runs
+ * in-process and its serial I/O (hd_read_timeout(), hd_write_timeout())
+ * fails once the deadline has passed. The deadline is ps->timeout seconds
+ * from now; progress() extends it, but not beyond ps->total_timeout
+ * seconds.
+ *
+ * The step then finishes normally: it closes its devices, restores the
+ * line settings and keeps the results it has got until then.
+ *
+ * Only waiting for serial data is bounded this way. A step blocking
+ * elsewhere (e.g. in open() or close() of a wedged device) still hangs;
+ * probes therefore use non-blocking fds and don't wait for output to drain
+ * in watched steps (cf. hd_watched()).
+ */
+void hd_scan_watched(hd_data_t *hd_data, struct probe_step_s *ps)
+{
+  uint64_t now = io_clock();
+  char *name = mod_name_by_idx(ps->mod);
+
+  hd_data->io_stop = now + ps->total_timeout * 1000000ull;
+  hd_data->io_timeout = ps->timeout;
+  hd_data->io_deadline = now + ps->timeout * 1000000ull;
+  if(hd_data->io_deadline > hd_data->io_stop) hd_data->io_deadline = hd_data->io_stop;
+
+  ADD2LOG("******  started %s (%ds/%ds)  ******\n", name, ps->timeout, ps->total_timeout);
+
+  ps->scan(hd_data);
+
+  ADD2LOG("******  %s %s  ******\n", hd_timed_out(hd_data) ? "timed out" : "stopped", name);
+
+  hd_data->io_deadline = hd_data->io_stop = 0;
+  hd_data->io_timeout = 0;
+}
+
+
+/*
+ * Current time in us (CLOCK_MONOTONIC).
+ */
+uint64_t io_clock()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+
+/*
+ * Has the deadline of the current probing step passed (cf. hd_scan_watched())?
+ */
+int hd_timed_out(hd_data_t *hd_data)
+{
+  return hd_data->io_deadline && io_clock() >= hd_data->io_deadline;
+}
+
+
+/*
+ * Is the current probing step watched (cf. hd_scan_watched())?
+ */
+int hd_watched(hd_data_t *hd_data)
+{
+  return hd_data->io_deadline != 0;
+}
+
+
+/*
+ * Wait at most ms milliseconds (-1: no limit) for events on fd, but not
+ * beyond the deadline of the current probing step.
+ *
+ * Return 1 if fd is ready, 0 on timeout, -1 on error.
+ */
+int io_wait(hd_data_t *hd_data, int fd, short events, int ms)
+{
+  struct pollfd pfd = { .fd = fd, .events = events };
+  uint64_t now, left;
+  int i;
+
+  if(hd_data->io_deadline) {
+    now = io_clock();
+    if(now >= hd_data->io_deadline) return 0;
+    left = (hd_data->io_deadline - now + 999) / 1000;
+    if(ms < 0 || (uint64_t) ms > left) ms = left;
+  }
+
+  while((i = poll(&pfd, 1, ms)) == -1 && errno == EINTR);
+
+  return i > 0 ? 1 : i;
+}
+
+
+/*
+ * Read up to len bytes from fd; wait at most ms milliseconds for them
+ * (cf. io_wait()).
+ *
+ * In a watched step fd should be non-blocking; otherwise this just sleeps
+ * ms milliseconds and does a single read(). Return the number of bytes
+ * read, or -1 if there was an error before anything could be read.
+ */
+int hd_read_timeout(hd_data_t *hd_data, int fd, void *buf, unsigned len, int ms)
+{
+  uint64_t end = io_clock() + ms * 1000ull, now;
+  unsigned pos = 0;
+  int i, err = 0;
+
+  if(!hd_watched(hd_data)) {
+    usleep(ms * 1000);
+
+    return read(fd, buf, len);
+  }
+
+  while(pos < len) {
+    now = io_clock();
+    i = io_wait(hd_data, fd, POLLIN, now < end ? (end - now + 999) / 1000 : 0);
+    if(i <= 0) {
+      err = i;
+      break;
+    }
+    i = read(fd, (char *) buf + pos, len - pos);
+    if(i <= 0) {
+      if(i == -1 && (errno == EAGAIN || errno == EINTR)) continue;
+      err = i;
+      break;
+    }
+    pos += i;
+  }
+
+  return pos || !err ? (int) pos : -1;
+}
+
+
+/*
+ * Write len bytes to fd; wait at most ms milliseconds until they are
+ * accepted (cf. io_wait()).
+ *
+ * In a watched step fd should be non-blocking; otherwise this is a plain
+ * write(). Return the number of bytes written, or -1 if there was an
+ * error before anything could be written.
+ */
+int hd_write_timeout(hd_data_t *hd_data, int fd, const void *buf, unsigned len, int ms)
+{
+  uint64_t end = io_clock() + ms * 1000ull, now;
+  unsigned pos = 0;
+  int i, err = 0;
+
+  if(!hd_watched(hd_data)) return write(fd, buf, len);
+
+  while(pos < len) {
+    now = io_clock();
+    i = io_wait(hd_data, fd, POLLOUT, now < end ? (end - now + 999) / 1000 : 0);
+    if(i <= 0) {
+      err = i;
+      break;
+    }
+    i = write(fd, (const char *) buf + pos, len - pos);
+    if(i <= 0) {
+      if(i == -1 && (errno == EAGAIN || errno == EINTR)) continue;
+      err = i;
+      break;
+    }
+    pos += i;
+  }
+
+  return pos || !err ? (int) pos : -1;
+}
+
+
+/*
+ * Start a thread for step ps.
+ *
+ * If no thread can be created, the step is run right away.
+ */
+probe_worker_t *probe_worker_start(hd_data_t *hd_data, struct probe_step_s *ps)
+{
+  probe_worker_t *pw = new_mem(sizeof *pw);
+  hd_t *hd;
+  unsigned u, cnt;
+
+  pw->step = ps;
+  pw->base = pw->data = *hd_data;
+
+  pw->data.flags.worker = 1;
+
+  pw->data.log = NULL;
+  pw->data.log_size = pw->data.log_max = 0;
+  pw->data.log_sink = NULL;
+  pw->data.hd_index = NULL;
+  pw->data.class_index = NULL;
+  pw->data.last_hd = NULL;
+  pw->data.arena = NULL;
+  pw->data.old_hd = NULL;
+  pw->data.stats = NULL;
+  pw->data.stats_mark = NULL;
+
+  /* set up before, it is shared by all threads; if outdated, the thread builds its own */
+  pw->data.sysfsdrv_arena = NULL;
+
+  /* read_kmods() would replace the list */
+  if(hd_data->flags.keep_kmods != 2) {
+    pw->data.kmods = NULL;
+    pw->own_kmods = 1;
+  }
+
+  /* single devices are read and cached on demand (cf. hd_get_udevinfo()) */
+  if(hd_data->udev_db == 1) {
+    pw->data.udevinfo = NULL;
+    pw->data.udev_index = NULL;
+    pw->own_udev = 1;
+  }
+
+  for(cnt = 0, hd = hd_data->hd; hd; hd = hd->next) cnt++;
+
+  pw->hd_cnt = cnt;
+  if(cnt) {
+    pw->hd_orig = new_mem(cnt * sizeof *pw->hd_orig);
+    pw->hd_copy = new_mem(cnt * sizeof *pw->hd_copy);
+    pw->hd_base = new_mem(cnt * sizeof *pw->hd_base);
+    for(u = 0, hd = hd_data->hd; hd; hd = hd->next, u++) {
+      pw->hd_orig[u] = hd;
+      pw->hd_copy[u] = *hd;
+      pw->hd_copy[u].next = u + 1 < cnt ? pw->hd_copy + u + 1 : NULL;
+      pw->hd_base[u] = pw->hd_copy[u];
+    }
+  }
+  pw->data.hd = pw->hd_copy;
+
+  pw->started = 1;
+  if(pthread_create(&pw->thread, NULL, probe_worker, pw)) {
+    pw->started = 0;
+    probe_worker(pw);
+  }
+
+  return pw;
+}
+
+
+void *probe_worker(void *arg)
+{
+  probe_worker_t *pw = arg;
+
+  pw->step->scan(&pw->data);
+
+  if(pw->data.flags.stats) probe_stats_mark(&pw->data, NULL, NULL);
+
+  if(pw->started) {
+    free_mem(tls_buf.sysfs_link);
+    free_mem(tls_buf.sysfs_attr);
+    free_mem(tls_buf.hddb_path);
+    free_str_list(tls_buf.attr_list);
+    free_mem(tls_buf.name2_dev);
+    free_mem(tls_buf.dev2_name);
+  }
+
+  return NULL;
+}
+
+
+void probe_worker_join(probe_worker_t *pw)
+{
+  if(pw->started && !pw->joined) pthread_join(pw->thread, NULL);
+  pw->joined = 1;
+}
+
+
+/*
+ * Merge the results of a probing thread into hd_data.
+ *
+ * Entries and hd_data get a three-way merge against their state at
+ * dispatch time (cf. merge3()): only what the thread has changed is taken
+ * over. If something has been changed differently in hd_data in the
+ * meantime, nothing is merged and 1 is returned; else 0.
+ *
+ * Whatever is taken over is removed from the thread's hd_data; the rest
+ * is freed by probe_worker_free().
+ */
+int probe_worker_merge(hd_data_t *hd_data, probe_worker_t *pw)
+{
+  hd_data_t *w = &pw->data, *data;
+  hd_t *hd, *next, **hdp, **next_copy = NULL;
+  unsigned u, shift;
+  int conflict, apply;
+  static const size_t hd_bits[] = {
+    offsetof(hd_t, hw_class_list), sizeof ((hd_t *) 0)->hw_class_list,
+    offsetof(hd_t, is), sizeof ((hd_t *) 0)->is,
+    offsetof(hd_t, tag), sizeof ((hd_t *) 0)->tag,
+    0, 0
+  };
+  static const size_t hd_data_bits[] = {
+    offsetof(hd_data_t, flags), sizeof ((hd_data_t *) 0)->flags,
+    0, 0
+  };
+
+  /* what the thread has changed in hd_data, without its private parts */
+  data = new_mem(sizeof *data);
+  *data = *w;
+  data->flags.worker = pw->base.flags.worker;
+  data->log = pw->base.log;
+  data->log_size = pw->base.log_size;
+  data->log_max = pw->base.log_max;
+  data->log_sink = pw->base.log_sink;
+  data->hd = pw->base.hd;
+  data->old_hd = pw->base.old_hd;
+  data->hd_index = pw->base.hd_index;
+  data->class_index = pw->base.class_index;
+  data->last_hd = pw->base.last_hd;
+  data->last_idx = pw->base.last_idx;
+  data->module = pw->base.module;
+  data->arena = pw->base.arena;
+  data->stats = pw->base.stats;
+  data->stats_mark = pw->base.stats_mark;
+  data->kmods = pw->base.kmods;
+  data->sysfsdrv = pw->base.sysfsdrv;
+  data->sysfsdrv_id = pw->base.sysfsdrv_id;
+  data->sysfsdrv_arena = pw->base.sysfsdrv_arena;
+  data->udevinfo = pw->base.udevinfo;
+  data->udev_index = pw->base.udev_index;
+
+  /* the list links differ anyway */
+  if(pw->hd_cnt) next_copy = new_mem(pw->hd_cnt * sizeof *next_copy);
+  for(u = 0; u < pw->hd_cnt; u++) {
+    next_copy[u] = pw->hd_copy[u].next;
+    pw->hd_copy[u].next = pw->hd_base[u].next = pw->hd_orig[u]->next;
+  }
+
+  for(conflict = apply = 0; apply < 2 && !conflict; apply++) {
+    for(u = 0; u < pw->hd_cnt && !conflict; u++) {
+      conflict = merge3(pw->hd_orig[u], pw->hd_base + u, pw->hd_copy + u, sizeof (hd_t), hd_bits, apply);
+    }
+    if(!conflict) {
+      conflict = merge3(hd_data, &pw->base, data, sizeof *data, hd_data_bits, apply);
+    }
+  }
+
+  for(u = 0; u < pw->hd_cnt; u++) pw->hd_copy[u].next = next_copy[u];
+
+  free_mem(next_copy);
+  free_mem(data);
+
+  if(conflict) return 1;
+
+  /* entries the thread has removed: remove the originals */
+  for(hdp = &w->old_hd; (hd = *hdp);) {
+    if(hd >= pw->hd_copy && hd < pw->hd_copy + pw->hd_cnt) {
+      *hdp = hd->next;
+    }
+    else {
+      hdp = &hd->next;
+    }
+  }
+  remove_tagged_hd_entries(hd_data);
+
+  /* new entries: renumber and append */
+  shift = hd_data->last_idx - pw->base.last_idx;
+
+  for(hdp = &hd_data->hd; *hdp; hdp = &(*hdp)->next);
+
+  for(hd = w->hd; hd; hd = next) {
+    next = hd->next;
+    if(hd >= pw->hd_copy && hd < pw->hd_copy + pw->hd_cnt) continue;
+    hd->next = NULL;
+    if(hd->idx > pw->base.last_idx) hd->idx += shift;
+    if(hd->attached_to > pw->base.last_idx) hd->attached_to += shift;
+    if(hd->ref >= pw->hd_copy && hd->ref < pw->hd_copy + pw->hd_cnt) {
+      hd->ref = pw->hd_orig[hd->ref - pw->hd_copy];
+    }
+    *hdp = hd;
+    hdp = &hd->next;
+  }
+  w->hd = NULL;
+
+  hd_data->last_idx += w->last_idx - pw->base.last_idx;
+
+  add_hd_entry2(&hd_data->old_hd, w->old_hd);
+  w->old_hd = NULL;
+
+  hd_log(hd_data, w->log, w->log_size);
+
+  probe_stats_merge(&hd_data->stats, w->stats);
+  w->stats = NULL;
+
+  arena_join(&hd_data->arena, w->arena);
+  w->arena = NULL;
+
+  hd_data->module = w->module;
+
+  /* entries have been updated and renumbered */
+  hd_index_reset(hd_data);
+  hd_data->last_hd = NULL;
+
+  return 0;
+}
+
+
+/*
+ * Free what is left of a probing thread after probe_worker_merge().
+ */
+void probe_worker_free(probe_worker_t *pw)
+{
+  hd_data_t *w = &pw->data;
+  hd_t *hd, *next;
+  int i;
+
+  /* entries not merged */
+  for(i = 0, hd = w->hd; i < 2; i++, hd = w->old_hd) {
+    for(; hd; hd = next) {
+      next = hd->next;
+      if(hd >= pw->hd_copy && hd < pw->hd_copy + pw->hd_cnt) continue;
+      free_hd_entry(hd);
+      free_mem(hd);
+    }
+  }
+
+  free_mem(w->log);
+  free_probe_stats(w->stats);
+  free_mem(w->stats_mark);
+  hd_index_reset(w);
+  arena_free(w->arena);
+
+  if(pw->own_kmods) free_str_list(w->kmods);
+  if(pw->own_udev) udev_index_free(w);
+  hd_free_sysfsdrv(w);
+
+  free_mem(pw->hd_orig);
+  free_mem(pw->hd_copy);
+  free_mem(pw->hd_base);
+
+  free_mem(pw);
+}
+
+
+/*
+ * Three-way merge: apply the changes from base to new to cur.
+ *
+ * The objects are compared in words (size must be a multiple of it),
+ * the ranges in bits (offset, size pairs, ending with size 0). If cur has
+ * a different change of its own in a word, return 1; else 0.
+ *
+ * Nothing is changed unless apply is set.
+ */
+int merge3(void *cur, void *base, void *new, size_t size, const size_t *bits, int apply)
+{
+  unsigned long c, b, n;
+  const size_t *r;
+  size_t u;
+  int bitwise;
+
+  for(u = 0; u < size; u += sizeof c) {
+    memcpy(&b, (char *) base + u, sizeof b);
+    memcpy(&n, (char *) new + u, sizeof n);
+    if(b == n) continue;
+    memcpy(&c, (char *) cur + u, sizeof c);
+
+    for(bitwise = 0, r = bits; r[1] && !bitwise; r += 2) {
+      bitwise = u < r[0] + r[1] && u + sizeof c > r[0];
+    }
+
+    if(bitwise) {
+      c = (c & ~(b ^ n)) | (n & (b ^ n));
+    }
+    else {
+      if(c != b && c != n) return 1;
+      c = n;
+    }
+
+    if(apply) memcpy((char *) cur + u, &c, sizeof c);
+  }
+
+  return 0;
+}
+
+
+/*
+ * Note: due to byte order problems decoding the id is really a mess...
+ * And, we use upper case for hex numbers!
+ */
+char *isa_id2str(unsigned id)
+{
+  char *s = new_mem(8);
+  unsigned u = ((id & 0xff) << 8) + ((id >> 8) & 0xff);
+  unsigned v = ((id >> 8) & 0xff00) + ((id >> 24) & 0xff);
+
+  s[0] = ((u >> 10) & 0x1f) + 'A' - 1;
+  s[1] = ((u >>  5) & 0x1f) + 'A' - 1;
+  s[2] = ( u        & 0x1f) + 'A' - 1;
+
+  sprintf(s + 3, "%04X", v);
+
+  return s;
+}
+
+char *eisa_vendor_str(unsigned v)
+{
+  static __thread char s[4];
+
+  s[0] = ((v >> 10) & 0x1f) + 'A' - 1;
+  s[1] = ((v >>  5) & 0x1f) + 'A' - 1;
+  s[2] = ( v        & 0x1f) + 'A' - 1;
+  s[3] = 0;
+
+  return s;
+}
+
+
+/*
+ *  Must _not_ check that s is exactly 3 chars.
+ */
+API_SYM unsigned hd_name2eisa_id(char *s)
+{
+  int i;
+  unsigned u = 0;
+
+  for(i = 0; i < 3; i++) {
+    u <<= 5;
+    if(s[i] < 'A' - 1 || s[i] > 'A' - 1 + 0x1f) return 0;
+    u += s[i] - 'A' + 1;
+  }
+
+  return MAKE_ID(TAG_EISA, u);
+}
+
+
+/*
+ * Create a 'canonical' version, i.e. no spaces at start and end.
+ *
+ * Note: removes chars >= 0x80 as well (due to (char *))! This
+ * is currently considered a feature.
+ */
+char *canon_str(char *s, int len)
+{
+  char *m2, *m1, *m0;
+  int i;
+
+  if(len < 0) len = 0;		/* just to be safe */
+
+  m0 = new_mem(len + 1);
 
   for(m1 = m0, i = 0; i < len; i++) {
     if(m1 == m0 && s[i] <= ' ') continue;
@@ -2237,62 +3286,308 @@ int hex(char *s, int n)
     i = (i << 4) + j;
   }
 
-  return i;
+  return i;
+}
+
+
+/* simple 32 bit fixed point numbers with n decimals */
+int str2float(char *s, int n)
+{
+  int i = 0;
+  int dot = 0;
+
+  while(*s) {
+    if(*s == '.') {
+      if(dot++) return 0;
+    }
+    else if(*s >= '0' && *s <= '9') {
+      if(dot) {
+        if(!n) return i;
+        n--;
+      }
+      i *= 10;
+      i += *s - '0';
+    }
+    else {
+      return 0;
+    }
+
+    s++;
+  }
+
+  while(n--) i *= 10;
+
+  return i;
+}
+
+
+/* simple 32 bit fixed point numbers with n decimals */
+char *float2str(int f, int n)
+{
+  int i = 1, j, m = n;
+  static __thread char buf[32];
+
+  while(n--) i *= 10;
+
+  j = f / i;
+  i = f % i;
+
+  while(i && !(i % 10)) i /= 10, m--;
+
+  if(i) {
+    sprintf(buf, "%d.%0*d", j, m, i);
+  }
+  else {
+    sprintf(buf, "%d", j);
+  }
+
+  return buf;
+}
+
+
+/*
+ * String key of hd for lookup table 'table'.
+ */
+char *hd_index_key(hd_t *hd, int table)
+{
+  switch(table) {
+    case HD_INDEX_UNIQUE_ID: return hd->unique_id;
+    case HD_INDEX_SYSFS_ID: return hd->sysfs_id;
+    case HD_INDEX_DEV_NAME: return hd->unix_dev_name;
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Hash of idx (HD_INDEX_IDX) or key (other tables).
+ */
+unsigned hd_index_hash(int table, unsigned idx, char *key)
+{
+  unsigned h;
+
+  if(table == HD_INDEX_IDX) {
+    h = idx * 0x9e3779b1;
+  }
+  else {
+    for(h = 2166136261u; *key; key++) h = (h ^ (unsigned char) *key) * 16777619;
+  }
+
+  return h;
+}
+
+
+/*
+ * Check if hd matches idx (HD_INDEX_IDX) or key (other tables).
+ */
+int hd_index_match(hd_t *hd, int table, unsigned idx, char *key)
+{
+  char *s;
+
+  if(table == HD_INDEX_IDX) return hd->idx == idx;
+
+  return (s = hd_index_key(hd, table)) && !strcmp(s, key);
+}
+
+
+/*
+ * Hash chain for idx (HD_INDEX_IDX) or key (other tables).
+ */
+unsigned *hd_index_chain(struct hd_index_s *index, int table, unsigned idx, char *key)
+{
+  return index->bucket + table * index->size + (hd_index_hash(table, idx, key) & (index->size - 1));
+}
+
+
+/*
+ * Add record n to lookup table 'table' (unless the entry has no key).
+ */
+void hd_index_link(struct hd_index_s *index, unsigned n, int table)
+{
+  hd_index_rec_t *rec = index->rec + n;
+  unsigned *chain;
+
+  rec->key[table] = hd_index_key(rec->hd, table);
+
+  if(table != HD_INDEX_IDX && !rec->key[table]) return;
+
+  rec->hash[table] = hd_index_hash(table, rec->hd->idx, rec->key[table]);
+  chain = index->bucket + table * index->size + (rec->hash[table] & (index->size - 1));
+
+  rec->next[table] = *chain;
+  *chain = n;
+}
+
+
+/*
+ * Remove record n from lookup table 'table'.
+ */
+void hd_index_unlink(struct hd_index_s *index, unsigned n, int table)
+{
+  hd_index_rec_t *rec = index->rec + n;
+  unsigned *pn;
+
+  if(table != HD_INDEX_IDX && !rec->key[table]) return;
+
+  pn = index->bucket + table * index->size + (rec->hash[table] & (index->size - 1));
+  for(; *pn; pn = &index->rec[*pn].next[table]) {
+    if(*pn == n) {
+      *pn = rec->next[table];
+      break;
+    }
+  }
+}
+
+
+/*
+ * Rebuild all hash chains (with twice the number of buckets).
+ */
+void hd_index_rehash(struct hd_index_s *index)
+{
+  unsigned n;
+  int table;
+
+  free_mem(index->bucket);
+  index->size = index->size ? index->size * 2 : 64;
+  index->bucket = new_mem(HD_INDEX_TABLES * index->size * sizeof *index->bucket);
+
+  for(n = 1; n <= index->count; n++) {
+    for(table = 0; table < HD_INDEX_TABLES; table++) hd_index_link(index, n, table);
+  }
+}
+
+
+/*
+ * Bring lookup tables up to date.
+ *
+ * Entries are indexed by idx, unique_id, sysfs_id and unix_dev_name. As new
+ * entries are always appended to hd_data->hd, we just add everything after
+ * the last indexed entry - except the list tail. Probing modules fill in
+ * the keys after they have added an entry, so the tail is checked directly
+ * on lookup (cf. hd_index_find()). The tables are rebuilt for every new
+ * probing module.
+ *
+ * If a key of an entry before the tail changes, call hd_index_changed().
+ * Anything that removes or reorders entries must call hd_index_reset().
+ */
+struct hd_index_s *hd_index_update(hd_data_t *hd_data)
+{
+  struct hd_index_s *index = hd_data->hd_index;
+  hd_t *hd;
+  int table;
+
+  if(index && index->module != hd_data->module) {
+    hd_index_reset(hd_data);
+    index = NULL;
+  }
+
+  if(!index) {
+    index = hd_data->hd_index = new_mem(sizeof *index);
+    index->module = hd_data->module;
+    hd_index_rehash(index);
+  }
+
+  for(hd = index->last ? index->last->next : hd_data->hd; hd && hd->next; hd = hd->next) {
+    if(index->count + 1 >= index->max) {
+      index->max = index->max ? index->max * 2 : 64;
+      index->rec = resize_mem(index->rec, index->max * sizeof *index->rec);
+    }
+    index->rec[++index->count].hd = hd;
+    index->last = hd;
+
+    if(index->count > index->size) {
+      hd_index_rehash(index);
+    }
+    else {
+      for(table = 0; table < HD_INDEX_TABLES; table++) hd_index_link(index, index->count, table);
+    }
+  }
+
+  index->tail = hd;
+
+  return index;
+}
+
+
+/*
+ * Update lookup tables after unique_id, sysfs_id or unix_dev_name of hd
+ * have changed.
+ *
+ * Does nothing if hd has not been indexed yet.
+ */
+void hd_index_changed(hd_data_t *hd_data, hd_t *hd)
+{
+  struct hd_index_s *index = hd_data->hd_index;
+  unsigned n;
+  int table;
+
+  if(!index || !hd) return;
+
+  n = *hd_index_chain(index, HD_INDEX_IDX, hd->idx, NULL);
+  for(; n && index->rec[n].hd != hd; n = index->rec[n].next[HD_INDEX_IDX]);
+
+  if(!n) return;
+
+  for(table = 0; table < HD_INDEX_TABLES; table++) {
+    if(table == HD_INDEX_IDX) continue;
+    hd_index_unlink(index, n, table);
+    hd_index_link(index, n, table);
+  }
 }
 
 
-/* simple 32 bit fixed point numbers with n decimals */
-int str2float(char *s, int n)
+/*
+ * Drop lookup tables; they are rebuilt on the next lookup.
+ */
+void hd_index_reset(hd_data_t *hd_data)
 {
-  int i = 0;
-  int dot = 0;
-
-  while(*s) {
-    if(*s == '.') {
-      if(dot++) return 0;
-    }
-    else if(*s >= '0' && *s <= '9') {
-      if(dot) {
-        if(!n) return i;
-        n--;
-      }
-      i *= 10;
-      i += *s - '0';
-    }
-    else {
-      return 0;
-    }
+  struct hd_index_s *index = hd_data->hd_index;
 
-    s++;
-  }
+  hd_class_index_free(hd_data);
 
-  while(n--) i *= 10;
+  if(!index) return;
 
-  return i;
+  free_mem(index->bucket);
+  free_mem(index->rec);
+  hd_data->hd_index = free_mem(index);
 }
 
 
-/* simple 32 bit fixed point numbers with n decimals */
-char *float2str(int f, int n)
+/*
+ * Find next entry in hd_data->hd (after 'after', or the first one if
+ * 'after' is NULL) with given idx (table HD_INDEX_IDX) or key.
+ *
+ * Only the entries found are checked against their current key.
+ */
+hd_t *hd_index_find(hd_data_t *hd_data, int table, unsigned idx, char *key, hd_t *after)
 {
-  int i = 1, j, m = n;
-  static char buf[32];
-
-  while(n--) i *= 10;
+  struct hd_index_s *index;
+  unsigned n, start, best;
 
-  j = f / i;
-  i = f % i;
+  index = hd_index_update(hd_data);
 
-  while(i && !(i % 10)) i /= 10, m--;
+  start = best = 0;
 
-  if(i) {
-    sprintf(buf, "%d.%0*d", j, m, i);
+  if(after) {
+    if(after == index->tail) return NULL;
+    for(n = *hd_index_chain(index, table, idx, key); n; n = index->rec[n].next[table]) {
+      if(index->rec[n].hd == after) start = n;
+    }
+    if(!start) return NULL;
   }
-  else {
-    sprintf(buf, "%d", j);
+
+  /* chains are not sorted, look for the first match in list order */
+  for(n = *hd_index_chain(index, table, idx, key); n; n = index->rec[n].next[table]) {
+    if(n > start && (!best || n < best) && hd_index_match(index->rec[n].hd, table, idx, key)) best = n;
   }
 
-  return buf;
+  if(best) return index->rec[best].hd;
+
+  /* the entry probing modules are still working on */
+  if(index->tail && hd_index_match(index->tail, table, idx, key)) return index->tail;
+
+  return NULL;
 }
 
 
@@ -2301,15 +3596,9 @@ char *float2str(int f, int n)
  */
 API_SYM hd_t *hd_get_device_by_idx(hd_data_t *hd_data, unsigned idx)
 {
-  hd_t *hd;
-
   if(!idx) return NULL;		/* early out: idx is always != 0 */
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(hd->idx == idx) return hd;
-  }
-
-  return NULL;
+  return hd_index_find(hd_data, HD_INDEX_IDX, idx, NULL, NULL);
 }
 
 
@@ -2318,15 +3607,9 @@ API_SYM hd_t *hd_get_device_by_idx(hd_data_t *hd_data, unsigned idx)
  */
 hd_t *hd_get_device_by_id(hd_data_t *hd_data, char *id)
 {
-  hd_t *hd;
-
   if(!id) return NULL;
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(hd->unique_id && !strcmp(hd->unique_id, id)) return hd;
-  }
-
-  return NULL;
+  return hd_index_find(hd_data, HD_INDEX_UNIQUE_ID, 0, id, NULL);
 }
 
 
@@ -2344,17 +3627,76 @@ char *mod_name_by_idx(unsigned idx)
 }
 
 
+/*
+ * Debug flag of a probing module (0: none).
+ */
+static unsigned mod_debug_flag(unsigned mod)
+{
+  switch(mod) {
+    case mod_pci: return HD_DEB_PCI;
+    case mod_isapnp: return HD_DEB_ISAPNP;
+    case mod_net: return HD_DEB_NET;
+    case mod_floppy: return HD_DEB_FLOPPY;
+    case mod_misc: return HD_DEB_MISC;
+    case mod_serial: return HD_DEB_SERIAL;
+    case mod_monitor: return HD_DEB_MONITOR;
+    case mod_cpu: return HD_DEB_CPU;
+    case mod_bios: return HD_DEB_BIOS;
+    case mod_mouse: return HD_DEB_MOUSE;
+    case mod_scsi: return HD_DEB_SCSI;
+    case mod_usb: return HD_DEB_USB;
+    case mod_adb: return HD_DEB_ADB;
+    case mod_modem: return HD_DEB_MODEM;
+    case mod_parallel: return HD_DEB_PARALLEL;
+    case mod_isa: return HD_DEB_ISA;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Check if log messages of the current probing module are wanted.
+ */
+API_SYM int hd_log_enabled(hd_data_t *hd_data)
+{
+  unsigned deb;
+
+  if(!hd_data || hd_data->flags.nolog) return 0;
+
+  if(!(hd_data->debug & HD_DEB_LOG_FILTER)) return 1;
+
+  deb = mod_debug_flag(hd_data->module);
+
+  return !deb || (hd_data->debug & deb);
+}
+
+
 void hd_log(hd_data_t *hd_data, char *buf, ssize_t len)
 {
-  if (!hd_data) return;
+  if (!hd_data || hd_data->flags.nolog) return;
   ssize_t new_size;
   char *p;
 
   if(len <= 0 || !buf) return;
 
+  /* with a log sink, the buffer never grows beyond HD_LOG_CHUNK */
+  if(hd_data->log_sink) {
+    if(hd_data->log_size + len + 1 > HD_LOG_CHUNK) hd_log_flush(hd_data);
+    if(len + 1 > HD_LOG_CHUNK) {
+      hd_data->log_sink(hd_data->log_sink_data, buf, len);
+      return;
+    }
+  }
+
   if(hd_data->log_size + len + 1 > hd_data->log_max) {
-    new_size = hd_data->log_max + len + (1 << 20);
-    new_size += new_size / 2;
+    if(hd_data->log_sink) {
+      new_size = HD_LOG_CHUNK;
+    }
+    else {
+      new_size = hd_data->log_max + len + (1 << 20);
+      new_size += new_size / 2;
+    }
     p = realloc(hd_data->log, new_size);
     if(p) {
       hd_data->log = p;
@@ -2370,12 +3712,114 @@ void hd_log(hd_data_t *hd_data, char *buf, ssize_t len)
 }
 
 
+/*
+ * Pass log messages to sink() instead of keeping them all in hd_data->log.
+ *
+ * Messages are collected in a buffer of at most HD_LOG_CHUNK bytes that is
+ * handed to sink() whenever it is full, at the end of hd_scan() and when
+ * hd_log_flush() is called. Anything logged so far is passed on right away.
+ * Use sink = NULL to go back to the in-memory log.
+ */
+API_SYM void hd_set_log_sink(hd_data_t *hd_data, void (*sink)(void *data, const char *buf, size_t len), void *data)
+{
+  hd_log_flush(hd_data);
+
+  hd_data->log_sink = sink;
+  hd_data->log_sink_data = data;
+
+  hd_log_flush(hd_data);
+}
+
+
+/*
+ * Pass each new device to cb() as soon as its probing module is done.
+ *
+ * The entry passed is a preliminary copy with unique id, data base info,
+ * hw class and model filled in; it is valid only during the call. The
+ * remaining steps of hd_scan() can still change or remove the device - the
+ * final result is the list in hd_data->hd. Entries not created by a probing
+ * module are passed at the end of hd_scan().
+ *
+ * cb() is called once for every entry. Use cb = NULL to turn it off.
+ */
+API_SYM void hd_set_device_callback(hd_data_t *hd_data, void (*cb)(void *data, hd_t *hd), void *data)
+{
+  hd_data->device_cb = cb;
+  hd_data->device_cb_data = data;
+}
+
+
+/*
+ * Pass entries not yet reported to the device callback (if any).
+ *
+ * final = 0: after a probing module; pass a completed copy of the entry.
+ * final = 1: at the end of hd_scan(); pass the entry itself.
+ */
+void report_devices(hd_data_t *hd_data, int final)
+{
+  hd_t *hd, tmp;
+
+  if(!hd_data->device_cb) return;
+
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(
+      hd->tag.reported ||
+      hd->tag.remove ||
+      !hd_report_this(hd_data, hd) ||
+      (hd_data->sysfs_scope && !hd_entry_in_scope(hd_data, hd, 0))
+    ) continue;
+
+    hd->tag.reported = 1;
+
+    if(final) {
+      hd_data->device_cb(hd_data->device_cb_data, hd);
+      continue;
+    }
+
+    /* same order as in hd_scan() */
+    tmp = *hd;
+    tmp.next = NULL;
+    tmp.ref = hd;
+    hd_add_id(hd_data, &tmp);
+    hddb_add_info(hd_data, &tmp);
+    assign_hw_class(hd_data, &tmp);
+    create_model_name(hd_data, &tmp);
+
+    hd_data->device_cb(hd_data->device_cb_data, &tmp);
+
+    /* drop what was added to the copy */
+    if(tmp.unique_id != hd->unique_id) free_mem(tmp.unique_id);
+    if(tmp.unique_id1 != hd->unique_id1) free_mem(tmp.unique_id1);
+    if(tmp.old_unique_id != hd->old_unique_id) free_mem(tmp.old_unique_id);
+    if(tmp.requires != hd->requires) free_str_list(tmp.requires);
+    if(tmp.driver_info != hd->driver_info) free_driver_info(tmp.driver_info);
+    if(tmp.model != hd->model) free_mem(tmp.model);
+  }
+}
+
+
+/*
+ * Pass buffered log messages to the log sink (if any).
+ */
+API_SYM void hd_log_flush(hd_data_t *hd_data)
+{
+  if(!hd_data->log_sink || !hd_data->log_size) return;
+
+  hd_data->log_sink(hd_data->log_sink_data, hd_data->log, hd_data->log_size);
+
+  hd_data->log_size = 0;
+  *hd_data->log = 0;
+}
+
+
 API_SYM void hd_log_printf(hd_data_t *hd_data, char *format, ...)
 {
   ssize_t l;
   char *s = NULL;
   va_list args;
 
+  if(!hd_log_enabled(hd_data)) return;
+
   va_start(args, format);
   l = vasprintf(&s, format, args);
   va_end(args);
@@ -2390,6 +3834,8 @@ void hd_log_hex(hd_data_t *hd_data, int with_ascii, unsigned data_len, unsigned
 {
   char *buf = NULL;
 
+  if(!hd_log_enabled(hd_data)) return;
+
   hexdump(&buf, with_ascii, data_len, data);
 
   if(buf) hd_log(hd_data, buf, strlen(buf));
@@ -2412,8 +3858,8 @@ void hd_log_hex(hd_data_t *hd_data, int with_ascii, unsigned data_len, unsigned
  */
 void str_printf(char **buf, int offset, char *format, ...)
 {
-  static char *last_buf = NULL;
-  static int last_len = 0;
+  static __thread char *last_buf = NULL;
+  static __thread int last_len = 0;
   int len, use_cache;
   char b[0x10000];
   va_list args;
@@ -2541,16 +3987,19 @@ API_SYM str_list_t *hd_read_file(char *file_name, unsigned start_line, unsigned
   FILE *f;
   char buf[0x10000];
   int pipe = 0;
+  uint64_t cpu;
   str_list_t *sl_start = NULL, *sl_end = NULL, *sl;
 
   if(*file_name == '|') {
     pipe = 1;
     file_name++;
+    probe_count.children++;
     if(!(f = popen(file_name, "r"))) {
       return NULL;
     }
   }
   else {
+    probe_count.files++;
     if(!(f = fopen(file_name, "r"))) {
       return NULL;
     }
@@ -2573,10 +4022,14 @@ API_SYM str_list_t *hd_read_file(char *file_name, unsigned start_line, unsigned
     lines--;
   }
 
-  if(pipe)
+  if(pipe) {
+    cpu = reap_start();
     pclose(f);
-  else
+    reap_end(cpu);
+  }
+  else {
     fclose(f);
+  }
 
   return sl_start;
 }
@@ -2599,6 +4052,8 @@ API_SYM str_list_t *hd_read_dir(char *dir_name, int type)
     link_allowed = 1;
   }
 
+  if(dir_name) probe_count.files++;
+
   if(dir_name && (dir = opendir(dir_name))) {
     while((de = readdir(dir))) {
       if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
@@ -2665,18 +4120,17 @@ str_list_t *read_dir_canonical(char *dir_name, int type)
 API_SYM char *hd_read_sysfs_link(char *base_dir, char *link_name)
 {
   char *s = NULL;
-  static char *buf = NULL;
 
   if(!base_dir || !link_name) return NULL;
 
   str_printf(&s, 0, "%s/%s", base_dir, link_name);
 
-  free_mem(buf);
-  buf = realpath(s, NULL);
+  free_mem(tls_buf.sysfs_link);
+  tls_buf.sysfs_link = realpath(s, NULL);
 
   free_mem(s);
 
-  return buf;
+  return tls_buf.sysfs_link;
 }
 
 
@@ -2689,69 +4143,283 @@ API_SYM char *hd_read_sysfs_link(char *base_dir, char *link_name)
  * component is *not* a subcomponent of itself.
  * IOW: the path in list must really be longer than comp to qualify.
  */
-str_list_t *subcomponent_list(str_list_t *list, char *comp, int max)
+str_list_t *subcomponent_list(str_list_t *list, char *comp, int max)
+{
+  str_list_t *sub_list = NULL;
+
+  if(!list || !comp) return sub_list;
+
+  size_t comp_len = strlen(comp);
+
+  for(str_list_t *sl = list; sl; sl = sl->next) {
+    if(
+      !strncmp(sl->str, comp, comp_len) &&
+      sl->str[comp_len] == '/'
+    ) {
+      add_str_list(&sub_list, sl->str);
+      if(!--max) return sub_list;
+    }
+  }
+
+  return sub_list;
+}
+
+
+/*
+ * Check if list contains a subcomponent of comp.
+ *
+ * Returns 0 (no) or 1 (yes).
+ */
+int has_subcomponent(str_list_t *list, char *comp)
+{
+  str_list_t *sl = subcomponent_list(list, comp, 1);
+  if(!sl) return 0;
+
+  free_str_list(sl);
+
+  return 1;
+}
+
+
+/*
+ * Log the hardware detection progress.
+ */
+void progress(hd_data_t *hd_data, unsigned pos, unsigned count, char *msg)
+{
+  if (!hd_data) return;
+
+  char buf1[32], buf2[32], buf3[128], *fn;
+
+  if(hd_data->shm.ok && hd_data->flags.forked) {
+    ((hd_data_t *) (hd_data->shm.data))->shm.updated++;
+  }
+
+  /* some progress: extend the step deadline (cf. hd_scan_watched()) */
+  if(hd_data->io_deadline) {
+    hd_data->io_deadline = io_clock() + hd_data->io_timeout * 1000000ull;
+    if(hd_data->io_deadline > hd_data->io_stop) hd_data->io_deadline = hd_data->io_stop;
+  }
+
+  if(!msg) msg = "";
+
+  sprintf(buf1, "%u", hd_data->module);
+  sprintf(buf2, ".%u", count);
+  fn = mod_name_by_idx(hd_data->module);
+
+  sprintf(buf3, "%s.%u%s", *fn ? fn : buf1, pos, count ? buf2 : "");
+
+  if((hd_data->debug & HD_DEB_PROGRESS))
+    ADD2LOG(">> %s: %s\n", buf3, msg);
+
+  if(hd_data->flags.stats) probe_stats_mark(hd_data, buf3, msg);
+
+  if(hd_data->progress) {
+    /* probing modules may run in parallel, cf. hd_scan_threaded() */
+    pthread_mutex_lock(&progress_lock);
+    hd_data->progress(buf3, msg);
+    pthread_mutex_unlock(&progress_lock);
+  }
+}
+
+
+/*
+ * Probing statistics.
+ *
+ * Only collected if hd_data->flags.stats is set. The statistics accumulate
+ * over all hd_scan() calls; the list is freed by hd_free_hd_data().
+ */
+API_SYM hd_probe_stats_t *hd_probe_stats(hd_data_t *hd_data)
+{
+  return hd_data->stats;
+}
+
+
+/*
+ * Account resource usage since the last call to the current step and
+ * start a new step (step == NULL: no new step).
+ */
+void probe_stats_mark(hd_data_t *hd_data, char *step, char *info)
+{
+  struct probe_stats_mark_s *m, m_new = {};
+  hd_probe_stats_t st = {};
+  char buf[16], *s;
+
+  if(!(m = hd_data->stats_mark)) m = hd_data->stats_mark = new_mem(sizeof *m);
+
+  probe_stats_sample(&m_new);
+
+  if(m->mod) {
+    st.wall_time = m_new.wall - m->wall;
+    st.cpu_time = m_new.cpu - m->cpu;
+    st.files = m_new.files - m->files;
+    st.bytes = m_new.bytes - m->bytes;
+    st.children = m_new.children - m->children;
+    probe_stats_add(m->mod, &st);
+    probe_stats_add(m->step, &st);
+  }
+
+  if(step) {
+    if(!*(s = mod_name_by_idx(hd_data->module))) sprintf(s = buf, "%u", hd_data->module);
+    m_new.mod = probe_stats_get(&hd_data->stats, s, NULL, hd_data->module);
+    m_new.step = probe_stats_get(&hd_data->stats, step, info, hd_data->module);
+    m_new.step->runs++;
+    if(m_new.mod != m->mod) m_new.mod->runs++;
+  }
+
+  *m = m_new;
+}
+
+
+void probe_stats_sample(struct probe_stats_mark_s *m)
+{
+  struct timespec ts;
+  char buf[512], *s;
+  int fd;
+  ssize_t len = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  m->wall = ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+
+  /* this thread and the child processes it has reaped */
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  m->cpu = ts.tv_sec * 1000000ull + ts.tv_nsec / 1000 + probe_count.children_cpu;
+
+  /* rchar: everything read by this thread (except this read) */
+  if((fd = open("/proc/thread-self/io", O_RDONLY)) >= 0) {
+    if((len = read(fd, buf, sizeof buf - 1)) > 0) {
+      buf[len] = 0;
+      if((s = strstr(buf, "rchar:"))) {
+        m->bytes = strtoull(s + sizeof "rchar:" - 1, NULL, 10) - probe_count.stats_bytes;
+      }
+      probe_count.stats_bytes += len;
+    }
+    close(fd);
+  }
+
+  m->files = probe_count.files;
+  m->children = probe_count.children;
+}
+
+
+/*
+ * Start reaping a child process; returns the CPU time of all reaped
+ * children so far (cf. reap_lock).
+ */
+uint64_t reap_start()
+{
+  pthread_mutex_lock(&reap_lock);
+
+  return children_cpu();
+}
+
+
+/*
+ * Done reaping; account the child's CPU time to the current thread.
+ */
+void reap_end(uint64_t cpu)
+{
+  probe_count.children_cpu += children_cpu() - cpu;
+
+  pthread_mutex_unlock(&reap_lock);
+}
+
+
+/*
+ * CPU time of all reaped child processes, in us.
+ */
+uint64_t children_cpu()
 {
-  str_list_t *sub_list = NULL;
+  struct rusage ru = {};
 
-  if(!list || !comp) return sub_list;
+  getrusage(RUSAGE_CHILDREN, &ru);
 
-  size_t comp_len = strlen(comp);
+  return
+    ru.ru_utime.tv_sec * 1000000ull + ru.ru_utime.tv_usec +
+    ru.ru_stime.tv_sec * 1000000ull + ru.ru_stime.tv_usec;
+}
 
-  for(str_list_t *sl = list; sl; sl = sl->next) {
-    if(
-      !strncmp(sl->str, comp, comp_len) &&
-      sl->str[comp_len] == '/'
-    ) {
-      add_str_list(&sub_list, sl->str);
-      if(!--max) return sub_list;
-    }
+
+/*
+ * Wait for child process pid to exit and reap it (cf. reap_lock).
+ */
+pid_t hd_waitpid(pid_t pid, int *status)
+{
+  siginfo_t si;
+  uint64_t cpu;
+  pid_t p;
+
+  /* wait without reaping it, so the lock is held only briefly */
+  while(waitid(P_PID, pid, &si, WEXITED | WNOWAIT) == -1) {
+    if(errno != EINTR) return -1;
   }
 
-  return sub_list;
+  cpu = reap_start();
+  p = waitpid(pid, status, 0);
+  reap_end(cpu);
+
+  return p;
 }
 
 
 /*
- * Check if list contains a subcomponent of comp.
- *
- * Returns 0 (no) or 1 (yes).
+ * Find statistics entry; add new one if there is none.
  */
-int has_subcomponent(str_list_t *list, char *comp)
+hd_probe_stats_t *probe_stats_get(hd_probe_stats_t **list, char *name, char *info, unsigned module)
 {
-  str_list_t *sl = subcomponent_list(list, comp, 1);
-  if(!sl) return 0;
+  hd_probe_stats_t *st;
 
-  free_str_list(sl);
+  for(; (st = *list); list = &st->next) {
+    if(!strcmp(st->name, name)) return st;
+  }
 
-  return 1;
+  st = *list = new_mem(sizeof *st);
+  st->name = new_str(name);
+  st->info = new_str(info);
+  st->module = module;
+
+  return st;
+}
+
+
+void probe_stats_add(hd_probe_stats_t *st, hd_probe_stats_t *st_add)
+{
+  st->wall_time += st_add->wall_time;
+  st->cpu_time += st_add->cpu_time;
+  st->files += st_add->files;
+  st->bytes += st_add->bytes;
+  st->children += st_add->children;
 }
 
 
 /*
- * Log the hardware detection progress.
+ * Add statistics from list_add to list; list_add is freed.
  */
-void progress(hd_data_t *hd_data, unsigned pos, unsigned count, char *msg)
+void probe_stats_merge(hd_probe_stats_t **list, hd_probe_stats_t *list_add)
 {
-  if (!hd_data) return;
+  hd_probe_stats_t *st, *st2;
 
-  char buf1[32], buf2[32], buf3[128], *fn;
-
-  if(hd_data->shm.ok && hd_data->flags.forked) {
-    ((hd_data_t *) (hd_data->shm.data))->shm.updated++;
+  for(st = list_add; st; st = st->next) {
+    st2 = probe_stats_get(list, st->name, st->info, st->module);
+    probe_stats_add(st2, st);
+    st2->runs += st->runs;
   }
 
-  if(!msg) msg = "";
+  free_probe_stats(list_add);
+}
 
-  sprintf(buf1, "%u", hd_data->module);
-  sprintf(buf2, ".%u", count);
-  fn = mod_name_by_idx(hd_data->module);
 
-  sprintf(buf3, "%s.%u%s", *fn ? fn : buf1, pos, count ? buf2 : "");
+hd_probe_stats_t *free_probe_stats(hd_probe_stats_t *st)
+{
+  hd_probe_stats_t *next;
 
-  if((hd_data->debug & HD_DEB_PROGRESS))
-    ADD2LOG(">> %s: %s\n", buf3, msg);
+  for(; st; st = next) {
+    next = st->next;
+    free_mem(st->name);
+    free_mem(st->info);
+    free_mem(st);
+  }
 
-  if(hd_data->progress) hd_data->progress(buf3, msg);
+  return NULL;
 }
 
 
@@ -2794,7 +4462,7 @@ void remove_hd_entries(hd_data_t *hd_data)
   hd_t *hd;
 
   for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(hd->module == hd_data->module) {
+    if(hd->module == hd_data->module && hd_entry_in_scope(hd_data, hd, 1)) {
       hd->tag.remove = 1;
     }
   }
@@ -2813,6 +4481,9 @@ void remove_tagged_hd_entries(hd_data_t *hd_data)
 
   for(hd = *(prev = &hd_data->hd); hd;) {
     if(hd->tag.remove) {
+      hd_index_reset(hd_data);
+      hd_data->last_hd = NULL;
+
       /* find end of the old list... */
       h = &hd_data->old_hd;
       while(*h) h = &(*h)->next;
@@ -3290,7 +4961,7 @@ void hd_copy(hd_t *dst, hd_t *src)
 
 API_SYM hd_t *hd_list(hd_data_t *hd_data, hd_hw_item_t item, int rescan, hd_t *hd_old)
 {
-  hd_t *hd, *hd1, *hd_list = NULL;
+  hd_t *hd, *hd1, *hd_list = NULL, **hd_next = &hd_list;
   unsigned char probe_save[sizeof hd_data->probe];
   unsigned fast_save;
 
@@ -3333,8 +5004,9 @@ API_SYM hd_t *hd_list(hd_data_t *hd_data, hd_hw_item_t item, int rescan, hd_t *h
         if(!cmp_hd(hd1, hd)) break;
       }
       if(!hd1) {
-        hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
+        hd1 = add_hd_entry2(hd_next, new_mem(sizeof *hd_list));
         hd_copy(hd1, hd);
+        hd_next = &hd1->next;
       }
     }
   }
@@ -3351,7 +5023,7 @@ API_SYM hd_t *hd_list(hd_data_t *hd_data, hd_hw_item_t item, int rescan, hd_t *h
 
 API_SYM hd_t *hd_list_with_status(hd_data_t *hd_data, hd_hw_item_t item, hd_status_t status)
 {
-  hd_t *hd, *hd1, *hd_list = NULL;
+  hd_t *hd, *hd1, *hd_list = NULL, **hd_next = &hd_list;
   unsigned char probe_save[sizeof hd_data->probe];
 
   memcpy(probe_save, hd_data->probe, sizeof probe_save);
@@ -3368,8 +5040,9 @@ API_SYM hd_t *hd_list_with_status(hd_data_t *hd_data, hd_hw_item_t item, hd_stat
         (status.needed == 0 || status.needed == hd->status.needed) &&
         (status.reconfig == 0 || status.reconfig == hd->status.reconfig)
       ) {
-        hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
+        hd1 = add_hd_entry2(hd_next, new_mem(sizeof *hd_list));
         hd_copy(hd1, hd);
+        hd_next = &hd1->next;
       }
     }
   }
@@ -3401,16 +5074,14 @@ int has_hw_class(hd_t *hd, hd_hw_item_t *items)
  */
 API_SYM hd_t *hd_list2(hd_data_t *hd_data, hd_hw_item_t *items, int rescan)
 {
-  hd_t *hd, *hd1, *hd_list = NULL;
+  hd_t *hd, *hd1, *hd_list = NULL, **hd_next = &hd_list;
   unsigned char probe_save[sizeof hd_data->probe];
   unsigned fast_save;
   hd_hw_item_t *item_ptr;
-  int is_manual;
+  hd_iter_t iter;
 
   if(!items) return NULL;
 
-  is_manual = has_item(items, hw_manual);
-
   if(rescan) {
     memcpy(probe_save, hd_data->probe, sizeof probe_save);
     fast_save = hd_data->flags.fast;
@@ -3427,32 +5098,15 @@ API_SYM hd_t *hd_list2(hd_data_t *hd_data, hd_hw_item_t *items, int rescan)
     hd_data->flags.fast = fast_save;
   }
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(!hd_report_this(hd_data, hd)) continue;
-    if(
-      (
-        (is_manual && hd->module == mod_manual) || has_hw_class(hd, items)
-      )
-#ifndef LIBHD_TINY
-/* with LIBHD_TINY hd->status is not maintained (cf. manual.c) */
-      && (
-        hd_data->hal ||
-        hd->status.available == status_yes ||
-        hd->status.available == status_unknown ||
-        is_manual ||
-        hd_data->flags.list_all
-      )
-#endif
-    ) {
-//      if(hd->is.softraiddisk) continue;		/* don't report them */
+  hd_iter_init2(hd_data, &iter, items);
 
-      /* don't report old entries again */
-      hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
-      hd_copy(hd1, hd);
-    }
+  while((hd = hd_iter_next(hd_data, &iter))) {
+    hd1 = add_hd_entry2(hd_next, new_mem(sizeof *hd_list));
+    hd_copy(hd1, hd);
+    hd_next = &hd1->next;
   }
 
-  if(is_manual) {
+  if(iter.is_manual) {
     for(hd = hd_list; hd; hd = hd->next) {
       if(hd->module == mod_manual) {
         hd->status.available = hd->status.available_orig;
@@ -3469,8 +5123,9 @@ API_SYM hd_t *hd_list2(hd_data_t *hd_data, hd_hw_item_t *items, int rescan)
  */
 API_SYM hd_t *hd_list_with_status2(hd_data_t *hd_data, hd_hw_item_t *items, hd_status_t status)
 {
-  hd_t *hd, *hd1, *hd_list = NULL;
+  hd_t *hd, *hd1, *hd_list = NULL, **hd_next = &hd_list;
   unsigned char probe_save[sizeof hd_data->probe];
+  hd_iter_t iter;
 
   if(!items) return NULL;
 
@@ -3480,27 +5135,286 @@ API_SYM hd_t *hd_list_with_status2(hd_data_t *hd_data, hd_hw_item_t *items, hd_s
   hd_scan(hd_data);
   memcpy(hd_data->probe, probe_save, sizeof hd_data->probe);
 
+  hd_iter_init2(hd_data, &iter, items);
+  hd_iter_set_status(&iter, status);
+
+  while((hd = hd_iter_next(hd_data, &iter))) {
+    hd1 = add_hd_entry2(hd_next, new_mem(sizeof *hd_list));
+    hd_copy(hd1, hd);
+    hd_next = &hd1->next;
+  }
+
+  return hd_list;
+}
+
+
+/*
+ * Probe the devices in a sysfs subtree; meant for hotplug events.
+ *
+ * path is a device directory, e.g. /sys/devices/pci0000:00/0000:00:14.0/usb1/1-2
+ * (the leading "/sys" is optional). It need not exist any more.
+ *
+ * Only the pci, usb, block, scsi and network modules are run, and they look
+ * only at devices at or below path and at the devices above it (so parent
+ * links come out as with a full scan). Entries for devices that have gone
+ * are removed, all other entries are kept.
+ *
+ * Returns a list of the entries for the subtree; free it with
+ * hd_free_hd_list().
+ */
+API_SYM hd_t *hd_scan_sysfs_path(hd_data_t *hd_data, char *path)
+{
+  hd_t *hd, *hd1, *hd_list = NULL, **hd_next = &hd_list;
+  unsigned char probe_save[sizeof hd_data->probe];
+  unsigned fast_save;
+  char *s = NULL, *t;
+
+  if(!path || *path != '/') return NULL;
+
+  str_printf(&s, 0, "%s%s", strncmp(path, "/sys/", sizeof "/sys/" - 1) ? "/sys" : "", path);
+
+  /* resolve links, if the device is still there */
+  if((t = realpath(s, NULL))) {
+    free_mem(s);
+    s = t;
+  }
+
+  /* strip trailing '/' */
+  for(t = s + strlen(s); t > s + 1 && t[-1] == '/'; *--t = 0);
+
+  hd_data->sysfs_scope = new_str(hd_sysfs_id(s));
+  free_mem(s);
+
+  if(!hd_data->sysfs_scope) return NULL;
+
+  ADD2LOG("sysfs scope: %s\n", hd_data->sysfs_scope);
+
+  memcpy(probe_save, hd_data->probe, sizeof probe_save);
+  fast_save = hd_data->flags.fast;
+  hd_clear_probe_feature(hd_data, pr_all);
+  hd_set_probe_feature(hd_data, pr_int);
+  hd_set_probe_feature(hd_data, pr_pci);
+  hd_set_probe_feature(hd_data, pr_usb);
+  hd_set_probe_feature(hd_data, pr_block);
+  hd_set_probe_feature(hd_data, pr_block_cdrom);
+  hd_set_probe_feature(hd_data, pr_block_part);
+  hd_set_probe_feature(hd_data, pr_block_mods);
+  hd_set_probe_feature(hd_data, pr_scsi);
+  hd_set_probe_feature(hd_data, pr_net);
+  hd_scan(hd_data);
+  memcpy(hd_data->probe, probe_save, sizeof hd_data->probe);
+  hd_data->flags.fast = fast_save;
+
   for(hd = hd_data->hd; hd; hd = hd->next) {
-    if(has_hw_class(hd, items)) {
-      if(
-        (status.configured == 0 || status.configured == hd->status.configured) &&
-        (status.available == 0 || status.available == hd->status.available) &&
-        (status.needed == 0 || status.needed == hd->status.needed) &&
-        (status.reconfig == 0 || status.reconfig == hd->status.reconfig)
-      ) {
-        hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
-        hd_copy(hd1, hd);
-      }
+    if(hd_entry_in_scope(hd_data, hd, 0)) {
+      hd1 = add_hd_entry2(hd_next, new_mem(sizeof *hd_list));
+      hd_copy(hd1, hd);
+      hd_next = &hd1->next;
     }
   }
 
+  hd_data->sysfs_scope = free_mem(hd_data->sysfs_scope);
+
   return hd_list;
 }
 
 
+/*
+ * Iterate over all entries of hw class item (cf. hd_iter_init2()).
+ */
+API_SYM void hd_iter_init(hd_data_t *hd_data, hd_iter_t *iter, hd_hw_item_t item)
+{
+  hd_iter_init2(hd_data, iter, NULL);
+
+  iter->item[0] = item;
+  iter->is_manual = item == hw_manual;
+  iter->use_index = !iter->is_manual && item != hw_all;
+}
+
+
+/*
+ * Iterate over all entries in one of the hw classes in items; items must
+ * be a 0 terminated list and must stay valid while the iterator is used.
+ *
+ * Entries are selected like hd_list2() does it (without rescan). Unlike
+ * hd_list2(), manually configured entries keep their current
+ * status.available value.
+ */
+API_SYM void hd_iter_init2(hd_data_t *hd_data, hd_iter_t *iter, hd_hw_item_t *items)
+{
+  memset(iter, 0, sizeof *iter);
+
+  if(!items) items = iter->item;
+
+  iter->items = items;
+  iter->is_manual = has_item(items, hw_manual);
+  iter->use_index = !iter->is_manual && !has_item(items, hw_all);
+  iter->next = hd_data->hd;
+
+  if(iter->use_index && !hd_class_index_ok(hd_data)) hd_class_index_build(hd_data);
+}
+
+
+/*
+ * Select entries by status instead, like hd_list_with_status2() does.
+ * Status fields that are 0 match anything.
+ */
+API_SYM void hd_iter_set_status(hd_iter_t *iter, hd_status_t status)
+{
+  iter->status = status;
+  iter->with_status = 1;
+}
+
+
+/*
+ * Return next matching entry or NULL.
+ */
+API_SYM hd_t *hd_iter_next(hd_data_t *hd_data, hd_iter_t *iter)
+{
+  struct hd_class_index_s *index = hd_data->class_index;
+  hd_hw_item_t *item;
+  hd_t *hd;
+  uint64_t mask;
+  unsigned w;
+
+  /* the list has changed since we started: check all remaining entries */
+  if(iter->use_index && !hd_class_index_ok(hd_data)) iter->use_index = 0;
+
+  if(iter->use_index) {
+    for(w = iter->pos >> 6; w < index->words; w++) {
+      for(mask = 0, item = iter->items; *item; item++) {
+        if((unsigned) *item < hw_all) mask |= index->bits[*item * index->words + w];
+      }
+      if(w == iter->pos >> 6) mask &= ~0ULL << (iter->pos & 63);
+
+      for(; mask; mask &= mask - 1) {
+        iter->pos = (w << 6) + __builtin_ctzll(mask) + 1;
+        hd = index->hd[iter->pos - 1];
+        iter->next = hd->next;
+        if(hd_iter_match(hd_data, iter, hd)) return hd;
+      }
+    }
+
+    iter->pos = w << 6;
+    iter->next = NULL;
+
+    return NULL;
+  }
+
+  while((hd = iter->next)) {
+    iter->next = hd->next;
+    if(hd_iter_match(hd_data, iter, hd)) return hd;
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Check if hd is one of the entries iter is looking for.
+ */
+int hd_iter_match(hd_data_t *hd_data, hd_iter_t *iter, hd_t *hd)
+{
+  hd_status_t *status = &iter->status;
+
+  if(iter->with_status) {
+    return
+      has_hw_class(hd, iter->items) &&
+      (status->configured == 0 || status->configured == hd->status.configured) &&
+      (status->available == 0 || status->available == hd->status.available) &&
+      (status->needed == 0 || status->needed == hd->status.needed) &&
+      (status->reconfig == 0 || status->reconfig == hd->status.reconfig);
+  }
+
+  if(!hd_report_this(hd_data, hd)) return 0;
+
+  return
+    (
+      (iter->is_manual && hd->module == mod_manual) || has_hw_class(hd, iter->items)
+    )
+#ifndef LIBHD_TINY
+/* with LIBHD_TINY hd->status is not maintained (cf. manual.c) */
+    && (
+      hd_data->hal ||
+      hd->status.available == status_yes ||
+      hd->status.available == status_unknown ||
+      iter->is_manual ||
+      hd_data->flags.list_all
+    )
+#endif
+    ;
+}
+
+
+/*
+ * Build hw class index: for every hw class a bitmap of the entries that
+ * belong to it.
+ *
+ * This is done at the end of hd_scan(), once all hw classes have been
+ * assigned. The index is rebuilt when entries have been added or removed
+ * since. Note that it does not notice hw classes set with hd_set_hw_class()
+ * after hd_scan().
+ */
+void hd_class_index_build(hd_data_t *hd_data)
+{
+  struct hd_class_index_s *index;
+  hd_t *hd;
+  unsigned n, u, v;
+
+  hd_class_index_free(hd_data);
+
+  index = hd_data->class_index = new_mem(sizeof *index);
+
+  for(hd = hd_data->hd; hd; hd = hd->next) index->count++;
+
+  index->words = (index->count + 63) >> 6;
+  index->first = hd_data->hd;
+  index->hd = new_mem(index->count * sizeof *index->hd);
+  index->bits = new_mem(hw_all * index->words * sizeof *index->bits);
+
+  for(n = 0, hd = hd_data->hd; hd; hd = hd->next, n++) {
+    index->hd[n] = index->last = hd;
+    for(u = 0; u < sizeof hd->hw_class_list / sizeof *hd->hw_class_list; u++) {
+      if(!hd->hw_class_list[u]) continue;
+      for(v = 0; v < 8; v++) {
+        if((hd->hw_class_list[u] & (1 << v)) && (u << 3) + v < hw_all) {
+          index->bits[((u << 3) + v) * index->words + (n >> 6)] |= 1ULL << (n & 63);
+        }
+      }
+    }
+  }
+}
+
+
+void hd_class_index_free(hd_data_t *hd_data)
+{
+  struct hd_class_index_s *index = hd_data->class_index;
+
+  if(!index) return;
+
+  free_mem(index->hd);
+  free_mem(index->bits);
+  hd_data->class_index = free_mem(index);
+}
+
+
+/*
+ * Check if hw class index is still in sync with hd_data->hd.
+ *
+ * Entries are only appended or removed (and removing requires a call to
+ * hd_index_reset()), so it's enough to look at both ends of the list.
+ */
+int hd_class_index_ok(hd_data_t *hd_data)
+{
+  struct hd_class_index_s *index = hd_data->class_index;
+
+  return index && index->first == hd_data->hd && (!index->last || !index->last->next);
+}
+
+
 API_SYM hd_t *hd_base_class_list(hd_data_t *hd_data, unsigned base_class)
 {
-  hd_t *hd, *hd1, *hd_list = NULL;
+  hd_t *hd, *hd1, *hd_list = NULL, **hd_next = &hd_list;
 //  hd_t *bridge_hd;
 
   for(hd = hd_data->hd; hd; hd = hd->next) {
@@ -3513,8 +5427,9 @@ API_SYM hd_t *hd_base_class_list(hd_data_t *hd_data, unsigned base_class)
         hd->sub_class.id == sc_multi_video
       )
     ) {
-      hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
+      hd1 = add_hd_entry2(hd_next, new_mem(sizeof *hd_list));
       hd_copy(hd1, hd);
+      hd_next = &hd1->next;
     }
   }
 
@@ -3523,12 +5438,13 @@ API_SYM hd_t *hd_base_class_list(hd_data_t *hd_data, unsigned base_class)
 
 API_SYM hd_t *hd_sub_class_list(hd_data_t *hd_data, unsigned base_class, unsigned sub_class)
 {
-  hd_t *hd, *hd1, *hd_list = NULL;
+  hd_t *hd, *hd1, *hd_list = NULL, **hd_next = &hd_list;
 
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(hd->base_class.id == base_class && hd->sub_class.id == sub_class) {
-      hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
+      hd1 = add_hd_entry2(hd_next, new_mem(sizeof *hd_list));
       hd_copy(hd1, hd);
+      hd_next = &hd1->next;
     }
   }
 
@@ -3537,12 +5453,13 @@ API_SYM hd_t *hd_sub_class_list(hd_data_t *hd_data, unsigned base_class, unsigne
 
 API_SYM hd_t *hd_bus_list(hd_data_t *hd_data, unsigned bus)
 {
-  hd_t *hd, *hd1, *hd_list = NULL;
+  hd_t *hd, *hd1, *hd_list = NULL, **hd_next = &hd_list;
 
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(hd->bus.id == bus) {
-      hd1 = add_hd_entry2(&hd_list, new_mem(sizeof *hd_list));
+      hd1 = add_hd_entry2(hd_next, new_mem(sizeof *hd_list));
       hd_copy(hd1, hd);
+      hd_next = &hd1->next;
     }
   }
 
@@ -3572,11 +5489,12 @@ int hd_timeout(void(*func)(void *), void *arg, int timeout)
   int child1, child2;
   int status = 0;
 
+  probe_count.children++;
   child1 = fork();
   if(child1 == -1) return -1;
 
   if(child1) {
-    if(waitpid(child1, &status, 0) == -1) return -1;
+    if(hd_waitpid(child1, &status) == -1) return -1;
 //    fprintf(stderr, ">child1 status: 0x%x\n", status);
 
     if(WIFEXITED(status)) {
@@ -3622,7 +5540,7 @@ void timeout_alarm_handler(int signal)
  */
 str_list_t *read_kmods(hd_data_t *hd_data)
 {
-  str_list_t *sl, *sl0, *sl1 = NULL;
+  str_list_t *sl, *sl0, *sl1 = NULL, **sl_next = &sl1;
   char *s;
 
   if(!hd_data->kmods || hd_data->flags.keep_kmods != 2) {
@@ -3634,7 +5552,7 @@ str_list_t *read_kmods(hd_data_t *hd_data)
 
   for(sl = hd_data->kmods; sl; sl = sl->next) {
     s = sl->str;
-    add_str_list(&sl1, strsep(&s, " \t"));
+    sl_next = &add_str_list(sl_next, strsep(&s, " \t"))->next;
   }
 
   for(sl = sl1; sl; sl = sl->next) {
@@ -4128,9 +6046,11 @@ void hd_scan_xtra(hd_data_t *hd_data)
             /* insert at top */
             hd_tmp = hd_data->hd;
             hd_data->hd = NULL;
+            hd_data->last_hd = NULL;
             hd = add_hd_entry(hd_data, __LINE__, 0);
             hd->next = hd_tmp;
             hd_tmp = NULL;
+            hd_index_reset(hd_data);
           }
           else {
             hd = add_hd_entry(hd_data, __LINE__, 0);
@@ -4203,7 +6123,7 @@ void crc64(uint64_t *id, void *p, int len)
 
 char *numid2str(uint64_t id, int len)
 {
-  static char buf[32];
+  static __thread char buf[32];
 
 #ifdef NUMERIC_UNIQUE_ID
   /* numeric */
@@ -4352,6 +6272,8 @@ void hd_add_id(hd_data_t *hd_data, hd_t *hd)
   id0 += (id0 >> 32);
 
   str_printf(&hd->unique_id, 0, "%s.%s", numid2str(id0, 24), hd->unique_id1);
+
+  hd_index_changed(hd_data, hd);
 }
 #undef INT_CRC
 #undef STR_CRC
@@ -4414,6 +6336,7 @@ unsigned char *read_block0(hd_data_t *hd_data, char *dev, int *timeout)
     fd = -2;
   }
   else {
+    probe_count.files++;
     fd = open(dev, O_RDONLY);
     if(fd < 0) ADD2LOG("  read_block0: open(%s) failed\n", dev);
   }
@@ -4484,7 +6407,7 @@ void get_kernel_version(hd_data_t *hd_data)
 
 char *vend_id2str(unsigned vend)
 {
-  static char buf[32];
+  static __thread char buf[32];
   char *s;
 
   *(s = buf) = 0;
@@ -4897,7 +6820,7 @@ void create_model_name(hd_data_t *hd_data, hd_t *hd)
 {
   char *vend, *dev;
   char *compat, *dev_class, *hw_class;
-  char *part1, *part2;
+  char *part1, *part2, *buf = NULL;
   cpu_info_t *ct;
 
   /* early out */
@@ -4916,8 +6839,9 @@ void create_model_name(hd_data_t *hd_data, hd_t *hd)
   ) {
     /* cpu entry */
 
-    part1 = new_str(ct->model_name);
-    if(ct->clock) str_printf(&part1, -1, ", %u MHz", ct->clock);
+    str_printf(&buf, 0, "%s", ct->model_name);
+    if(ct->clock) str_printf(&buf, -1, ", %u MHz", ct->clock);
+    part1 = buf;
   }
   else {
     /* normal entry */
@@ -5009,14 +6933,16 @@ void create_model_name(hd_data_t *hd_data, hd_t *hd)
   }
 
   if(!part1 && !part2 && hw_class) {
-    str_printf(&part1, 0, "unknown %s", hw_class);
+    str_printf(&buf, 0, "unknown %s", hw_class);
     if(strchr(hw_class, ' ')) {
-      str_printf(&part1, -1, " hardware");
+      str_printf(&buf, -1, " hardware");
     }
+    part1 = buf;
   }
 
   str_printf(&hd->model, 0, "%s%s%s", part1, part2 ? " " : "", part2 ? part2 : "");
 
+  free_mem(buf);
   free_mem(vend);
   free_mem(dev);
   free_mem(compat);
@@ -5053,6 +6979,83 @@ API_SYM int hd_change_config_status(hd_data_t *hd_data, const char *id, hd_statu
 }
 
 
+/*
+ * Set a config status field of the entry with unique id (or udi) id; if id
+ * is a device name ('/dev/...'), of the single available manual entry using it.
+ *
+ * type: 1 = configured, 2 = available, 3 = needed, 4 = active;
+ * val: status name (cf. hd_status_value_name()).
+ *
+ * Returns 0 on success, 1 if val is invalid, 2 if there's no such entry,
+ * and 3 if the config could not be written.
+ */
+API_SYM int hd_set_config_status(hd_data_t *hd_data, const char *id, unsigned type, const char *val)
+{
+  hd_data_t *hd_data_manual;
+  hd_t *hd, *hd_manual;
+  hd_status_value_t status = 0;
+  char *s, *_id = NULL;
+  int i, nr = 0, err = 0;
+
+  for(i = 1; i < 8; i++) {
+    s = hd_status_value_name(i);
+    if(s && !strcmp(val, s)) {
+      status = i;
+      break;
+    }
+  }
+
+  if(!status || type < 1 || type > 4) return 1;
+
+  if(*id == '/') {
+    /* don't mix the manual entries into the caller's hardware list */
+    hd_data_manual = new_mem(sizeof *hd_data_manual);
+
+    hd_manual = hd_list(hd_data_manual, hw_manual, 1, NULL);
+    for(hd = hd_manual; hd; hd = hd->next) {
+      if(hd->status.available != status_yes) continue;
+      if(!search_str_list(hd->unix_dev_names, (char *) id)) continue;
+      _id = hd->unique_id;
+      nr++;
+    }
+    hd = nr == 1 ? hd_read_config(hd_data, _id) : NULL;
+
+    hd_free_hd_list(hd_manual);
+    hd_free_hd_data(hd_data_manual);
+    free_mem(hd_data_manual);
+  }
+  else {
+    hd = hd_read_config(hd_data, id);
+  }
+
+  if(!hd) return 2;
+
+  switch(type) {
+    case 1:
+      hd->status.configured = status;
+      break;
+
+    case 2:
+      hd->status.available = status;
+      break;
+
+    case 3:
+      hd->status.needed = status;
+      break;
+
+    case 4:
+      hd->status.active = status;
+      break;
+  }
+
+  if(hd_write_config(hd_data, hd)) err = 3;
+
+  hd_free_hd_list(hd);
+
+  return err;
+}
+
+
 /* wrapper for hd_change_config_status(); obsolete - do not use */
 API_SYM int hd_change_status(const char *id, hd_status_t status, const char *config_string)
 {
@@ -5093,6 +7096,7 @@ int hd_getdisksize(hd_data_t *hd_data, char *dev, int fd, hd_res_t **geo, hd_res
 
   if(fd < 0) {
     if(!dev) return 0;
+    probe_count.files++;
     fd = open(dev, O_RDONLY | O_NONBLOCK);
     close_fd = 1;
     if(fd < 0) return 0;
@@ -5381,6 +7385,7 @@ void hd_fork(hd_data_t *hd_data, int timeout, int total_timeout)
 
   updated = hd_data_shm->shm.updated;
 
+  probe_count.children++;
   child = fork();
 
   sigprocmask(SIG_SETMASK, &old_set, NULL);
@@ -5426,6 +7431,8 @@ void hd_fork(hd_data_t *hd_data, int timeout, int total_timeout)
     else {
       hd_data->log = free_mem(hd_data->log);
       hd_data->log_size = hd_data->log_max = 0;
+      /* the parent passes our log on */
+      hd_data->log_sink = NULL;
 
       hd_data->flags.forked = 1;
 
@@ -5669,40 +7676,24 @@ void hd_move_to_shm(hd_data_t *hd_data)
         ser->vend = hd_shm_add_str(hd_data, ser->vend);
         ser->init_string1 = hd_shm_add_str(hd_data, ser->init_string1);
         ser->init_string2 = hd_shm_add_str(hd_data, ser->init_string2);
-        ser->pppd_option = hd_shm_add_str(hd_data, ser->pppd_option);
-
-        ser->at_resp = hd_shm_add_str_list(hd_data, ser->at_resp);
-      }
-    }
-  }
-
-}
-
-
-hd_udevinfo_t *hd_free_udevinfo(hd_udevinfo_t *ui)
-{
-  hd_udevinfo_t *next;
-
-  for(; ui; ui = next) {
-    next = ui->next;
-
-    free_mem(ui->sysfs);
-    free_mem(ui->name);
-    free_str_list(ui->links);
+        ser->pppd_option = hd_shm_add_str(hd_data, ser->pppd_option);
 
-    free_mem(ui);
+        ser->at_resp = hd_shm_add_str_list(hd_data, ser->at_resp);
+      }
+    }
   }
 
-  return NULL;
 }
 
 
+/*
+ * Read complete udev data base via udevadm.
+ */
 void read_udevinfo(hd_data_t *hd_data)
 {
-  str_list_t *sl, *udevinfo;
+  str_list_t *sl, *udevinfo, **links = NULL;
   hd_udevinfo_t **uip, *ui;
   char *s = NULL, buf[256];
-  struct stat sbuf;
 
   udevinfo = read_file("| " PROG_UDEVADM " info -e 2>/dev/null", 0, 0);
   if(!udevinfo) udevinfo = read_file("| " PROG_UDEVINFO " -e 2>/dev/null", 0, 0);
@@ -5713,15 +7704,16 @@ void read_udevinfo(hd_data_t *hd_data)
   }
   ADD2LOG("-----  udevinfo end -----\n");
 
-  hd_data->udevinfo = hd_free_udevinfo(hd_data->udevinfo);
+  hd_data->udevinfo = NULL;
 
   uip = &hd_data->udevinfo;
 
   for(ui = NULL, sl = udevinfo; sl; sl = sl->next) {
     if(sscanf(sl->str, "P: %255s", buf) == 1) {
-      ui = *uip = new_mem(sizeof **uip);
+      ui = *uip = arena_alloc(&hd_data->arena, sizeof **uip);
       uip = &(*uip)->next;
-      ui->sysfs = new_str(buf);
+      ui->sysfs = arena_str(&hd_data->arena, buf);
+      links = &ui->links;
 
       continue;
     }
@@ -5729,14 +7721,15 @@ void read_udevinfo(hd_data_t *hd_data)
     if(!ui) continue;
 
     if(sscanf(sl->str, "N: %255s", buf) == 1) {
-      str_printf(&ui->name, 0, "/dev/%s", buf);
+      str_printf(&s, 0, "/dev/%s", buf);
+      ui->name = arena_str(&hd_data->arena, s);
 
       continue;
     }
 
     if(sscanf(sl->str, "S: %255s", buf) == 1) {
       str_printf(&s, 0, "/dev/%s", buf);
-      add_str_list(&ui->links, s);
+      arena_add_str_list(&hd_data->arena, &links, s);
 
       continue;
     }
@@ -5744,31 +7737,9 @@ void read_udevinfo(hd_data_t *hd_data)
 
   s = free_mem(s);
 
-  /*
-   * It sometimes happens that udev generates the same link for different
-   * kernel devices. To catch this we check here that udev device symlinks
-   * actually point to the kernel device name.
-   *
-   * If it does not match the link is replaced by the kernel device name.
-   */
   for(ui = hd_data->udevinfo; ui; ui = ui->next) {
-    if(!ui->name || stat(ui->name, &sbuf)) continue;
-
-    for(sl = ui->links; sl; sl = sl->next) {
-      char *real_path = realpath(sl->str, NULL);
-
-      if(real_path) {
-        if(strcmp(real_path, ui->name)) {
-          ADD2LOG(
-            "udev link %s points to %s (expected %s) - removed\n",
-            sl->str, real_path, ui->name
-          );
-          str_printf(&sl->str, 0, "%s", ui->name);
-        }
-
-        free(real_path);
-      }
-    }
+    check_udev_links(hd_data, ui);
+    udev_index_add(hd_data, ui);
   }
 
   for(ui = hd_data->udevinfo; ui; ui = ui->next) {
@@ -5785,6 +7756,279 @@ void read_udevinfo(hd_data_t *hd_data)
 }
 
 
+/*
+ * It sometimes happens that udev generates the same link for different
+ * kernel devices. To catch this we check here that udev device symlinks
+ * actually point to the kernel device name.
+ *
+ * If it does not match the link is replaced by the kernel device name.
+ */
+void check_udev_links(hd_data_t *hd_data, hd_udevinfo_t *ui)
+{
+  str_list_t *sl;
+  struct stat sbuf;
+
+  if(!ui->name || stat(ui->name, &sbuf)) return;
+
+  for(sl = ui->links; sl; sl = sl->next) {
+    char *real_path = realpath(sl->str, NULL);
+
+    if(real_path) {
+      if(strcmp(real_path, ui->name)) {
+        ADD2LOG(
+          "udev link %s points to %s (expected %s) - removed\n",
+          sl->str, real_path, ui->name
+        );
+        sl->str = ui->name;
+      }
+
+      free(real_path);
+    }
+  }
+}
+
+
+/*
+ * Read udev info for a single device directly from sysfs and the udev
+ * data base in UDEV_DATA_DIR and add it to hd_data->udevinfo.
+ *
+ * sysfs_id is the device path without leading "/sys". Devices without
+ * udev data are not added (udev may just not have processed them yet);
+ * NULL is returned for them.
+ */
+hd_udevinfo_t *read_udevinfo_dev(hd_data_t *hd_data, char *sysfs_id)
+{
+  hd_udevinfo_t ui0 = { }, *ui = &ui0;
+  str_list_t *sl, *db, **links = &ui->links;
+  char *s, *sys = NULL, *db_file = NULL, *subsystem = NULL, buf[256];
+  char *major = NULL, *minor = NULL, *ifindex = NULL, *dev_name = NULL;
+
+  str_printf(&sys, 0, "/sys%s", sysfs_id);
+
+  /* sysfs_id may point to a buffer that is reused below */
+  sysfs_id = sys + sizeof "/sys" - 1;
+
+  /* like udevadm, accept only real device paths (no class links) */
+  if(!(s = realpath(sys, NULL)) || strcmp(s, sys)) {
+    free(s);
+    free_mem(sys);
+
+    return NULL;
+  }
+  free(s);
+
+  for(sl = hd_attr_list(get_sysfs_attr_by_path(sys, "uevent")); sl; sl = sl->next) {
+    if(!strncmp(sl->str, "MAJOR=", sizeof "MAJOR=" - 1)) major = sl->str + sizeof "MAJOR=" - 1;
+    if(!strncmp(sl->str, "MINOR=", sizeof "MINOR=" - 1)) minor = sl->str + sizeof "MINOR=" - 1;
+    if(!strncmp(sl->str, "IFINDEX=", sizeof "IFINDEX=" - 1)) ifindex = sl->str + sizeof "IFINDEX=" - 1;
+    if(!strncmp(sl->str, "DEVNAME=", sizeof "DEVNAME=" - 1)) dev_name = sl->str + sizeof "DEVNAME=" - 1;
+  }
+
+  if((s = hd_read_sysfs_link(sys, "subsystem"))) {
+    subsystem = strrchr(s, '/');
+    subsystem = new_str(subsystem ? subsystem + 1 : s);
+  }
+
+  if(dev_name && *dev_name) {
+    s = NULL;
+    str_printf(&s, 0, "/dev/%s", dev_name);
+    ui->name = arena_str(&hd_data->arena, s);
+    free_mem(s);
+  }
+
+  /* udev device id: b<maj>:<min>, c<maj>:<min>, n<ifindex>, or +<subsystem>:<sysname> */
+  if(major && minor) {
+    str_printf(&db_file, 0, UDEV_DATA_DIR "/%c%s:%s",
+      subsystem && !strcmp(subsystem, "block") ? 'b' : 'c', major, minor
+    );
+  }
+  else if(ifindex) {
+    str_printf(&db_file, 0, UDEV_DATA_DIR "/n%s", ifindex);
+  }
+  else if(subsystem && (s = strrchr(sysfs_id, '/'))) {
+    str_printf(&db_file, 0, UDEV_DATA_DIR "/+%s:%s", subsystem, s + 1);
+  }
+
+  if(db_file) {
+    db = read_file(db_file, 0, 0);
+    for(sl = db; sl; sl = sl->next) {
+      if(sscanf(sl->str, "S:%255s", buf) == 1) {
+        s = NULL;
+        str_printf(&s, 0, "/dev/%s", buf);
+        arena_add_str_list(&hd_data->arena, &links, s);
+        free_mem(s);
+      }
+    }
+    free_str_list(db);
+  }
+
+  free_mem(db_file);
+  free_mem(subsystem);
+
+  if(!ui->name && !ui->links) {
+    ADD2LOG("udev: %s: no data\n", sysfs_id);
+    free_mem(sys);
+
+    return NULL;
+  }
+
+  check_udev_links(hd_data, ui);
+
+  /* order doesn't matter, just prepend */
+  ui = arena_alloc(&hd_data->arena, sizeof *ui);
+  *ui = ui0;
+  ui->next = hd_data->udevinfo;
+  hd_data->udevinfo = ui;
+  ui->sysfs = arena_str(&hd_data->arena, sysfs_id);
+  udev_index_add(hd_data, ui);
+
+  free_mem(sys);
+
+  ADD2LOG("udev: %s\n", ui->sysfs);
+  if(ui->name) ADD2LOG("  name: %s\n", ui->name);
+  if(ui->links) {
+    s = hd_join(", ", ui->links);
+    ADD2LOG("  links: %s\n", s);
+    free_mem(s);
+  }
+
+  return ui;
+}
+
+
+/*
+ * Find the slot for key in an udevinfo index table. It is either empty
+ * or holds the entry for key.
+ */
+hd_udevinfo_t **udev_index_slot(struct hd_udev_index_s *index, int table, char *key)
+{
+  hd_udevinfo_t **slot = index->slot[table], *ui;
+  unsigned h, mask = index->size - 1;
+  char *s;
+
+  for(h = 2166136261u, s = key; *s; s++) h = (h ^ (unsigned char) *s) * 16777619;
+
+  for(h &= mask; (ui = slot[h]); h = (h + 1) & mask) {
+    if(!strcmp(table == UDEV_INDEX_SYSFS ? ui->sysfs : ui->name, key)) break;
+  }
+
+  return slot + h;
+}
+
+
+/*
+ * Add ui to the udevinfo index.
+ *
+ * If there are several entries for a sysfs path or device name, the first
+ * one is kept (as a search through hd_data->udevinfo would have found it).
+ */
+void udev_index_add(hd_data_t *hd_data, hd_udevinfo_t *ui)
+{
+  struct hd_udev_index_s *index = hd_data->udev_index;
+  hd_udevinfo_t **slot, **old[2], *ui2;
+  unsigned u, old_size;
+  int table;
+
+  if(!ui->sysfs) return;
+
+  if(!index) index = hd_data->udev_index = new_mem(sizeof *index);
+
+  /* keep load factor below 1/2 */
+  if(2 * (index->count + 1) > index->size) {
+    old_size = index->size;
+    old[UDEV_INDEX_SYSFS] = index->slot[UDEV_INDEX_SYSFS];
+    old[UDEV_INDEX_NAME] = index->slot[UDEV_INDEX_NAME];
+    index->size = old_size ? 2 * old_size : 64;
+    for(table = 0; table < 2; table++) {
+      index->slot[table] = new_mem(index->size * sizeof *index->slot[table]);
+      for(u = 0; u < old_size; u++) {
+        if((ui2 = old[table][u])) {
+          *udev_index_slot(index, table, table == UDEV_INDEX_SYSFS ? ui2->sysfs : ui2->name) = ui2;
+        }
+      }
+      free_mem(old[table]);
+    }
+  }
+
+  slot = udev_index_slot(index, UDEV_INDEX_SYSFS, ui->sysfs);
+  if(*slot) return;
+  *slot = ui;
+  index->count++;
+
+  if(ui->name && !*(slot = udev_index_slot(index, UDEV_INDEX_NAME, ui->name))) *slot = ui;
+}
+
+
+void udev_index_free(hd_data_t *hd_data)
+{
+  struct hd_udev_index_s *index = hd_data->udev_index;
+
+  if(!index) return;
+
+  free_mem(index->slot[UDEV_INDEX_SYSFS]);
+  free_mem(index->slot[UDEV_INDEX_NAME]);
+  hd_data->udev_index = free_mem(index);
+}
+
+
+/*
+ * Get udev info for device sysfs_id (without leading "/sys").
+ *
+ * If UDEV_DATA_DIR exists, devices are looked up individually as needed.
+ * Else, the complete udev data base is read via udevadm.
+ */
+hd_udevinfo_t *hd_get_udevinfo(hd_data_t *hd_data, char *sysfs_id)
+{
+  hd_udevinfo_t *ui;
+  struct stat sbuf;
+
+  if(!hd_data->udev_db) {
+    if(!stat(UDEV_DATA_DIR, &sbuf) && S_ISDIR(sbuf.st_mode)) {
+      ADD2LOG("udev: using %s\n", UDEV_DATA_DIR);
+      hd_data->udev_db = 1;
+    }
+    else {
+      read_udevinfo(hd_data);
+      hd_data->udev_db = 2;
+    }
+  }
+
+  if(!sysfs_id) return NULL;
+
+  if(hd_data->udev_index && (ui = *udev_index_slot(hd_data->udev_index, UDEV_INDEX_SYSFS, sysfs_id))) return ui;
+
+  return hd_data->udev_db == 1 ? read_udevinfo_dev(hd_data, sysfs_id) : NULL;
+}
+
+
+/*
+ * Get udev info for device node name.
+ */
+hd_udevinfo_t *hd_get_udevinfo_by_name(hd_data_t *hd_data, char *name)
+{
+  hd_udevinfo_t *ui;
+  struct stat sbuf;
+  char buf[32];
+
+  if(!name) return NULL;
+
+  hd_get_udevinfo(hd_data, NULL);
+
+  if(hd_data->udev_db == 1) {
+    if(stat(name, &sbuf) || !(S_ISBLK(sbuf.st_mode) || S_ISCHR(sbuf.st_mode))) return NULL;
+
+    snprintf(buf, sizeof buf, "%u:%u", major(sbuf.st_rdev), minor(sbuf.st_rdev));
+    ui = hd_get_udevinfo(hd_data,
+      hd_sysfs_id(hd_read_sysfs_link(S_ISBLK(sbuf.st_mode) ? "/sys/dev/block" : "/sys/dev/char", buf))
+    );
+
+    return ui && ui->name && !strcmp(ui->name, name) ? ui : NULL;
+  }
+
+  return hd_data->udev_index ? *udev_index_slot(hd_data->udev_index, UDEV_INDEX_NAME, name) : NULL;
+}
+
+
 /*
  * Return libhd version.
  */
@@ -5796,13 +8040,7 @@ API_SYM char *hd_version()
 
 hd_t *hd_find_sysfs_id(hd_data_t *hd_data, char *id)
 {
-  hd_t *hd;
-
-  if(id && *id) {
-    for(hd = hd_data->hd; hd; hd = hd->next) {
-      if(hd->sysfs_id && !strcmp(hd->sysfs_id, id)) return hd;
-    }
-  }
+  if(id && *id) return hd_index_find(hd_data, HD_INDEX_SYSFS_ID, 0, id, NULL);
 
   return NULL;
 }
@@ -5810,21 +8048,11 @@ hd_t *hd_find_sysfs_id(hd_data_t *hd_data, char *id)
 
 hd_t *hd_find_sysfs_id_devname(hd_data_t *hd_data, char *id, char *devname)
 {
-  hd_t *hd;
+  hd_t *hd = NULL;
 
   if(id && *id && devname) {
-    for(hd = hd_data->hd; hd; hd = hd->next) {
-      if(
-        hd->sysfs_id &&
-        !strcmp(hd->sysfs_id, id) &&
-        (
-          !hd->unix_dev_name ||
-          (
-            hd->unix_dev_name &&
-            !strcmp(hd->unix_dev_name, devname)
-          )
-        )
-      ) return hd;
+    while((hd = hd_index_find(hd_data, HD_INDEX_SYSFS_ID, 0, id, hd))) {
+      if(!hd->unix_dev_name || !strcmp(hd->unix_dev_name, devname)) return hd;
     }
   }
 
@@ -5832,21 +8060,25 @@ hd_t *hd_find_sysfs_id_devname(hd_data_t *hd_data, char *id, char *devname)
 }
 
 
-hd_sysfsdrv_t *hd_free_sysfsdrv(hd_sysfsdrv_t *sf)
+/*
+ * Find next entry (after hd, or the first one if hd is NULL) with given
+ * device name.
+ */
+hd_t *hd_find_unix_dev_name(hd_data_t *hd_data, char *dev_name, hd_t *hd)
 {
-  hd_sysfsdrv_t *next;
-
-  for(; sf; sf = next) {
-    next = sf->next;
+  if(dev_name) return hd_index_find(hd_data, HD_INDEX_DEV_NAME, 0, dev_name, hd);
 
-    free_mem(sf->driver);
-    free_mem(sf->device);
-    free_mem(sf->module);
+  return NULL;
+}
 
-    free_mem(sf);
-  }
 
-  return NULL;
+/*
+ * The sysfs driver list lives in its own arena.
+ */
+void hd_free_sysfsdrv(hd_data_t *hd_data)
+{
+  hd_data->sysfsdrv = NULL;
+  hd_data->sysfsdrv_arena = arena_free(hd_data->sysfsdrv_arena);
 }
 
 
@@ -5863,9 +8095,12 @@ void hd_sysfs_driver_list(hd_data_t *hd_data)
   }
   free_str_list(sl0);
 
-  if(id != hd_data->sysfsdrv_id) {
-    hd_data->sysfsdrv = hd_free_sysfsdrv(hd_data->sysfsdrv);
-  }
+  /*
+   * Note: a probing thread starts with the shared list but without its
+   * arena; so if the list is outdated it builds a private one and leaves
+   * the shared list alone (cf. probe_worker_init()).
+   */
+  if(id != hd_data->sysfsdrv_id) hd_free_sysfsdrv(hd_data);
 
   if(hd_data->sysfsdrv) return;
 
@@ -5891,18 +8126,18 @@ void hd_sysfs_driver_list(hd_data_t *hd_data)
           s = hd_read_sysfs_link(drv, sf_drv2_e->str);
           module = s ? strrchr(s, '/') : NULL;
           if(module) {
-            sf = *sfp = new_mem(sizeof **sfp);
+            sf = *sfp = arena_alloc(&hd_data->sysfsdrv_arena, sizeof **sfp);
             sfp = &(*sfp)->next;
-            sf->driver = new_str(sf_drv_e->str);
-            sf->module = new_str(module + 1);
+            sf->driver = arena_str(&hd_data->sysfsdrv_arena, sf_drv_e->str);
+            sf->module = arena_str(&hd_data->sysfsdrv_arena, module + 1);
             ADD2LOG("%16s: module = %s\n", sf->driver, sf->module);
           }
         }
         else {
-          sf = *sfp = new_mem(sizeof **sfp);
+          sf = *sfp = arena_alloc(&hd_data->sysfsdrv_arena, sizeof **sfp);
           sfp = &(*sfp)->next;
-          sf->driver = new_str(sf_drv_e->str);
-          sf->device = new_str(hd_sysfs_id(hd_read_sysfs_link(drv, sf_drv2_e->str)));
+          sf->driver = arena_str(&hd_data->sysfsdrv_arena, sf_drv_e->str);
+          sf->device = arena_str(&hd_data->sysfsdrv_arena, hd_sysfs_id(hd_read_sysfs_link(drv, sf_drv2_e->str)));
           ADD2LOG("%16s: %s\n", sf->driver, sf->device);
         }
       }
@@ -5924,6 +8159,107 @@ void hd_sysfs_driver_list(hd_data_t *hd_data)
 }
 
 
+/*
+ * Update fingerprints of the sysfs based probing modules (cf. probe_fp_src[]).
+ *
+ * Returns the steps whose entries from the last scan are still valid.
+ */
+uint64_t probe_fp_update(hd_data_t *hd_data)
+{
+  struct probe_fp_s *pf;
+  struct probe_fp_src_s *src;
+  uint64_t id0 = 0, id, bit, run = 0, cached = 0, run_old;
+  str_list_t *sl, *sl0;
+  char **s;
+
+  if(!hd_data->probe_fp) hd_data->probe_fp = new_mem(sizeof *hd_data->probe_fp);
+  pf = hd_data->probe_fp;
+
+  /* shared by all modules */
+  crc64(&id0, hd_data->probe, sizeof hd_data->probe);
+  id = hd_data->flags.fast | (hd_data->flags.list_md << 1);
+  crc64(&id0, &id, sizeof id);
+  for(sl = sl0 = read_file(PROC_MODULES, 0, 0); sl; sl = sl->next) {
+    crc64(&id0, sl->str, strlen(sl->str) + 1);
+  }
+  free_str_list(sl0);
+
+  for(src = probe_fp_src; src < probe_fp_src + sizeof probe_fp_src / sizeof *probe_fp_src; src++) {
+    bit = 1ull << src->step;
+
+    if(!hd_probe_feature(hd_data, src->feature)) {
+      pf->valid &= ~bit;
+      continue;
+    }
+
+    id = id0;
+    for(s = src->dirs; *s; s++) probe_fp_dir(&id, *s, src->attr);
+    for(s = src->files; *s; s++) probe_fp_file(&id, *s);
+
+    if(!(pf->valid & bit) || pf->fp[src->step] != id) run |= bit;
+
+    pf->fp[src->step] = id;
+    pf->valid |= bit;
+    cached |= bit;
+  }
+
+  /* run everything that depends on modules we have to run */
+  do {
+    run_old = run;
+    for(src = probe_fp_src; src < probe_fp_src + sizeof probe_fp_src / sizeof *probe_fp_src; src++) {
+      if(src->deps & run) run |= 1ull << src->step;
+    }
+  } while(run != run_old);
+
+  ADD2LOG("incremental scan: keeping");
+  for(src = probe_fp_src; src < probe_fp_src + sizeof probe_fp_src / sizeof *probe_fp_src; src++) {
+    if(cached & ~run & (1ull << src->step)) ADD2LOG(" %s", pr_flags_by_id(src->feature)->name);
+  }
+  ADD2LOG("\n");
+
+  return cached & ~run;
+}
+
+
+/*
+ * Add directory entries (with link target, driver, and attribute attr) to id.
+ */
+void probe_fp_dir(uint64_t *id, char *dir, char *attr)
+{
+  str_list_t *sl, *sl0;
+  char *path, *s;
+
+  for(sl = sl0 = read_dir(dir, 0); sl; sl = sl->next) {
+    crc64(id, sl->str, strlen(sl->str) + 1);
+
+    if(!(path = new_str(hd_read_sysfs_link(dir, sl->str)))) continue;
+
+    crc64(id, path, strlen(path) + 1);
+    if((s = hd_read_sysfs_link(path, "driver"))) crc64(id, s, strlen(s) + 1);
+    if(attr && (s = get_sysfs_attr_by_path(path, attr))) crc64(id, s, strlen(s) + 1);
+
+    free_mem(path);
+  }
+
+  free_str_list(sl0);
+}
+
+
+/*
+ * Add file content to id.
+ */
+void probe_fp_file(uint64_t *id, char *name)
+{
+  str_list_t *sl, *sl0;
+
+  for(sl = sl0 = read_file(name, 0, 0); sl; sl = sl->next) {
+    crc64(id, sl->str, strlen(sl->str) + 1);
+  }
+
+  free_str_list(sl0);
+}
+
+
 int hd_report_this(hd_data_t *hd_data, hd_t *hd)
 {
   if(!hd_data->only) return 1;
@@ -5934,6 +8270,71 @@ int hd_report_this(hd_data_t *hd_data, hd_t *hd)
 }
 
 
+/*
+ * Check if sysfs path (with or without leading "/sys") is at or below
+ * the subtree hd_scan_sysfs_path() is looking at.
+ *
+ * With 'parents' set, the devices above the subtree qualify, too: they are
+ * probed as well, so entries in the subtree get the same parent links as
+ * with a full scan.
+ *
+ * Without hd_scan_sysfs_path() every path qualifies.
+ */
+int sysfs_scope_check(hd_data_t *hd_data, char *path, int parents)
+{
+  size_t len;
+
+  if(!hd_data->sysfs_scope) return 1;
+
+  if(!path) return 0;
+
+  if(!strncmp(path, "/sys/", sizeof "/sys/" - 1)) path += sizeof "/sys" - 1;
+
+  len = strlen(hd_data->sysfs_scope);
+
+  if(!strncmp(path, hd_data->sysfs_scope, len) && (!path[len] || path[len] == '/')) return 1;
+
+  if(!parents) return 0;
+
+  len = strlen(path);
+
+  return !strncmp(hd_data->sysfs_scope, path, len) && hd_data->sysfs_scope[len] == '/';
+}
+
+
+/*
+ * Check if sysfs path belongs to what hd_scan_sysfs_path() probes: the
+ * subtree and the devices above it (cf. sysfs_scope_check()).
+ */
+int hd_sysfs_in_scope(hd_data_t *hd_data, char *path)
+{
+  return sysfs_scope_check(hd_data, path, 1);
+}
+
+
+/*
+ * Check if hardware entry belongs to the subtree hd_scan_sysfs_path() is
+ * looking at; with 'parents' set, also if it is above it.
+ *
+ * Entries for class devices (like /class/net/eth0) qualify if the class
+ * device or its parent device does.
+ */
+int hd_entry_in_scope(hd_data_t *hd_data, hd_t *hd, int parents)
+{
+  if(!hd_data->sysfs_scope) return 1;
+
+  if(sysfs_scope_check(hd_data, hd->sysfs_device_link, parents)) return 1;
+
+  if(!hd->sysfs_id) return 0;
+
+  if(!strncmp(hd->sysfs_id, "/devices/", sizeof "/devices/" - 1)) {
+    return sysfs_scope_check(hd_data, hd->sysfs_id, parents);
+  }
+
+  return sysfs_scope_check(hd_data, hd_read_sysfs_link("/sys", hd->sysfs_id + 1), parents);
+}
+
+
 str_list_t *hd_module_list(hd_data_t *hd_data, unsigned id)
 {
   hd_t *hd;
@@ -5982,6 +8383,7 @@ API_SYM int hd_read_mmap(hd_data_t *hd_data, char *name, unsigned char *buf, off
 
   map_size = (xofs + size + psize - 1) & -psize;
 
+  probe_count.files++;
   fd = open(name, O_RDONLY);
 
   if(fd == -1) return 0;
@@ -6043,11 +8445,9 @@ char *hd_get_hddb_dir()
  */
 char *hd_get_hddb_path(char *sub)
 {
-  static char *dir = NULL;
+  str_printf(&tls_buf.hddb_path, 0, "%s/%s", hd_get_hddb_dir(), sub);
 
-  str_printf(&dir, 0, "%s/%s", hd_get_hddb_dir(), sub);
-
-  return dir;
+  return tls_buf.hddb_path;
 }
 
 
@@ -6074,11 +8474,9 @@ int hd_attr_uint(char* attr, uint64_t* u, int base)
  */
 str_list_t *hd_attr_list(char *str)
 {
-  static str_list_t *sl = NULL;
-
-  free_str_list(sl);
+  free_str_list(tls_buf.attr_list);
 
-  return sl = hd_split('\n', str);
+  return tls_buf.attr_list = hd_split('\n', str);
 }
 
 
@@ -6099,19 +8497,17 @@ char *hd_sysfs_id(char *path)
  */
 char *hd_sysfs_name2_dev(char *str)
 {
-  static char *s = NULL;
-
   if(!str) return NULL;
 
-  free_mem(s);
-  s = str = new_str(str);
+  free_mem(tls_buf.name2_dev);
+  tls_buf.name2_dev = str = new_str(str);
 
   while(*str) {
     if(*str == '!') *str = '/';
     str++;
   }
 
-  return s;
+  return tls_buf.name2_dev;
 }
 
 
@@ -6120,27 +8516,26 @@ char *hd_sysfs_name2_dev(char *str)
  */
 char *hd_sysfs_dev2_name(char *str)
 {
-  static char *s = NULL;
-
   if(!str) return NULL;
 
-  free_mem(s);
-  s = str = new_str(str);
+  free_mem(tls_buf.dev2_name);
+  tls_buf.dev2_name = str = new_str(str);
 
   while(*str) {
     if(*str == '/') *str = '!';
     str++;
   }
 
-  return s;
+  return tls_buf.dev2_name;
 }
 
 
 char* get_sysfs_attr(const char* bus, const char* device, const char* attr)
 {
-  static char buf[256];
+  static __thread char buf[256];
   FILE* fp;
   sprintf(buf, "/sys/bus/%s/devices/%s/%s", bus, device, attr);
+  probe_count.files++;
   fp = fopen(buf, "r");
   if(!fp) return NULL;
   fgets(buf, 127, fp);
@@ -6163,18 +8558,20 @@ char *get_sysfs_attr_by_path(const char *path, const char *attr)
  */
 char *get_sysfs_attr_by_path2(const char *path, const char *attr, unsigned *len)
 {
-  static char *buf = NULL;
-  char * ptr;
+  char *buf, *ptr;
   int i, fd, max;
 
   if(len) *len = 0;
 
   // init static buffer on first run
-  if(!buf) buf = new_mem(MAX_ATTR_SIZE + 1);
+  if(!tls_buf.sysfs_attr) tls_buf.sysfs_attr = new_mem(MAX_ATTR_SIZE + 1);
+
+  buf = tls_buf.sysfs_attr;
 
   if(!buf) return NULL;
 
   sprintf(buf, "%s/%s", path, attr);
+  probe_count.files++;
   fd = open(buf, O_RDONLY);
   if(fd >= 0) {
     max = MAX_ATTR_SIZE;
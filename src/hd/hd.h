@@ -54,6 +54,7 @@ extern "C" {
 #define HD_DEB_ISA		(1 << 21)
 #define HD_DEB_BOOT		(1 << 22)
 #define HD_DEB_HDDB		(1 << 23)
+#define HD_DEB_LOG_FILTER	(1 << 24)	/**< log only probing modules whose debug flag is set */
 /** @} */
 
 #include <stdio.h>
@@ -68,6 +69,21 @@ extern "C" {
  */
 #define HARDWARE_DIR		"/var/lib/hardware"
 
+/**
+ * hardware config status, see \ref hd_write_config()
+ */
+#define HARDWARE_UNIQUE_KEYS	HARDWARE_DIR "/unique-keys"
+
+/**
+ * default scan cache, see \ref hd_cache_save()
+ */
+#define HD_CACHE_FILE		"/run/hwinfo/scan.cache"
+
+/**
+ * config store, relative to libhd's directory, see \ref hd_config_import()
+ */
+#define HD_CONFIG_DB		"config.db"
+
 /**
  * \defgroup idmacros ID macros
  * Macros to handle device and vendor ids.
@@ -123,7 +139,7 @@ typedef enum probe_feature {
   pr_bios_fb, pr_bios_mode, pr_input, pr_block_mods, pr_bios_vesa,
   pr_cpuemu_debug, pr_scsi_noserial, pr_wlan, pr_bios_crc, pr_hal,
   pr_bios_vram, pr_bios_acpi, pr_bios_ddc_ports, pr_modules_pata,
-  pr_net_eeprom, pr_x86emu,
+  pr_net_eeprom, pr_x86emu, pr_threads, pr_watchdog,
   pr_max, pr_lxrc, pr_default, 
   pr_all		/**< pr_all must be last */
 } hd_probe_feature_t;
@@ -1004,6 +1020,25 @@ typedef struct s_sysfsdrv_t {
 } hd_sysfsdrv_t;
 
 
+/**
+ * Probing statistics.
+ * There is one entry per probing module and one per progress step. Times
+ * are in microseconds. See \ref hd_probe_stats().
+ */
+typedef struct s_hd_probe_stats_t {
+  struct s_hd_probe_stats_t *next;
+  char *name;			/**< module name (e.g. "pci") or progress step (e.g. "pci.2") */
+  char *info;			/**< progress step description, NULL for modules */
+  unsigned module;		/**< probing module */
+  unsigned runs;		/**< number of times the step was run */
+  uint64_t wall_time;		/**< elapsed time */
+  uint64_t cpu_time;		/**< CPU time, including child processes */
+  unsigned files;		/**< files opened */
+  uint64_t bytes;		/**< bytes read */
+  unsigned children;		/**< child processes started */
+} hd_probe_stats_t;
+
+
 /**
  * device number; type is either 0 or 'b' or 'c'.
  *
@@ -1548,6 +1583,9 @@ typedef struct {
   unsigned *ids;
   unsigned strings_len, strings_max;
   char *strings;
+  void *map;			/**< binary data base (if mapped) */
+  size_t map_size;		/**< size of map */
+  struct hddb_index_s *index;	/**< search index, see hddb_build_index() */
 } hddb2_data_t;
 
 
@@ -2519,6 +2557,7 @@ typedef struct s_hd_t {
     unsigned skip_modem:1;	/**< if serial line, don't scan for modems */
     unsigned skip_braille:1;	/**< if serial line, don't scan for braille devices */
     unsigned ser_device:2;	/**< if != 0: info about attached serial device; see serial.c */
+    unsigned reported:1;	/**< passed to device callback; see hd_set_device_callback() */
   } tag;
 
   /**
@@ -2605,6 +2644,25 @@ typedef struct s_hd_t {
 } hd_t;
 
 
+/**
+ * Iterator over the current hardware list.
+ * Set it up with \ref hd_iter_init() or \ref hd_iter_init2() and fetch the
+ * matching entries with \ref hd_iter_next(). The entries are not copied; they
+ * belong to hd_data and stay valid until the next \ref hd_scan() or
+ * \ref hd_free_hd_data(). Don't modify or free them.
+ */
+typedef struct {
+  hd_t *next;			/**< (Internal) next entry to check */
+  hd_hw_item_t *items;		/**< (Internal) 0 terminated list of hw classes */
+  hd_hw_item_t item[2];		/**< (Internal) storage for a single hw class */
+  hd_status_t status;		/**< (Internal) status filter, cf. \ref hd_iter_set_status() */
+  unsigned pos;			/**< (Internal) next position to check in hw class index */
+  unsigned with_status:1;	/**< (Internal) status filter is active */
+  unsigned is_manual:1;		/**< (Internal) items contains hw_manual */
+  unsigned use_index:1;		/**< (Internal) look up candidates in hw class index */
+} hd_iter_t;
+
+
 /**
  * Holds all data accumulated during hardware probing.
  */
@@ -2629,6 +2687,9 @@ typedef struct {
   /** 
    * @brief Log messages.
    * All messages logged during hardware probing accumulate here.
+   * Set flags.nolog if you don't need them. If a log sink has been
+   * registered with \ref hd_set_log_sink(), this holds only the part
+   * not yet passed on.
    */
   char *log;
 
@@ -2637,6 +2698,8 @@ typedef struct {
    * Although there exist some debug flag defines this scheme is currently
    * not followed consistently. It is guaranteed however that -1 will give
    * the most log messages and 0 the least.
+   * If HD_DEB_LOG_FILTER is set, messages of probing modules that have a
+   * debug flag (e.g. HD_DEB_PCI) are logged only if that flag is set, too.
    * @see DEBUGpub
    */
   unsigned debug;
@@ -2668,6 +2731,10 @@ typedef struct {
     unsigned vbox:1;		/**< running in virtual box  */
     unsigned vmware:1;		/**< running in vmware  */
     unsigned vmware_mouse:1;	/**< has vmware mouse */
+    unsigned stats:1;		/**< collect probing statistics, see \ref hd_probe_stats() */
+    unsigned nolog:1;		/**< don't log anything (hd_data_t::log stays empty) */
+    unsigned incremental:1;	/**< on rescan, keep results of probing modules whose input hasn't changed */
+    unsigned worker:1;		/**< internal: probing module runs in a thread, see hd_scan_threaded() */
   } flags;
 
 
@@ -2737,11 +2804,31 @@ typedef struct {
   str_list_t *scanner_db;	/**< (Internal) list of scanner modules */
   edd_info_t edd[0x80];		/**< (Internal) enhanced disk drive data */
   hal_device_t *hal;		/**< (Internal) HAL data (if any) */
-  str_list_t *lsscsi;		/**< (Internal) lsscsi result (if any) */
+  str_list_t *lsscsi;		/**< (Internal) no longer used */
   struct vm_s *vm;		/**< (Internal) x86emu vm */
   size_t log_size;		/**< (Internal) current log size (including final 0) */
   size_t log_max;		/**< (Internal) log buffer size */
   str_list_t *klog_raw;		/**< (Internal) unmodified kernel log */
+  hd_probe_stats_t *stats;	/**< (Internal) probing statistics */
+  struct probe_stats_mark_s *stats_mark;	/**< (Internal) current probing step */
+  struct modinfo_index_s *modinfo_index;	/**< (Internal) search index for modinfo */
+  int udev_db;			/**< (Internal) udev data source: 0 = not checked, 1 = UDEV_DATA_DIR, 2 = udevadm */
+  void (*log_sink)(void *data, const char *buf, size_t len);	/**< (Internal) log consumer, see \ref hd_set_log_sink() */
+  void *log_sink_data;		/**< (Internal) argument passed to log_sink */
+  struct hd_index_s *hd_index;	/**< (Internal) lookup tables for hd list */
+  hd_t *last_hd;		/**< (Internal) entry last added to hd list */
+  struct hd_arena_s *arena;	/**< (Internal) memory for data that is valid until the next \ref hd_scan() */
+  struct hd_arena_s *sysfsdrv_arena;	/**< (Internal) memory for sysfsdrv */
+  struct hd_class_index_s *class_index;	/**< (Internal) hw class index for hd list */
+  char *sysfs_scope;		/**< (Internal) sysfs subtree to probe, see \ref hd_scan_sysfs_path() */
+  struct probe_fp_s *probe_fp;	/**< (Internal) input fingerprints of probing modules, see \ref hd_data_t::flags::incremental */
+  void (*device_cb)(void *data, hd_t *hd);	/**< (Internal) new device consumer, see \ref hd_set_device_callback() */
+  void *device_cb_data;		/**< (Internal) argument passed to device_cb */
+  struct hd_config_db_s *config_db;	/**< (Internal) mapped config store, see \ref hd_config_import() */
+  uint64_t io_deadline;		/**< (Internal) serial I/O deadline of the current probing step in us (CLOCK_MONOTONIC), 0: none */
+  uint64_t io_stop;		/**< (Internal) io_deadline is not extended beyond this */
+  unsigned io_timeout;		/**< (Internal) io_deadline is extended by this many seconds on progress */
+  struct hd_udev_index_s *udev_index;	/**< (Internal) udevinfo by sysfs path and device name */
 } hd_data_t;
 
 
@@ -2763,6 +2850,9 @@ hd_data_t *hd_free_hd_data(hd_data_t *hd_data);
 //! Free hardware items returned by e.g. \ref hd_list().
 hd_t *hd_free_hd_list(hd_t *hd);
 
+//! Free entries replaced by rescans; only if no lists from \ref hd_list() are left.
+void hd_free_old_hd_entries(hd_data_t *hd_data);
+
 void hd_set_probe_feature(hd_data_t *hd_data, enum probe_feature feature);
 void hd_clear_probe_feature(hd_data_t *hd_data, enum probe_feature feature);
 int hd_probe_feature(hd_data_t *hd_data, enum probe_feature feature);
@@ -2773,6 +2863,13 @@ char *hd_probe_feature_by_value(enum probe_feature feature);
 
 int hd_module_is_active(hd_data_t *hd_data, char *mod);
 
+hd_probe_stats_t *hd_probe_stats(hd_data_t *hd_data);
+
+void hd_set_log_sink(hd_data_t *hd_data, void (*sink)(void *data, const char *buf, size_t len), void *data);
+void hd_set_device_callback(hd_data_t *hd_data, void (*cb)(void *data, hd_t *hd), void *data);
+void hd_log_flush(hd_data_t *hd_data);
+int hd_log_enabled(hd_data_t *hd_data);
+
 hd_t *hd_base_class_list(hd_data_t *hd_data, unsigned base_class);
 hd_t *hd_sub_class_list(hd_data_t *hd_data, unsigned base_class, unsigned sub_class);
 hd_t *hd_bus_list(hd_data_t *hd_data, unsigned bus);
@@ -2781,6 +2878,12 @@ hd_t *hd_list(hd_data_t *hd_data, hd_hw_item_t item, int rescan, hd_t *hd_old);
 hd_t *hd_list_with_status(hd_data_t *hd_data, hd_hw_item_t item, hd_status_t status);
 hd_t *hd_list2(hd_data_t *hd_data, hd_hw_item_t *items, int rescan);
 hd_t *hd_list_with_status2(hd_data_t *hd_data, hd_hw_item_t *items, hd_status_t status);
+hd_t *hd_scan_sysfs_path(hd_data_t *hd_data, char *path);
+
+void hd_iter_init(hd_data_t *hd_data, hd_iter_t *iter, hd_hw_item_t item);
+void hd_iter_init2(hd_data_t *hd_data, hd_iter_t *iter, hd_hw_item_t *items);
+void hd_iter_set_status(hd_iter_t *iter, hd_status_t status);
+hd_t *hd_iter_next(hd_data_t *hd_data, hd_iter_t *iter);
 
 void hd_add_driver_data(hd_data_t *hd_data, hd_t *hd);
 
@@ -2818,6 +2921,7 @@ int hd_write_properties(const char *udi, hal_prop_t *prop);
 
 int hd_change_status(const char *id, hd_status_t status, const char *config_string);
 int hd_change_config_status(hd_data_t *hd_data, const char *id, hd_status_t status, const char *config_string);
+int hd_set_config_status(hd_data_t *hd_data, const char *id, unsigned type, const char *val);
 int hd_read_mmap(hd_data_t *hd_data, char *name, unsigned char *buf, off_t start, unsigned size);
 
 str_list_t *hd_read_file(char *file_name, unsigned start_line, unsigned lines);
@@ -2865,6 +2969,10 @@ int hd_manual_write_entry(hd_data_t *hd_data, hd_manual_t *entry);
 hd_manual_t *hd_free_manual(hd_manual_t *manual);
 hd_t *hd_read_config(hd_data_t *hd_data, const char *id);
 int hd_write_config(hd_data_t *hd_data, hd_t *hd);
+int hd_write_config_list(hd_data_t *hd_data, hd_t *hd);
+int hd_cache_load(hd_data_t *hd_data, const char *file);
+int hd_cache_save(hd_data_t *hd_data, const char *file);
+int hd_config_import(hd_data_t *hd_data);
 char *hd_hw_item_name(hd_hw_item_t item);
 hd_hw_item_t hd_hw_item_type(char *name);
 char *hd_status_value_name(hd_status_value_t status);
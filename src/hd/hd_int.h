@@ -26,6 +26,9 @@
 #define PROC_PARTITIONS		"/proc/partitions"
 #define PROC_APM		"/proc/apm"
 #define PROC_XEN_BALLOON	"/proc/xen/balloon"
+#define PROC_BOOT_ID		"/proc/sys/kernel/random/boot_id"
+
+#define SYS_UEVENT_SEQNUM	"/sys/kernel/uevent_seqnum"
 
 #define DEV_NVRAM		"/dev/nvram"
 #define DEV_PSAUX		"/dev/psaux"
@@ -44,6 +47,7 @@
 #define PROG_CARDCTL		"/sbin/cardctl"
 #define PROG_UDEVINFO		"/usr/bin/udevinfo"
 #define PROG_UDEVADM		"/usr/bin/udevadm"
+#define UDEV_DATA_DIR		"/run/udev/data"
 
 #define KLOG_BOOT		"/var/log/boot.msg"
 #define ISAPNP_CONF		"/etc/isapnp.conf"
@@ -62,8 +66,15 @@
 // (this is to avoid accidentally reading unlimited data)
 #define MAX_ATTR_SIZE		0x10000
 
+// log buffer size if log messages are passed on to a log sink
+#define HD_LOG_CHUNK		(64 << 10)
+
+// memory block size for hd_arena_t
+#define HD_ARENA_BLOCK		(64 << 10)
+
 #define PROGRESS(a, b, c) progress(hd_data, a, b, c)
-#define ADD2LOG(a...) hd_log_printf(hd_data, a)
+/* messages are not even formatted if logging is off */
+#define ADD2LOG(a...) do { if(hd_log_enabled(hd_data)) hd_log_printf(hd_data, a); } while(0)
 
 /*
  * define to make (hd_t).unique_id a hex string, otherwise it is a
@@ -90,6 +101,7 @@
 #define free_str_list		hd_free_str_list
 #define reverse_str_list	hd_reverse_str_list
 #define add_hd_entry		hd_add_hd_entry
+#define free_old_hd_entries	hd_free_old_hd_entries
 
 /*
  * Internal probing module numbers. Use mod_name_by_idx() outside of libhd.
@@ -108,6 +120,15 @@ void *resize_mem(void *, size_t);
 void *add_mem(void *, size_t, size_t);
 char *new_str(const char *);
 void *free_mem(void *);
+
+typedef struct hd_arena_s hd_arena_t;
+
+void *arena_alloc(hd_arena_t **arena, size_t size);
+char *arena_str(hd_arena_t **arena, const char *s);
+str_list_t *arena_add_str_list(hd_arena_t **arena, str_list_t ***last, char *str);
+hd_arena_t *arena_free(hd_arena_t *arena);
+void arena_join(hd_arena_t **arena, hd_arena_t *arena2);
+
 int have_common_res(hd_res_t *res1, hd_res_t *res2);
 void join_res_io(hd_res_t **res1, hd_res_t *res2);
 void join_res_irq(hd_res_t **res1, hd_res_t *res2);
@@ -150,6 +171,7 @@ char *float2str(int i, int n);
 char *mod_name_by_idx(unsigned idx);
 
 int hd_timeout(void(*func)(void *), void *arg, int timeout);
+pid_t hd_waitpid(pid_t pid, int *status);
 
 str_list_t *read_kmods(hd_data_t *hd_data);
 char *get_cmd_param(hd_data_t *hd_data, int field);
@@ -201,11 +223,20 @@ void hd_shm_done(hd_data_t *hd_data);
 void *hd_shm_add(hd_data_t *hd_data, void *ptr, unsigned len);
 int hd_is_shm_ptr(hd_data_t *hd_data, void *ptr);
 void hd_move_to_shm(hd_data_t *hd_data);
+int hd_timed_out(hd_data_t *hd_data);
+int hd_watched(hd_data_t *hd_data);
+int hd_read_timeout(hd_data_t *hd_data, int fd, void *buf, unsigned len, int ms);
+int hd_write_timeout(hd_data_t *hd_data, int fd, const void *buf, unsigned len, int ms);
 
-void read_udevinfo(hd_data_t *hd_data);
+hd_udevinfo_t *hd_get_udevinfo(hd_data_t *hd_data, char *sysfs_id);
+hd_udevinfo_t *hd_get_udevinfo_by_name(hd_data_t *hd_data, char *name);
 
 hd_t *hd_find_sysfs_id(hd_data_t *hd_data, char *id);
 hd_t *hd_find_sysfs_id_devname(hd_data_t *hd_data, char *id, char *devname);
+hd_t *hd_find_unix_dev_name(hd_data_t *hd_data, char *dev_name, hd_t *hd);
+void hd_index_changed(hd_data_t *hd_data, hd_t *hd);
+void hd_index_reset(hd_data_t *hd_data);
+hd_t *hd_get_device_by_id(hd_data_t *hd_data, char *id);
 int hd_attr_uint(char* attr, uint64_t* u, int base);
 str_list_t *hd_attr_list(char *str);
 char *hd_sysfs_id(char *path);
@@ -214,6 +245,9 @@ char *hd_sysfs_dev2_name(char *str);
 void hd_sysfs_driver_list(hd_data_t *hd_data);
 char *hd_sysfs_find_driver(hd_data_t *hd_data, char *sysfs_id, int exact);
 int hd_report_this(hd_data_t *hd_data, hd_t *hd);
+int hd_sysfs_in_scope(hd_data_t *hd_data, char *path);
+int hd_entry_in_scope(hd_data_t *hd_data, hd_t *hd, int parents);
+void crc64(uint64_t *id, void *p, int len);
 str_list_t *hd_module_list(hd_data_t *hd_data, unsigned id);
 
 char* get_sysfs_attr(const char* bus, const char* device, const char* attr);
@@ -225,6 +259,16 @@ void hd_pci_read_data(hd_data_t *hd_data);
 
 hal_device_t *hd_free_hal_devices(hal_device_t *dev);
 char *hd_hal_print_prop(hal_prop_t *prop);
+void parse_property(hal_prop_t *prop, char *str);
+hal_prop_t *read_properties_file(const char *udi);
+int write_properties_file(const char *udi, hal_prop_t *prop);
+void sync_parent_dir(const char *file);
+int check_udi(const char *udi);
+
+struct hd_config_db_s *config_db_free(struct hd_config_db_s *db);
+int config_db_read(hd_data_t *hd_data, const char *key, hal_prop_t **prop);
+int config_db_write(hd_data_t *hd_data, const char *key, hal_prop_t *prop);
+int config_journal_replay(hd_data_t *hd_data);
 
 void hal_invalidate(hal_prop_t *prop);
 void hal_invalidate_all(hal_prop_t *prop, const char *key);
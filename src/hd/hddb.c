@@ -5,7 +5,12 @@
 #include <string.h>
 #include <ctype.h>
 #include <fnmatch.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/utsname.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #include "hd.h"
 #include "hd_int.h"
@@ -76,9 +81,12 @@ typedef struct {
 static void hddb_init_pci(hd_data_t *hd_data);
 static char *get_mi_field(char *str, char *tag, int field_len, unsigned *value, unsigned *has_value);
 static modinfo_t *parse_modinfo(str_list_t *file);
+static struct modinfo_index_s *modinfo_build_index(modinfo_t *modinfo);
+static unsigned *modinfo_candidates(struct modinfo_index_s *index, modinfo_t *match, unsigned *len);
 static driver_info_t *hd_modinfo_db(hd_data_t *hd_data, modinfo_t *modinfo_db, hd_t *hd, driver_info_t *drv_info);
 static int cmp_dir_entry_s(const void *p0, const void *p1);
 static void hddb_init_external(hd_data_t *hd_data);
+static hddb2_data_t *hddb_init_bin(hd_data_t *hd_data);
 
 static line_t *parse_line(char *str);
 static unsigned store_string(hddb2_data_t *x, char *str);
@@ -91,6 +99,13 @@ static hddb_entry_mask_t add_entry(hddb2_data_t *hddb2, tmp_entry_t *te, hddb_en
 static int compare_ids(hddb2_data_t *hddb, hddb_search_t *hs, hddb_entry_mask_t mask, unsigned key);
 static void complete_ids(hddb2_data_t *hddb, hddb_search_t *hs, hddb_entry_mask_t key_mask, hddb_entry_mask_t mask, unsigned val_idx);
 static int hddb_search(hd_data_t *hd_data, hddb_search_t *hs, int max_recursions);
+static void hddb_build_index(hddb2_data_t *hddb);
+static unsigned hddb_index_hash(unsigned bus, unsigned vendor, unsigned device);
+static int hddb_index_key(hddb2_data_t *hddb, unsigned u, unsigned *bus, unsigned *vendor, unsigned *device);
+#ifndef HDDB_EXTERNAL_ONLY
+static void hddb_internal_index(void);
+static void hddb_internal_free(void) __attribute__((destructor));
+#endif
 #ifdef HDDB_TEST
 static void test_db(hd_data_t *hd_data);
 #endif
@@ -128,6 +143,7 @@ void hddb_init_pci(hd_data_t *hd_data)
     }
 
     hd_data->modinfo = parse_modinfo(sl);
+    hd_data->modinfo_index = modinfo_build_index(hd_data->modinfo);
 
     sl = free_str_list(sl);
   }
@@ -254,6 +270,231 @@ modinfo_t *parse_modinfo(str_list_t *file)
 }
 
 
+/*
+ * Search index for modinfo.
+ *
+ * PCI aliases are put into hash buckets keyed by vendor & device id (either
+ * may be a wildcard). All other aliases are stored in a prefix trie, keyed
+ * by the literal part of the alias up to the first glob character.
+ *
+ * modinfo_candidates() returns the entries that may match, in modinfo order;
+ * they still have to be checked with match_modinfo().
+ */
+#define MI_NO_CHILD	(~0u)
+
+typedef struct {
+  unsigned child;		/**< first child node */
+  unsigned sibling;		/**< next node on same level */
+  unsigned entry;		/**< start index into entry list */
+  unsigned entry_len;		/**< number of entries */
+  unsigned char c;		/**< character leading to this node */
+} modinfo_node_t;
+
+typedef struct modinfo_index_s {
+  unsigned buckets;		/**< number of PCI buckets (power of 2) */
+  unsigned nodes;		/**< number of trie nodes (node 0 is the root) */
+  unsigned *bucket;		/**< buckets + 1 start indices into pci_entry */
+  unsigned *pci_entry;		/**< PCI entries, grouped by bucket */
+  modinfo_node_t *node;		/**< trie nodes */
+  unsigned *other_entry;	/**< non-PCI entries, grouped by trie node */
+} modinfo_index_t;
+
+
+static unsigned modinfo_hash(unsigned has_vendor, unsigned vendor, unsigned has_device, unsigned device)
+{
+  unsigned h = 0x811c9dc5;
+
+  h = (h ^ (has_vendor ? vendor : 0)) * 0x01000193;
+  h = (h ^ (has_device ? device : 0)) * 0x01000193;
+  h = (h ^ (has_vendor + 2 * has_device)) * 0x01000193;
+
+  return h ^ (h >> 16);
+}
+
+
+/*
+ * Length of literal prefix of a fnmatch() pattern.
+ */
+static unsigned modinfo_literal_len(char *s)
+{
+  return s ? strcspn(s, "*?[\\") : 0;
+}
+
+
+modinfo_index_t *modinfo_build_index(modinfo_t *modinfo)
+{
+  modinfo_index_t *index;
+  modinfo_node_t *node = NULL, *n;
+  unsigned u, v, len, entries, pci_entries = 0, nodes = 1, nodes_max = 0;
+  unsigned buckets, *key, *pos;
+  char *s;
+
+  if(!modinfo) return NULL;
+
+  for(entries = 0; modinfo[entries].type; entries++) {
+    if(modinfo[entries].type == mi_pci) pci_entries++;
+  }
+
+  if(!entries) return NULL;
+
+  /* key: PCI hash or trie node */
+  key = new_mem(entries * sizeof *key);
+
+  nodes_max = 1024;
+  node = new_mem(nodes_max * sizeof *node);
+  node->child = node->sibling = MI_NO_CHILD;
+
+  for(u = 0; u < entries; u++) {
+    if(modinfo[u].type == mi_pci) {
+      key[u] = modinfo_hash(
+        modinfo[u].pci.has.vendor, modinfo[u].pci.vendor,
+        modinfo[u].pci.has.device, modinfo[u].pci.device
+      );
+      continue;
+    }
+
+    s = modinfo[u].alias;
+    len = modinfo_literal_len(s);
+    for(v = 0; len--; s++) {
+      for(n = node + node[v].child; n != node + MI_NO_CHILD; n = node + n->sibling) {
+        if(n->c == (unsigned char) *s) break;
+      }
+      if(n != node + MI_NO_CHILD) {
+        v = n - node;
+        continue;
+      }
+      if(nodes == nodes_max) {
+        nodes_max *= 2;
+        node = resize_mem(node, nodes_max * sizeof *node);
+      }
+      n = node + nodes;
+      n->c = *s;
+      n->child = MI_NO_CHILD;
+      n->sibling = node[v].child;
+      n->entry = n->entry_len = 0;
+      node[v].child = nodes;
+      v = nodes++;
+    }
+    key[u] = v;
+    node[v].entry_len++;
+  }
+
+  for(buckets = 1; buckets < pci_entries; buckets <<= 1);
+
+  index = new_mem(
+    sizeof *index +
+    nodes * sizeof *node +
+    (buckets + 1 + entries) * sizeof (unsigned)
+  );
+  index->buckets = buckets;
+  index->nodes = nodes;
+  index->node = (modinfo_node_t *) (index + 1);
+  index->bucket = (unsigned *) (index->node + nodes);
+  index->pci_entry = index->bucket + buckets + 1;
+  index->other_entry = index->pci_entry + pci_entries;
+
+  memcpy(index->node, node, nodes * sizeof *node);
+  free_mem(node);
+
+  for(len = u = 0; u < nodes; u++) {
+    index->node[u].entry = len;
+    len += index->node[u].entry_len;
+    index->node[u].entry_len = 0;
+  }
+
+  for(u = 0; u < entries; u++) {
+    if(modinfo[u].type == mi_pci) index->bucket[(key[u] & (buckets - 1)) + 1]++;
+  }
+  for(u = 0; u < buckets; u++) index->bucket[u + 1] += index->bucket[u];
+
+  pos = new_mem(buckets * sizeof *pos);
+  memcpy(pos, index->bucket, buckets * sizeof *pos);
+
+  for(u = 0; u < entries; u++) {
+    if(modinfo[u].type == mi_pci) {
+      index->pci_entry[pos[key[u] & (buckets - 1)]++] = u;
+    }
+    else {
+      n = index->node + key[u];
+      index->other_entry[n->entry + n->entry_len++] = u;
+    }
+  }
+
+  free_mem(pos);
+  free_mem(key);
+
+  return index;
+}
+
+
+static int cmp_unsigned(const void *p0, const void *p1)
+{
+  unsigned u0 = *(const unsigned *) p0, u1 = *(const unsigned *) p1;
+
+  return u0 < u1 ? -1 : u0 > u1;
+}
+
+
+/*
+ * Get list of modinfo entries that might match.
+ *
+ * Returns a sorted list of entry numbers (free it with free_mem()).
+ */
+unsigned *modinfo_candidates(modinfo_index_t *index, modinfo_t *match, unsigned *len)
+{
+  unsigned u, v, h, keys = 0, buckets[4], total = 0, *list;
+  modinfo_node_t *n;
+  char *s;
+
+  *len = 0;
+
+  if(match->type == mi_pci) {
+    for(u = 0; u < 4; u++) {
+      if((u & 1) && !match->pci.has.vendor) continue;
+      if((u & 2) && !match->pci.has.device) continue;
+      h = modinfo_hash(u & 1, match->pci.vendor, u & 2 ? 1 : 0, match->pci.device) & (index->buckets - 1);
+      for(v = 0; v < keys; v++) if(buckets[v] == h) break;
+      if(v < keys) continue;
+      buckets[keys++] = h;
+      total += index->bucket[h + 1] - index->bucket[h];
+    }
+
+    list = new_mem((total + 1) * sizeof *list);
+
+    for(v = 0; v < keys; v++) {
+      for(u = index->bucket[buckets[v]]; u < index->bucket[buckets[v] + 1]; u++) {
+        list[(*len)++] = index->pci_entry[u];
+      }
+    }
+  }
+  else {
+    for(n = index->node, s = match->alias;; s++) {
+      total += n->entry_len;
+      if(!s || !*s || n->child == MI_NO_CHILD) break;
+      for(n = index->node + n->child; n->c != (unsigned char) *s; n = index->node + n->sibling) {
+        if(n->sibling == MI_NO_CHILD) break;
+      }
+      if(n->c != (unsigned char) *s) break;
+    }
+
+    list = new_mem((total + 1) * sizeof *list);
+
+    for(n = index->node, s = match->alias;; s++) {
+      for(u = 0; u < n->entry_len; u++) list[(*len)++] = index->other_entry[n->entry + u];
+      if(!s || !*s || n->child == MI_NO_CHILD) break;
+      for(n = index->node + n->child; n->c != (unsigned char) *s; n = index->node + n->sibling) {
+        if(n->sibling == MI_NO_CHILD) break;
+      }
+      if(n->c != (unsigned char) *s) break;
+    }
+  }
+
+  qsort(list, *len, sizeof *list, cmp_unsigned);
+
+  return list;
+}
+
+
 /**
  *  return prio, 0: no match 
  */
@@ -365,7 +606,8 @@ driver_info_t *hd_modinfo_db(hd_data_t *hd_data, modinfo_t *modinfo_db, hd_t *hd
   char *mod_list[16 /* arbitrary, > 0 */];
   int mod_prio[sizeof mod_list / sizeof *mod_list];
   int i, prio, mod_list_len;
-  modinfo_t match = { };
+  modinfo_t match = { }, *mi;
+  unsigned u, *cand = NULL, cand_len = 0;
 
   if(!modinfo_db) return drv_info;
 
@@ -415,8 +657,13 @@ driver_info_t *hd_modinfo_db(hd_data_t *hd_data, modinfo_t *modinfo_db, hd_t *hd
     }
   }
 
-  for(mod_list_len = 0; modinfo_db->type; modinfo_db++) {
-    if((prio = match_modinfo(hd_data, modinfo_db, &match))) {
+  if(modinfo_db == hd_data->modinfo && hd_data->modinfo_index) {
+    cand = modinfo_candidates(hd_data->modinfo_index, &match, &cand_len);
+  }
+
+  for(mod_list_len = 0, u = 0; cand ? u < cand_len : modinfo_db[u].type != mi_none; u++) {
+    mi = modinfo_db + (cand ? cand[u] : u);
+    if((prio = match_modinfo(hd_data, mi, &match))) {
       for(di2 = drv_info; di2; di2 = di2->next) {
         if(
           di2->any.type == di_module &&
@@ -424,12 +671,12 @@ driver_info_t *hd_modinfo_db(hd_data_t *hd_data, modinfo_t *modinfo_db, hd_t *hd
           (
             (
               di2->any.hddb0->str &&
-              !hd_mod_cmp(di2->any.hddb0->str, modinfo_db->module)
+              !hd_mod_cmp(di2->any.hddb0->str, mi->module)
             ) ||
             (
               di2->any.hddb0->next &&
               di2->any.hddb0->next->str &&
-              !hd_mod_cmp(di2->any.hddb0->next->str, modinfo_db->module)
+              !hd_mod_cmp(di2->any.hddb0->next->str, mi->module)
             )
           )
         ) break;
@@ -438,7 +685,7 @@ driver_info_t *hd_modinfo_db(hd_data_t *hd_data, modinfo_t *modinfo_db, hd_t *hd
       if(di2) continue;
 
       for(i = 0; i < mod_list_len; i++) {
-        if(!strcmp(mod_list[i], modinfo_db->module)) {
+        if(!strcmp(mod_list[i], mi->module)) {
           if(prio > mod_prio[i]) mod_prio[i] = prio;
           break;
         }
@@ -447,12 +694,14 @@ driver_info_t *hd_modinfo_db(hd_data_t *hd_data, modinfo_t *modinfo_db, hd_t *hd
       if(i < mod_list_len) continue;
 
       mod_prio[mod_list_len] = prio;
-      mod_list[mod_list_len++] = modinfo_db->module;
+      mod_list[mod_list_len++] = mi->module;
 
       if(mod_list_len >= sizeof mod_list / sizeof *mod_list) break;
     }
   }
 
+  free_mem(cand);
+
   if(!mod_list_len && hd->modalias && !strchr(hd->modalias, ':')) {
     mod_prio[mod_list_len] = 0;
     mod_list[mod_list_len++] = hd->modalias;
@@ -487,15 +736,38 @@ int cmp_dir_entry_s(const void *p0, const void *p1)
 }
 
 
+#ifndef HDDB_EXTERNAL_ONLY
+static pthread_once_t hddb_internal_once = PTHREAD_ONCE_INIT;
+
+/*
+ * The internal data base is shared by all hd_data_t instances (and probing
+ * threads); its index is built once and freed when libhd is unloaded.
+ */
+void hddb_internal_index()
+{
+  hddb_build_index(&hddb_internal);
+}
+
+
+void hddb_internal_free()
+{
+  hddb_internal.index = free_mem(hddb_internal.index);
+}
+#endif
+
+
 void hddb_init(hd_data_t *hd_data)
 {
   hddb_init_pci(hd_data);
   hddb_init_external(hd_data);
 
 #ifndef HDDB_EXTERNAL_ONLY
+  pthread_once(&hddb_internal_once, hddb_internal_index);
   hd_data->hddb2[1] = &hddb_internal;
 #endif
 
+  if(hd_data->hddb2[0]) hddb_build_index(hd_data->hddb2[0]);
+
 #ifdef HDDB_TEST
   test_db(hd_data);
 #endif
@@ -517,6 +789,8 @@ void hddb_init_external(hd_data_t *hd_data)
 
   if(hd_data->hddb2[0]) return;
 
+  if((hd_data->hddb2[0] = hddb_init_bin(hd_data))) return;
+
   hddb2 = hd_data->hddb2[0] = new_mem(sizeof *hd_data->hddb2[0]);
 
   sl0 = read_file(hd_get_hddb_path("hd.ids"), 0, 0);
@@ -697,6 +971,164 @@ void hddb_init_external(hd_data_t *hd_data)
 }
 
 
+/*
+ * Fingerprint of the text files of the external data base (hd.ids & the files in ids/).
+ *
+ * The number of files found is stored in *sources.
+ */
+uint64_t hddb_sources_id(unsigned *sources)
+{
+  str_list_t *sl, *id_dir;
+  uint64_t sources_id = 0, id;
+  char *s;
+
+  *sources = 0;
+
+  if(hddb_bin_file_id(hd_get_hddb_path("hd.ids"), &id)) {
+    (*sources)++;
+    sources_id += id;
+  }
+
+  id_dir = read_dir(hd_get_hddb_path("ids"), 0);
+  for(sl = id_dir; sl; sl = sl->next) {
+    asprintf(&s, "ids/%s", sl->str);
+    if(hddb_bin_file_id(hd_get_hddb_path(s), &id)) {
+      (*sources)++;
+      sources_id += id;
+    }
+    free(s);
+  }
+  free_str_list(id_dir);
+
+  return sources_id;
+}
+
+
+/*
+ * Check that all references in a mapped data base are within bounds.
+ *
+ * Every id chain must end in the ids array, each list entry must point to as
+ * many chains as its masks have bits, and all strings must be 0-terminated.
+ *
+ * Returns 1 if it is ok.
+ */
+static int hddb_bin_check(hddb2_data_t *hddb2)
+{
+  unsigned u, v, idx, fl;
+  hddb_entry_mask_t mask;
+  hddb_list_t *list;
+
+  if(hddb2->strings_len && hddb2->strings[hddb2->strings_len - 1]) return 0;
+
+  if(hddb2->ids_len && (hddb2->ids[hddb2->ids_len - 1] & (1 << 31))) return 0;
+
+  for(u = 0; u < hddb2->ids_len; u++) {
+    fl = DATA_FLAG(hddb2->ids[u]) & ~FLAG_CONT;
+    if(
+      (fl == FLAG_STRING || fl == FLAG_REGEXP) &&
+      DATA_VALUE(hddb2->ids[u]) >= hddb2->strings_len
+    ) return 0;
+  }
+
+  for(list = hddb2->list, u = 0; u < hddb2->list_len; u++, list++) {
+    for(v = 0; v < 2; v++) {
+      idx = v ? list->value : list->key;
+      mask = v ? list->value_mask : list->key_mask;
+      if(mask >> he_nomask) return 0;
+      for(; mask; mask >>= 1) {
+        if(!(mask & 1)) continue;
+        if(idx >= hddb2->ids_len) return 0;
+        while((hddb2->ids[idx] & (1 << 31))) idx++;
+        idx++;
+      }
+    }
+  }
+
+  return 1;
+}
+
+
+/*
+ * Map binary data base (cf. hddb_bin_header_t).
+ *
+ * Returns NULL if there is none or if it doesn't match the text files.
+ */
+static hddb2_data_t *hddb_init_bin(hd_data_t *hd_data)
+{
+  hddb_bin_header_t *head;
+  hddb2_data_t *hddb2;
+  struct stat sbuf;
+  uint64_t sources_id;
+  unsigned sources;
+  size_t size;
+  void *map;
+  int fd;
+
+  if((fd = open(hd_get_hddb_path(HDDB_BIN_FILE), O_RDONLY)) == -1) return NULL;
+
+  if(fstat(fd, &sbuf) || sbuf.st_size < sizeof *head) {
+    close(fd);
+    return NULL;
+  }
+
+  size = sbuf.st_size;
+  map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if(map == MAP_FAILED) return NULL;
+
+  head = map;
+
+  /* fingerprint of the text files we would read otherwise */
+  sources_id = hddb_sources_id(&sources);
+
+  if(
+    memcmp(head->magic, HDDB_BIN_MAGIC, sizeof head->magic) ||
+    head->version != HDDB_BIN_VERSION ||
+    head->list_entry_size != sizeof (hddb_list_t) ||
+    head->list_ofs % sizeof (unsigned) ||
+    head->ids_ofs % sizeof (unsigned) ||
+    head->list_ofs < sizeof *head ||
+    head->ids_ofs < sizeof *head ||
+    head->strings_ofs < sizeof *head ||
+    head->list_ofs + (uint64_t) head->list_len * sizeof (hddb_list_t) > size ||
+    head->ids_ofs + (uint64_t) head->ids_len * sizeof (unsigned) > size ||
+    head->strings_ofs + (uint64_t) head->strings_len > size
+  ) {
+    ADD2LOG("id file: %s: invalid\n", HDDB_BIN_FILE);
+    munmap(map, size);
+    return NULL;
+  }
+
+  if(head->sources != sources || head->sources_id != sources_id) {
+    ADD2LOG("id file: %s: outdated\n", HDDB_BIN_FILE);
+    munmap(map, size);
+    return NULL;
+  }
+
+  hddb2 = new_mem(sizeof *hddb2);
+
+  hddb2->list_len = hddb2->list_max = head->list_len;
+  hddb2->list = map + head->list_ofs;
+  hddb2->ids_len = hddb2->ids_max = head->ids_len;
+  hddb2->ids = map + head->ids_ofs;
+  hddb2->strings_len = hddb2->strings_max = head->strings_len;
+  hddb2->strings = map + head->strings_ofs;
+  hddb2->map = map;
+  hddb2->map_size = size;
+
+  if(!hddb_bin_check(hddb2)) {
+    ADD2LOG("id file: %s: invalid\n", HDDB_BIN_FILE);
+    munmap(map, size);
+    return free_mem(hddb2);
+  }
+
+  ADD2LOG("id file: %s\n", HDDB_BIN_FILE);
+
+  return hddb2;
+}
+
+
 line_t *parse_line(char *str)
 {
   static line_t l;
@@ -1729,10 +2161,244 @@ void complete_ids(
   }
 }
 
+/*
+ * Search index.
+ *
+ * Entries whose key has a plain vendor id (no range/mask) are put into hash
+ * buckets keyed by (bus id, vendor id, device id); bus & device id are
+ * HDDB_INDEX_ANY if the key doesn't have a plain value for them. All other
+ * entries go into the fallback list.
+ *
+ * Both bucket and fallback lists are sorted by entry number, so a search
+ * can merge them and visit the candidates in data base order.
+ */
+#define HDDB_INDEX_ANY		(1u << 31)
+#define HDDB_INDEX_NONE		(~0u)
+
+typedef struct hddb_index_s {
+  unsigned buckets;		/**< number of buckets (power of 2) */
+  unsigned fallback_len;	/**< entries in fallback list */
+  unsigned *bucket;		/**< buckets + 1 start indices into entry */
+  unsigned *entry;		/**< entry numbers, grouped by bucket */
+  unsigned *fallback;		/**< entry numbers not in any bucket */
+} hddb_index_t;
+
+
+unsigned hddb_index_hash(unsigned bus, unsigned vendor, unsigned device)
+{
+  unsigned h = 0x811c9dc5;
+
+  h = (h ^ bus) * 0x01000193;
+  h = (h ^ vendor) * 0x01000193;
+  h = (h ^ device) * 0x01000193;
+
+  return h ^ (h >> 16);
+}
+
+
+/*
+ * Get index key of list entry u.
+ *
+ * Returns 0 if the entry must go into the fallback list.
+ */
+int hddb_index_key(hddb2_data_t *hddb, unsigned u, unsigned *bus, unsigned *vendor, unsigned *device)
+{
+  hddb_entry_t ent;
+  hddb_entry_mask_t mask;
+  unsigned *ids, fl, plain;
+
+  *bus = *vendor = *device = HDDB_INDEX_ANY;
+
+  mask = hddb->list[u].key_mask;
+  if(!(mask & (1 << he_vendor_id))) return 0;
+
+  if(hddb->list[u].key >= hddb->ids_len) return 0;
+  ids = hddb->ids + hddb->list[u].key;
+
+  /* cf. compare_ids() */
+  for(ent = 0; ent < he_nomask && mask; ent++, mask >>= 1) {
+    if(!(mask & 1)) continue;
+
+    plain = 1;
+    while(((fl = DATA_FLAG(*ids)) & FLAG_CONT)) {
+      if(fl != (FLAG_CONT | FLAG_RANGE) && fl != (FLAG_CONT | FLAG_MASK)) break;
+      plain = 0;
+      ids++;
+    }
+
+    if((fl & ~FLAG_CONT) == FLAG_ID && plain) {
+      if(ent == he_bus_id) *bus = DATA_VALUE(*ids);
+      if(ent == he_vendor_id) *vendor = DATA_VALUE(*ids);
+      if(ent == he_device_id) *device = DATA_VALUE(*ids);
+    }
+
+    while((*ids & (1 << 31))) ids++;
+    ids++;
+  }
+
+  return *vendor != HDDB_INDEX_ANY;
+}
+
+
+/*
+ * Build search index for hddb_search().
+ *
+ * The index is a single memory block; free it with free_mem().
+ */
+void hddb_build_index(hddb2_data_t *hddb)
+{
+  hddb_index_t *index;
+  unsigned u, buckets, indexed = 0, fallback_len = 0, *hash, *pos;
+  unsigned bus, vendor, device;
+
+  if(hddb->index || !hddb->list_len) return;
+
+  hash = new_mem(hddb->list_len * sizeof *hash);
+
+  for(u = 0; u < hddb->list_len; u++) {
+    if(hddb_index_key(hddb, u, &bus, &vendor, &device)) {
+      hash[u] = hddb_index_hash(bus, vendor, device);
+      indexed++;
+    }
+    else {
+      hash[u] = HDDB_INDEX_NONE;
+      fallback_len++;
+    }
+  }
+
+  for(buckets = 1; buckets < indexed; buckets <<= 1);
+
+  index = new_mem(
+    sizeof *index + (buckets + 1 + indexed + fallback_len) * sizeof (unsigned)
+  );
+  index->buckets = buckets;
+  index->fallback_len = fallback_len;
+  index->bucket = (unsigned *) (index + 1);
+  index->entry = index->bucket + buckets + 1;
+  index->fallback = index->entry + indexed;
+
+  for(u = 0; u < hddb->list_len; u++) {
+    if(hash[u] != HDDB_INDEX_NONE) index->bucket[(hash[u] & (buckets - 1)) + 1]++;
+  }
+  for(u = 0; u < buckets; u++) index->bucket[u + 1] += index->bucket[u];
+
+  pos = new_mem(buckets * sizeof *pos);
+  memcpy(pos, index->bucket, buckets * sizeof *pos);
+
+  for(fallback_len = u = 0; u < hddb->list_len; u++) {
+    if(hash[u] != HDDB_INDEX_NONE) {
+      index->entry[pos[hash[u] & (buckets - 1)]++] = u;
+    }
+    else {
+      index->fallback[fallback_len++] = u;
+    }
+  }
+
+  free_mem(pos);
+  free_mem(hash);
+
+  hddb->index = index;
+}
+
+
+/*
+ * Check list entry u and add its values to hs.
+ */
+static inline void hddb_search_entry(hddb2_data_t *hddb, hddb_search_t *hs, unsigned u)
+{
+  if(
+    (hs->key & hddb->list[u].key_mask) == hddb->list[u].key_mask
+    /* && (hs->value & hddb->list[u].value_mask) != hddb->list[u].value_mask */
+  ) {
+    if(!compare_ids(hddb, hs, hddb->list[u].key_mask, hddb->list[u].key)) {
+      complete_ids(hddb, hs,
+        hddb->list[u].key_mask,
+        hddb->list[u].value_mask, hddb->list[u].value
+      );
+    }
+  }
+}
+
+
+/*
+ * Search a single data base, using the index if there is one.
+ *
+ * Candidates are visited in the same order as a linear scan would. As
+ * complete_ids() may change the ids the candidates were selected by, fall
+ * back to a linear scan for the remaining entries if that happens.
+ */
+static void hddb_search_db(hddb2_data_t *hddb, hddb_search_t *hs)
+{
+  hddb_index_t *index = hddb->index;
+  unsigned u, i, lists = 0, *list[5], *list_end[5];
+  unsigned bus, vendor, device, next, h, b;
+  unsigned keys[4][2], bucket[4], buckets = 0;
+
+  if(!index) {
+    for(u = 0; u < hddb->list_len; u++) hddb_search_entry(hddb, hs, u);
+
+    return;
+  }
+
+  bus = hs->bus.id;
+  vendor = hs->vendor.id;
+  device = hs->device.id;
+
+  list[lists] = index->fallback;
+  list_end[lists++] = index->fallback + index->fallback_len;
+
+  if((hs->key & (1 << he_vendor_id))) {
+    keys[0][0] = HDDB_INDEX_ANY;
+    keys[0][1] = HDDB_INDEX_ANY;
+    keys[1][0] = HDDB_INDEX_ANY;
+    keys[1][1] = device;
+    keys[2][0] = bus;
+    keys[2][1] = HDDB_INDEX_ANY;
+    keys[3][0] = bus;
+    keys[3][1] = device;
+
+    for(i = 0; i < 4; i++) {
+      if(keys[i][0] != HDDB_INDEX_ANY && !(hs->key & (1 << he_bus_id))) continue;
+      if(keys[i][1] != HDDB_INDEX_ANY && !(hs->key & (1 << he_device_id))) continue;
+
+      h = hddb_index_hash(keys[i][0], vendor, keys[i][1]) & (index->buckets - 1);
+
+      /* buckets may coincide */
+      for(b = 0; b < buckets; b++) {
+        if(bucket[b] == h) break;
+      }
+      if(b < buckets) continue;
+      bucket[buckets++] = h;
+
+      list[lists] = index->entry + index->bucket[h];
+      list_end[lists++] = index->entry + index->bucket[h + 1];
+    }
+  }
+
+  for(;;) {
+    for(next = HDDB_INDEX_NONE, i = 0; i < lists; i++) {
+      if(list[i] < list_end[i] && *list[i] < next) next = *list[i];
+    }
+
+    if(next == HDDB_INDEX_NONE) break;
+
+    for(i = 0; i < lists; i++) {
+      if(list[i] < list_end[i] && *list[i] == next) list[i]++;
+    }
+
+    hddb_search_entry(hddb, hs, next);
+
+    if(hs->bus.id != bus || hs->vendor.id != vendor || hs->device.id != device) {
+      for(u = next + 1; u < hddb->list_len; u++) hddb_search_entry(hddb, hs, u);
+
+      break;
+    }
+  }
+}
+
+
 int hddb_search(hd_data_t *hd_data, hddb_search_t *hs, int max_recursions)
 {
-  unsigned u;
-  int i;
   hddb2_data_t *hddb;
   int db_idx;
   hddb_entry_mask_t all_values = 0;
@@ -1745,20 +2411,7 @@ int hddb_search(hd_data_t *hd_data, hddb_search_t *hs, int max_recursions)
     for(db_idx = 0; (unsigned) db_idx < sizeof hd_data->hddb2 / sizeof *hd_data->hddb2; db_idx++) {
       if(!(hddb = hd_data->hddb2[db_idx])) continue;
 
-      for(u = 0; u < hddb->list_len; u++) {
-        if(
-          (hs->key & hddb->list[u].key_mask) == hddb->list[u].key_mask
-          /* && (hs->value & hddb->list[u].value_mask) != hddb->list[u].value_mask */
-        ) {
-          i = compare_ids(hddb, hs, hddb->list[u].key_mask, hddb->list[u].key);
-          if(!i) {
-            complete_ids(hddb, hs,
-              hddb->list[u].key_mask,
-              hddb->list[u].value_mask, hddb->list[u].value
-            );
-          }
-        }
-      }
+      hddb_search_db(hddb, hs);
     }
 
     all_values |= hs->value;
@@ -3047,7 +3700,7 @@ void expand_driver_info(hd_data_t *hd_data, hd_t *hd)
 
 char *module_cmd(hd_t *hd, char *cmd)
 {
-  static char buf[256];
+  static __thread char buf[256];
   char *s = buf;
   int idx, ofs;
   hd_res_t *res;
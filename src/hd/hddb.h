@@ -1,4 +1,5 @@
 void hddb_init(hd_data_t *hd_data);
+uint64_t hddb_sources_id(unsigned *sources);
 
 unsigned device_class(hd_data_t *hd_data, unsigned vendor, unsigned device);
 unsigned sub_device_class(hd_data_t *hd_data, unsigned vendor, unsigned device, unsigned sub_vendor, unsigned sub_device);
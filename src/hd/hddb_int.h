@@ -4,6 +4,10 @@
  *
  * - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
 #define DATA_VALUE(a)	((a) & ~(-1 << 28))
 #define DATA_FLAG(a)	(((a) >> 28) & 0xf)
 #define MAKE_DATA(a, b)	((a << 28) | (b))
@@ -54,3 +58,67 @@ static char *hddb_entry_strings[] = {
   "driver.mouse", "driver.display", "driver.any"
 };
 
+
+
+/*
+ * Binary data base, written by check_hd --bfile.
+ *
+ * It holds list, ids, and strings of a hddb2_data_t in native byte order
+ * and is mapped as is instead of parsing hd.ids & the files in ids/. The
+ * data base is only used as long as the text files it was built from are
+ * unchanged (cf. hddb_bin_file_id()).
+ */
+#define HDDB_BIN_FILE		"hd.ids.bin"
+#define HDDB_BIN_MAGIC		"hddb2bin"
+#define HDDB_BIN_VERSION	3
+
+typedef struct {
+  char magic[8];		/* HDDB_BIN_MAGIC */
+  uint32_t version;		/* HDDB_BIN_VERSION */
+  uint32_t list_entry_size;	/* sizeof (hddb_list_t) */
+  uint32_t sources;		/* number of source files */
+  uint32_t reserved;
+  uint64_t sources_id;		/* combined hddb_bin_file_id() of all source files */
+  uint32_t list_len, ids_len, strings_len;
+  uint32_t list_ofs, ids_ofs, strings_ofs;
+} hddb_bin_header_t;
+
+
+/*
+ * Fingerprint of a source file (base name, size, mtime, and inode).
+ *
+ * This is a stat() stamp, the file is not read. The mtime includes the
+ * nanoseconds, so an edit in the same second is noticed. As the inode is
+ * part of it, a binary data base built elsewhere and copied over is
+ * considered outdated.
+ *
+ * The values of all files are added up, so the order doesn't matter.
+ *
+ * Returns 0 if file is not a regular file.
+ */
+static inline int hddb_bin_file_id(const char *file, uint64_t *id)
+{
+  const char *name;
+  struct stat sbuf;
+  uint64_t u, v[4];
+
+  if(stat(file, &sbuf) || !S_ISREG(sbuf.st_mode)) return 0;
+
+  *id = 0xcbf29ce484222325ull;
+
+  if((name = strrchr(file, '/'))) file = name + 1;
+
+  for(; *file; file++) *id = (*id ^ (unsigned char) *file) * 0x100000001b3ull;
+
+  v[0] = sbuf.st_size;
+  v[1] = sbuf.st_mtim.tv_sec;
+  v[2] = sbuf.st_mtim.tv_nsec;
+  v[3] = sbuf.st_ino;
+
+  for(u = 0; u < sizeof v / sizeof *v; u++) {
+    *id = (*id ^ v[u]) * 0x100000001b3ull;
+    *id ^= *id >> 29;
+  }
+
+  return 1;
+}
@@ -20,7 +20,7 @@
  * @{
  */
 
-static void get_input_devices(hd_data_t *hd_data);
+static void get_input_devices(hd_data_t *hd_data, unsigned usb, unsigned other);
 static char *all_bits(char *str);
 static int test_bit(const char *str, unsigned bit);
 
@@ -41,7 +41,24 @@ void hd_scan_input(hd_data_t *hd_data)
 
   PROGRESS(2, 0, "input");
 
-  get_input_devices(hd_data);
+  /* usb devices change usb entries; in a probing thread, see hd_scan_input_link() */
+  get_input_devices(hd_data, !hd_data->flags.worker, 1);
+}
+
+
+/*
+ * The part of hd_scan_input() that is run in the main thread after the
+ * probing thread has finished (cf. probe_steps[]).
+ */
+void hd_scan_input_link(hd_data_t *hd_data)
+{
+  if(!hd_probe_feature(hd_data, pr_input)) return;
+
+  hd_data->module = mod_input;
+
+  PROGRESS(2, 1, "input usb");
+
+  get_input_devices(hd_data, 1, 0);
 }
 
 // note: hd_data parameter is needed for ADD2LOG macro
@@ -83,7 +100,11 @@ void add_joystick_details(hd_data_t *hd_data, hd_t *h, const char *key, const ch
 #define INP_REL		"B: REL="
 #define INP_ABS		"B: ABS="
 
-void get_input_devices(hd_data_t *hd_data)
+/*
+ * Add input devices: usb devices are added to the existing usb entries,
+ * all other devices get new entries (other).
+ */
+void get_input_devices(hd_data_t *hd_data, unsigned usb, unsigned other)
 {
   hd_t *hd;
   str_list_t *input, *sl, *sl1;
@@ -98,13 +119,28 @@ void get_input_devices(hd_data_t *hd_data)
 
   input = read_file("/proc/bus/input/devices", 0, 0);
 
-  ADD2LOG("----- /proc/bus/input/devices -----\n");
-  for(sl = input; sl; sl = sl->next) {
-    ADD2LOG("  %s", sl->str);
+  if(other) {
+    ADD2LOG("----- /proc/bus/input/devices -----\n");
+    for(sl = input; sl; sl = sl->next) {
+      ADD2LOG("  %s", sl->str);
+    }
+    ADD2LOG("----- /proc/bus/input/devices end -----\n");
   }
-  ADD2LOG("----- /proc/bus/input/devices end -----\n");
 
   for(ok = 0, sl = input; sl; sl = sl->next) {
+    /* not wanted this time */
+    if(*sl->str == '\n' && !((ok && bus == BUS_USB) ? usb : other)) {
+      ok = 0;
+
+      name = free_mem(name);
+      handlers = free_mem(handlers);
+      key = free_mem(key);
+      rel = free_mem(rel);
+      abso = free_mem(abso);
+
+      continue;
+    }
+
     if(*sl->str == '\n') {
       ADD2LOG("bus = %u, name = %s\n", bus, name);
       if(handlers) ADD2LOG("  handlers = %s\n", handlers);
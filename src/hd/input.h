@@ -1 +1,2 @@
 void hd_scan_input(hd_data_t *hd_data);
+void hd_scan_input_link(hd_data_t *hd_data);
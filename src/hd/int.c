@@ -36,6 +36,7 @@ static void new_id(hd_data_t *hd_data, hd_t *hd);
 static void int_modem(hd_data_t *hd_data);
 static void int_wlan(hd_data_t *hd_data);
 static void int_udev(hd_data_t *hd_data);
+static void add_udev_links(hd_t *hd, hd_udevinfo_t *ui);
 static void int_devicenames(hd_data_t *hd_data);
 #if defined(__i386__) || defined (__x86_64__)
 static void int_softraid(hd_data_t *hd_data);
@@ -200,12 +201,10 @@ int set_bios_id(hd_data_t *hd_data, hd_t *hd_ref, int bios_id)
 
   if(!hd_ref || !hd_ref->unix_dev_name) return 0;
 
-  for(hd = hd_data->hd; hd; hd = hd->next) {
+  for(hd = NULL; (hd = hd_find_unix_dev_name(hd_data, hd_ref->unix_dev_name, hd));) {
     if(
       hd->base_class.id == bc_storage_device &&
-      hd->sub_class.id == sc_sdev_disk &&
-      hd->unix_dev_name &&
-      !strcmp(hd->unix_dev_name, hd_ref->unix_dev_name)
+      hd->sub_class.id == sc_sdev_disk
     ) {
       str_printf(&hd->rom_id, 0, "0x%02x", bios_id);
       found = 1;
@@ -635,6 +634,8 @@ void int_fix_usb_scsi(hd_data_t *hd_data)
             free_mem(hd_scsi->unique_id);
             hd_scsi->unique_id = hd_usb->unique_id;
             hd_usb->unique_id = NULL;
+            hd_index_changed(hd_data, hd_scsi);
+            hd_index_changed(hd_data, hd_usb);
 
             add_res_entry(&hd_scsi->res, hd_usb->res);
             hd_usb->res = NULL;
@@ -843,6 +844,7 @@ void int_modem(hd_data_t *hd_data)
         hd->unix_dev_name = s;
         s = NULL;
         hd->unix_dev_num = dev_num;
+        hd_index_changed(hd_data, hd);
       }
     }
   }
@@ -944,11 +946,11 @@ void int_udev(hd_data_t *hd_data)
 {
   hd_udevinfo_t *ui;
   hd_t *hd;
-  str_list_t *sl;
+  str_list_t *sl, *sl_last;
 
-  if(!hd_data->udevinfo) read_udevinfo(hd_data);
+  hd_get_udevinfo(hd_data, NULL);
 
-  if(!hd_data->udevinfo) return;
+  if(hd_data->udev_db == 2 && !hd_data->udevinfo) return;
 
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(!hd->unix_dev_names && hd->unix_dev_name) {
@@ -957,29 +959,22 @@ void int_udev(hd_data_t *hd_data)
 
     if(!hd->sysfs_id) continue;
 
-    for(ui = hd_data->udevinfo; ui; ui = ui->next) {
-      if(ui->name && !strcmp(ui->sysfs, hd->sysfs_id)) {
-        if(!search_str_list(hd->unix_dev_names, ui->name)) {
-          add_str_list(&hd->unix_dev_names, ui->name);
-        }
-        for(sl = ui->links; sl; sl = sl->next) {
-          if(!search_str_list(hd->unix_dev_names, sl->str)) {
-            add_str_list(&hd->unix_dev_names, sl->str);
-          }
-        }
-
-        if(!hd->unix_dev_name || hd_data->flags.udev) {
-          sl = hd->unix_dev_names;
+    if((ui = hd_get_udevinfo(hd_data, hd->sysfs_id)) && ui->name) {
+      if(!search_str_list(hd->unix_dev_names, ui->name)) {
+        add_str_list(&hd->unix_dev_names, ui->name);
+      }
+      add_udev_links(hd, ui);
 
-          if(hd_data->flags.udev) {
-            /* use first link as canonical device name */
-            if(ui->links) sl = sl->next;
-          }
+      if(!hd->unix_dev_name || hd_data->flags.udev) {
+        sl = hd->unix_dev_names;
 
-          hd->unix_dev_name = new_str(sl->str);
+        if(hd_data->flags.udev) {
+          /* use first link as canonical device name */
+          if(ui->links) sl = sl->next;
         }
 
-        break;
+        hd->unix_dev_name = new_str(sl->str);
+        hd_index_changed(hd_data, hd);
       }
     }
   }
@@ -987,14 +982,26 @@ void int_udev(hd_data_t *hd_data)
   for(hd = hd_data->hd; hd; hd = hd->next) {
     if(!hd->unix_dev_names) continue;
 
-    for(ui = hd_data->udevinfo; ui; ui = ui->next) {
-      if(search_str_list(hd->unix_dev_names, ui->name)) {
-        for(sl = ui->links; sl; sl = sl->next) {
-          if(!search_str_list(hd->unix_dev_names, sl->str)) {
-            add_str_list(&hd->unix_dev_names, sl->str);
-          }
-        }
-      }
+    /* links added below are not device node names */
+    for(sl_last = hd->unix_dev_names; sl_last->next; sl_last = sl_last->next);
+
+    for(sl = hd->unix_dev_names; sl; sl = sl == sl_last ? NULL : sl->next) {
+      if((ui = hd_get_udevinfo_by_name(hd_data, sl->str))) add_udev_links(hd, ui);
+    }
+  }
+}
+
+
+/*
+ * Add udev links of ui to hd->unix_dev_names.
+ */
+void add_udev_links(hd_t *hd, hd_udevinfo_t *ui)
+{
+  str_list_t *sl;
+
+  for(sl = ui->links; sl; sl = sl->next) {
+    if(!search_str_list(hd->unix_dev_names, sl->str)) {
+      add_str_list(&hd->unix_dev_names, sl->str);
     }
   }
 }
@@ -78,13 +78,14 @@ void _read_klog(hd_data_t *hd_data)
 {
   char buf[0x2000 + 1], *s;
   int i, j, len, n;
-  str_list_t *sl, *sl1, *sl2, *sl_last, **ssl, *sl_next;
+  str_list_t *sl, *sl1, *sl2, *sl_last, **ssl, *sl_next, **sl2_next;
 
   /* some clean-up */
   hd_data->klog = free_str_list(hd_data->klog);
 
   sl1 = read_file(KLOG_BOOT, 0, 0);
   sl2 = NULL;
+  sl2_next = &sl2;
 
   /*
    * remove non-canonical lines (not starting with <[0-9]>) at the start and
@@ -126,7 +127,7 @@ void _read_klog(hd_data_t *hd_data)
       len = i - j + 1;
       s = new_mem(len + 1);
       memcpy(s, buf + j, len);
-      add_str_list(&sl2, s);
+      sl2_next = &add_str_list(sl2_next, s)->next;
       s = free_mem(s);
       j = i + 1;
     }
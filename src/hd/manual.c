@@ -1,17 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <ctype.h>
 #include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/utsname.h>
 
 #include "hd.h"
 #include "hd_int.h"
 #include "manual.h"
 #include "hddb.h"
+#include "smbios.h"
 
 /**
  * @defgroup Manualint UDI manual hardware 
@@ -34,6 +41,73 @@ static hash_t status_names[] = {
 
 #ifndef LIBHD_TINY
 
+/*
+ * Config store (HD_CONFIG_DB), created by hd_config_import().
+ *
+ * It replaces the udi/ and unique-keys/ directories: every write appends a
+ * record, a hash index (by udi or unique id) covers all records up to the
+ * last compaction. Records appended after the index ('tail') supersede
+ * older records with the same key.
+ *
+ * Layout: header, records, index, tail records.
+ *
+ * Only tail records up to the committed end count; a write appends its
+ * records, syncs them, and then updates and syncs the end in the header.
+ * So a write either happens completely or not at all.
+ *
+ * Version 1 stores had no committed end (all valid tail records count);
+ * they are still read and are rewritten as version 2 on the next write.
+ */
+/*
+ * Without a config store, hd_write_config_list() first writes all records
+ * (same format as in the store) to a journal in the hddb directory; its
+ * rename() commits the write. Then the udi/ files are updated and the
+ * journal is removed. A journal left over from a crash is replayed before
+ * udi/ is next read or written.
+ */
+#define HD_CONFIG_JOURNAL	"udi.journal"
+
+#define HD_CONFIG_MAGIC		"hdcfgdb"
+#define HD_CONFIG_VERSION	2
+
+/* size of a version 1 header */
+#define HD_CONFIG_HEADER_V1	offsetof(hd_config_header_t, end)
+
+typedef struct {
+  char magic[8];		/* HD_CONFIG_MAGIC */
+  uint32_t version;		/* HD_CONFIG_VERSION */
+  uint32_t records;		/* number of indexed records */
+  uint32_t index_ofs;		/* hd_config_slot_t[index_size] */
+  uint32_t index_size;		/* 0 or a power of 2 */
+  uint32_t end;			/* committed end; since version 2 */
+} hd_config_header_t;
+
+/*
+ * Index slot; ofs 0 marks a free slot.
+ *
+ * A record is: uint32_t len (including len itself, a multiple of 4), the
+ * key, the properties as '\n'-terminated lines, each string 0-terminated;
+ * padded with 0.
+ */
+typedef struct {
+  uint32_t hash, ofs;
+} hd_config_slot_t;
+
+struct hd_config_db_s {
+  char *map;
+  size_t size;			/* file & map size */
+  size_t end;			/* end of last valid committed record */
+  dev_t dev;
+  ino_t ino;
+  hd_config_header_t *head;
+  hd_config_slot_t *index;	/* in map */
+  unsigned tail_cnt;
+  hd_config_slot_t *tail;	/* records after index */
+  unsigned tail_size;		/* 0 or a power of 2 */
+  unsigned *tail_index;		/* hash table: 1-based tail entries, last record wins */
+};
+
+
 static void prop2hd(hd_data_t *hd_data, hd_t *hd, int status_only);
 static hal_prop_t *hal_get_new(hal_prop_t **list, const char *key);
 static void hd2prop_add_int32(hal_prop_t **list, const char *key, int32_t i);
@@ -44,15 +118,51 @@ static void hd2prop(hd_data_t *hd_data, hd_t *hd);
 
 static hal_prop_t *hd_manual_read_entry_old(const char *id);
 static hal_prop_t *read_properties(hd_data_t *hd_data, const char *udi, const char *id);
+static hal_prop_t *read_props(hd_data_t *hd_data, const char *udi);
+static hd_t *new_config_entry(hd_data_t *hd_data, hal_prop_t *prop);
+static hal_prop_t *parse_properties(char *s, char *s_end);
+static void cache_put(char **rec, const void *data, unsigned len);
+static void cache_put_str(char **rec, const char *str);
+static void cache_put_list(char **rec, str_list_t *sl);
+static int cache_nibble(int c);
+static void *cache_get(char **rec, unsigned *len);
+static int cache_get_fixed(char **rec, void *data, unsigned len);
+static str_list_t *cache_get_list(char **rec);
+static void hd2prop_cache_res(hal_prop_t **list, hd_res_t *res);
+static hd_res_t *prop2hd_cache_res(char *rec);
+static void hd2prop_cache_detail(hal_prop_t **list, hd_detail_t *d);
+static void prop2hd_cache_detail(hd_t *hd, char *rec);
+static void hd2prop_cache_driver_info(hal_prop_t **list, driver_info_t *di);
+static driver_info_t *prop2hd_cache_driver_info(char *rec);
+static void hd2prop_cache(hd_t *hd, hal_prop_t **list);
+static void prop2hd_cache(hd_t *hd, hal_prop_t *list);
+static void hd2prop_cache_global(hd_data_t *hd_data, hal_prop_t **list);
+static void prop2hd_cache_global(hd_data_t *hd_data, hal_prop_t *list);
+static uint64_t cache_key(hd_data_t *hd_data);
+
+static uint32_t config_hash(const char *key);
+static char *config_db_record(struct hd_config_db_s *db, uint32_t ofs, char **props);
+static unsigned config_db_tail_find(struct hd_config_db_s *db, const char *key, uint32_t hash, unsigned **slot);
+static void config_db_unmap(struct hd_config_db_s *db);
+static struct hd_config_db_s *config_db_open(hd_data_t *hd_data, struct hd_config_db_s *db);
+static char *config_db_find(struct hd_config_db_s *db, const char *key);
+static char *config_db_next(struct hd_config_db_s *db, unsigned *pos, uint32_t *ofs);
+static void config_db_add(char **buf, unsigned *len, const char *key, hal_prop_t *prop);
+static int config_db_compact(hd_data_t *hd_data, struct hd_config_db_s *db, const char *file, char *buf, unsigned len);
+static int config_db_append(hd_data_t *hd_data, char *buf, unsigned len, unsigned records, int compact);
+static int config_journal_write(hd_data_t *hd_data, char *buf, unsigned len);
 
 
 void hd_scan_manual(hd_data_t *hd_data)
 {
   DIR *dir;
   struct dirent *de;
+  struct hd_config_db_s *db;
+  unsigned pos;
+  uint32_t ofs;
   int i, j;
   hd_t *hd, *hd1, *next, *hdm, **next2;
-  char *s;
+  char *s, *props;
   char *udi_dir[] = { "/org/freedesktop/Hal/devices", "", "" };
 
   if(!hd_probe_feature(hd_data, pr_manual)) return;
@@ -71,8 +181,28 @@ void hd_scan_manual(hd_data_t *hd_data)
 
   next2 = &hd_data->manual;
 
+  db = hd_data->config_db ?: (hd_data->config_db = new_mem(sizeof *db));
+
+  if(config_db_open(hd_data, db)) {
+    for(i = 0, pos = 0; config_db_next(db, &pos, &ofs); ) {
+      PROGRESS(1, ++i, "read");
+      config_db_record(db, ofs, &props);
+      props = new_str(props);
+      hd = new_config_entry(hd_data, parse_properties(props, props + strlen(props)));
+      free_mem(props);
+      if(hd) {
+        if(hd->status.available != status_unknown) hd->status.available = status_no;
+        ADD2LOG("  got %s\n", hd->unique_id);
+        *next2 = hd;
+        next2 = &hd->next;
+      }
+    }
+  }
+
+  if(!db->head) config_journal_replay(hd_data);
+
   s = NULL;
-  for(j = 0; j < sizeof udi_dir / sizeof *udi_dir; j++) {
+  for(j = 0; !db->head && j < sizeof udi_dir / sizeof *udi_dir; j++) {
     str_printf(&s, 0, "%s%s", j == 2 ? "unique-keys" : "udi", udi_dir[j]);
     if((dir = opendir(hd_get_hddb_path(s)))) {
       i = 0;
@@ -96,11 +226,7 @@ void hd_scan_manual(hd_data_t *hd_data)
   for(hdm = hd_data->manual; hdm; hdm = next) {
     next = hdm->next;
 
-    for(hd = hd_data->hd; hd; hd = hd->next) {
-      if(hd->unique_id && hdm->unique_id && !strcmp(hd->unique_id, hdm->unique_id)) break;
-    }
-
-    if(hd) {
+    if((hd = hd_get_device_by_id(hd_data, hdm->unique_id))) {
       /* just update config status */
       hd->status = hdm->status;
       if(hd->status.available != status_unknown) hd->status.available = status_yes;
@@ -124,13 +250,8 @@ void hd_scan_manual(hd_data_t *hd_data)
       if(hd->status.available != status_unknown) hd->status.available = status_no;
 
       // FIXME: do it really here?
-      if(hd->parent_id) {
-        for(hd1 = hd_data->hd; hd1; hd1 = hd1->next) {
-          if(hd1->unique_id && !strcmp(hd1->unique_id, hd->parent_id)) {
-            hd->attached_to = hd1->idx;
-            break;
-          }
-        }
+      if((hd1 = hd_get_device_by_id(hd_data, hd->parent_id))) {
+        hd->attached_to = hd1->idx;
       }
     }
   }
@@ -356,7 +477,7 @@ void prop2hd(hd_data_t *hd_data, hd_t *hd, int status_only)
 
   hd->broken = prop2hd_int32(list, "hwinfo.broken");
 
-  hd->bus.id = prop2hd_int32(list, "hwinfo.busid");
+  hd->bus.id = prop2hd_int32(list, "hwinfo.bus");
   hd->slot = prop2hd_int32(list, "hwinfo.slot");
   hd->func = prop2hd_int32(list, "hwinfo.func");
 
@@ -379,6 +500,7 @@ void prop2hd(hd_data_t *hd_data, hd_t *hd, int status_only)
   hd->sub_device.id = prop2hd_int32(list, "hwinfo.subdeviceid");
   hd->sub_device.name = prop2hd_str(list, "hwinfo.subdevicename");
 
+  hd->compat_vendor.id = prop2hd_int32(list, "hwinfo.compatvendorid");
   hd->compat_device.id = prop2hd_int32(list, "hwinfo.compatdeviceid");
   hd->compat_device.name = prop2hd_str(list, "hwinfo.compatdevicename");
 
@@ -641,6 +763,7 @@ void hd2prop_append_list(hal_prop_t **list, const char *key, char *str)
   if(!prop) {
     add_str_list(&sl, str);
     hd2prop_add_list(list, key, sl);
+    free_str_list(sl);
     return;
   }
 
@@ -854,7 +977,7 @@ hal_prop_t *read_properties(hd_data_t *hd_data, const char *udi, const char *id)
   hal_prop_t *prop = NULL;
 
   if(udi) {
-    prop = hd_read_properties(udi);
+    prop = read_props(hd_data, udi);
     ADD2LOG("  prop read: %s (%s)\n", udi, prop ? "ok" : "failed");
   }
 
@@ -870,16 +993,17 @@ hal_prop_t *read_properties(hd_data_t *hd_data, const char *udi, const char *id)
     }
 
     if(udi) {
-      prop = hd_read_properties(udi);
+      prop = read_props(hd_data, udi);
       ADD2LOG("  prop read: %s (%s)\n", udi, prop ? "ok" : "failed");
     }
   }
 
   if(!prop) {
-    prop = hd_read_properties(id);
+    prop = read_props(hd_data, id);
     ADD2LOG("  prop read: %s (%s)\n", id, prop ? "ok" : "failed");
   }
-  if(!prop) {
+  /* the store has the old entries, too */
+  if(!prop && !(hd_data->config_db && hd_data->config_db->head)) {
     prop = hd_manual_read_entry_old(id);
     ADD2LOG("  old prop read: %s (%s)\n", id, prop ? "ok" : "failed");
   }
@@ -888,40 +1012,65 @@ hal_prop_t *read_properties(hd_data_t *hd_data, const char *udi, const char *id)
 }
 
 
-API_SYM hd_t *hd_read_config(hd_data_t *hd_data, const char *id)
+/*
+ * Read properties from config store or, if there's none, from udi/.
+ */
+hal_prop_t *read_props(hd_data_t *hd_data, const char *udi)
 {
-  hd_t *hd = NULL;
-  hal_prop_t *prop = NULL;
-  const char *udi = NULL;
+  hal_prop_t *prop;
+
+  if(!udi) return NULL;
+
+  if(config_db_read(hd_data, udi, &prop)) return prop;
+
+  config_journal_replay(hd_data);
+
+  return read_properties_file(udi);
+}
+
+
+/*
+ * Create a stand-alone entry from config properties.
+ */
+hd_t *new_config_entry(hd_data_t *hd_data, hal_prop_t *prop)
+{
+  hd_t *hd;
+
+  if(!prop) return NULL;
 
   /* only of we didn't already (check internal db pointer) */
   /* prop2hd() makes db lookups */
   if(!hd_data->hddb2[1]) hddb_init(hd_data);
 
+  hd = new_mem(sizeof *hd);
+  hd->idx = ++(hd_data->last_idx);
+  hd->module = hd_data->module;
+  hd->line = __LINE__;
+  hd->tag.freeit = 1;		/* make it a 'stand alone' entry */
+  hd->persistent_prop = prop;
+  prop2hd(hd_data, hd, 0);
+
+  return hd;
+}
+
+
+API_SYM hd_t *hd_read_config(hd_data_t *hd_data, const char *id)
+{
+  const char *udi = NULL;
+
   if(id && *id == '/') {
     udi = id;
     id = NULL;
   }
 
-  prop = read_properties(hd_data, udi, id);
-
-  if(prop) {
-    hd = new_mem(sizeof *hd);
-    hd->idx = ++(hd_data->last_idx);
-    hd->module = hd_data->module;
-    hd->line = __LINE__;
-    hd->tag.freeit = 1;		/* make it a 'stand alone' entry */
-    hd->persistent_prop = prop;
-    prop2hd(hd_data, hd, 0);
-  }
-
-  return hd;
+  return new_config_entry(hd_data, read_properties(hd_data, udi, id));
 }
 
 
 API_SYM int hd_write_config(hd_data_t *hd_data, hd_t *hd)
 {
   char *udi;
+  int err;
 
   if(!hd_report_this(hd_data, hd)) return 0;
 
@@ -932,10 +1081,1947 @@ API_SYM int hd_write_config(hd_data_t *hd_data, hd_t *hd)
 
   if(!udi) return 5;
 
+  if((err = config_db_write(hd_data, udi, hd->persistent_prop)) >= 0) return err;
+
   return hd_write_properties(udi, hd->persistent_prop);
 }
 
 
+/*
+ * Write config status of all entries in list as a single transaction:
+ * either to the config store (cf. hd_config_import()) or, if there's
+ * none, through a journal to the udi/ directory.
+ *
+ * Returns 0 on success.
+ */
+API_SYM int hd_write_config_list(hd_data_t *hd_data, hd_t *hd_list)
+{
+  hd_t *hd;
+  char *udi, *buf = NULL;
+  unsigned len = 0, records = 0;
+  int err;
+
+  for(hd = hd_list; hd; hd = hd->next) {
+    if(!hd_report_this(hd_data, hd)) continue;
+    udi = hd->unique_id;
+    if(hd->udi) udi = hd->udi;
+    if(!udi) return 5;
+    while(*udi == '/') udi++;
+    if(!check_udi(udi)) return 1;
+  }
+
+  for(hd = hd_list; hd; hd = hd->next) {
+    if(!hd_report_this(hd_data, hd)) continue;
+
+    hd2prop(hd_data, hd);
+
+    udi = hd->unique_id;
+    if(hd->udi) udi = hd->udi;
+    while(*udi == '/') udi++;
+
+    config_db_add(&buf, &len, udi, hd->persistent_prop);
+    records++;
+  }
+
+  err = records ? config_db_append(hd_data, buf, len, records, 0) : 0;
+
+  /* no store: go through the journal, after finishing any older one */
+  if(err < 0) {
+    err =
+      config_journal_replay(hd_data) ||
+      config_journal_write(hd_data, buf, len) ||
+      config_journal_replay(hd_data);
+  }
+
+  free_mem(buf);
+
+  return err;
+}
+
+
+/*
+ * Parse '\n'-terminated property lines; the buffer is modified.
+ */
+hal_prop_t *parse_properties(char *s, char *s_end)
+{
+  hal_prop_t *list = NULL, **list_next = &list, prop;
+  char *next;
+
+  for(; s < s_end && (next = memchr(s, '\n', s_end - s)); s = next) {
+    *next++ = 0;
+    parse_property(&prop, s);
+    if(prop.type != p_invalid) {
+      *list_next = new_mem(sizeof **list_next);
+      **list_next = prop;
+      list_next = &(*list_next)->next;
+    }
+    else {
+      prop.key = free_mem(prop.key);
+    }
+  }
+
+  return list;
+}
+
+
+/*
+ * Scan cache, written by hd_cache_save().
+ *
+ * It holds the hd2prop() properties of each entry of a scan (plus the
+ * fields hd2prop() doesn't store, cf. hd2prop_cache()) as text and is used
+ * only as long as its key (cf. cache_key()) is unchanged.
+ *
+ * The hd_data properties (cf. hd2prop_cache_global()) come first.
+ */
+#define HD_CACHE_MAGIC		"hdcache"
+#define HD_CACHE_VERSION	2
+
+typedef struct {
+  char magic[8];		/* HD_CACHE_MAGIC */
+  uint32_t version;		/* HD_CACHE_VERSION */
+  uint32_t entries;		/* number of hd_cache_index_t entries */
+  uint64_t key;			/* cache_key() */
+  uint32_t probe_len;		/* sizeof probe */
+  uint32_t index_ofs, strings_ofs, strings_len;
+  uint32_t global_len;		/* hd_data properties, at strings_ofs */
+  unsigned char probe[(pr_all + 7) / 8];	/* probing features used for the scan */
+} hd_cache_header_t;
+
+typedef struct {
+  uint32_t ofs, len;		/* properties of one entry, relative to strings_ofs */
+} hd_cache_index_t;
+
+
+/*
+ * Key identifying the system state a scan is valid for.
+ *
+ * Any reboot, kernel or data base update, or hotplug event changes it.
+ *
+ * Returns 0 if there is no usable key.
+ */
+uint64_t cache_key(hd_data_t *hd_data)
+{
+  uint64_t id = 0, sources_id;
+  struct utsname ubuf;
+  str_list_t *sl;
+  unsigned sources, u;
+  char *s;
+
+  if(!(sl = read_file(PROC_BOOT_ID, 0, 1))) return 0;
+  crc64(&id, sl->str, strlen(sl->str) + 1);
+  free_str_list(sl);
+
+  /* increases with every uevent */
+  if(!(sl = read_file(SYS_UEVENT_SEQNUM, 0, 1))) return 0;
+  crc64(&id, sl->str, strlen(sl->str) + 1);
+  free_str_list(sl);
+
+  if(!uname(&ubuf)) {
+    crc64(&id, ubuf.release, strlen(ubuf.release) + 1);
+    crc64(&id, ubuf.version, strlen(ubuf.version) + 1);
+  }
+
+  s = hd_get_hddb_dir();
+  crc64(&id, s, strlen(s) + 1);
+  sources_id = hddb_sources_id(&sources);
+  crc64(&id, &sources_id, sizeof sources_id);
+  crc64(&id, &sources, sizeof sources);
+
+  s = hd_version();
+  crc64(&id, s, strlen(s) + 1);
+
+  /* cache records hold structs as they are in memory */
+  u = sizeof (hd_t);
+  crc64(&id, &u, sizeof u);
+
+  if((s = getenv("hwprobe"))) crc64(&id, s, strlen(s) + 1);
+
+  for(sl = hd_data->only; sl; sl = sl->next) {
+    crc64(&id, sl->str, strlen(sl->str) + 1);
+  }
+
+  return id ?: 1;
+}
+
+
+/*
+ * Cache records.
+ *
+ * A record is a sequence of fields, each the hex dump of some data followed
+ * by ','; missing data (e.g. a NULL string) are stored as '-'.
+ *
+ * Structs are dumped as they are in memory (cf. cache_key()); the pointers
+ * in them are then reset from the fields that follow.
+ */
+void cache_put(char **rec, const void *data, unsigned len)
+{
+  static const char digits[] = "0123456789abcdef";
+  const unsigned char *d = data;
+  unsigned u, rec_len;
+  char *s;
+
+  rec_len = *rec ? strlen(*rec) : 0;
+  *rec = resize_mem(*rec, rec_len + 2 * len + 3);
+  s = *rec + rec_len;
+
+  if(d) {
+    for(u = 0; u < len; u++) {
+      *s++ = digits[d[u] >> 4];
+      *s++ = digits[d[u] & 0xf];
+    }
+  }
+  else {
+    *s++ = '-';
+  }
+
+  *s++ = ',';
+  *s = 0;
+}
+
+
+void cache_put_str(char **rec, const char *str)
+{
+  cache_put(rec, str, str ? strlen(str) : 0);
+}
+
+
+void cache_put_list(char **rec, str_list_t *sl)
+{
+  str_list_t *sl0;
+  unsigned u;
+
+  for(u = 0, sl0 = sl; sl0; sl0 = sl0->next) u++;
+  cache_put(rec, &u, sizeof u);
+
+  for(; sl; sl = sl->next) cache_put_str(rec, sl->str);
+}
+
+
+int cache_nibble(int c)
+{
+  if(c >= '0' && c <= '9') return c - '0';
+  if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+
+  return -1;
+}
+
+
+/*
+ * Get next record field.
+ *
+ * Returns a newly allocated, 0-terminated buffer (so strings can be used
+ * as they are) or NULL if the data are missing; len is the data size.
+ */
+void *cache_get(char **rec, unsigned *len)
+{
+  unsigned char *data = NULL;
+  char *s, *end;
+  unsigned u, n = 0;
+  int i, j;
+
+  s = *rec;
+
+  if((end = strchr(s, ','))) {
+    *rec = end + 1;
+    if(*s != '-' && !((end - s) & 1)) {
+      n = (end - s) / 2;
+      data = new_mem(n + 1);
+      for(u = 0; u < n; u++, s += 2) {
+        if((i = cache_nibble(s[0])) < 0 || (j = cache_nibble(s[1])) < 0) break;
+        data[u] = (i << 4) + j;
+      }
+      if(u != n) {
+        data = free_mem(data);
+        n = 0;
+      }
+    }
+  }
+
+  if(len) *len = n;
+
+  return data;
+}
+
+
+/*
+ * Get next record field into a buffer of the exact size.
+ *
+ * Returns 1 on success.
+ */
+int cache_get_fixed(char **rec, void *data, unsigned len)
+{
+  unsigned data_len;
+  void *buf;
+  int ok;
+
+  buf = cache_get(rec, &data_len);
+  if((ok = buf && data_len == len)) memcpy(data, buf, len);
+  free_mem(buf);
+
+  return ok;
+}
+
+
+str_list_t *cache_get_list(char **rec)
+{
+  str_list_t *sl = NULL, **sl_next = &sl;
+  unsigned u;
+
+  if(!cache_get_fixed(rec, &u, sizeof u)) return NULL;
+
+  for(; u && **rec; u--) {
+    *sl_next = new_mem(sizeof **sl_next);
+    (*sl_next)->str = cache_get(rec, NULL);
+    sl_next = &(*sl_next)->next;
+  }
+
+  return sl;
+}
+
+
+/*
+ * Resources, in list order.
+ */
+void hd2prop_cache_res(hal_prop_t **list, hd_res_t *res)
+{
+  char *rec = NULL;
+
+  cache_put(&rec, res, sizeof *res);
+
+  switch(res->any.type) {
+    case res_init_strings:
+      cache_put_str(&rec, res->init_strings.init1);
+      cache_put_str(&rec, res->init_strings.init2);
+      break;
+
+    case res_pppd_option:
+      cache_put_str(&rec, res->pppd_option.option);
+      break;
+
+    case res_hwaddr:
+    case res_phwaddr:
+      cache_put_str(&rec, res->hwaddr.addr);
+      break;
+
+    case res_wlan:
+      cache_put_list(&rec, res->wlan.channels);
+      cache_put_list(&rec, res->wlan.frequencies);
+      cache_put_list(&rec, res->wlan.bitrates);
+      cache_put_list(&rec, res->wlan.auth_modes);
+      cache_put_list(&rec, res->wlan.enc_modes);
+      break;
+
+    case res_fc:
+      cache_put_str(&rec, res->fc.controller_id);
+      break;
+
+    default:
+      break;
+  }
+
+  hd2prop_append_list(list, "hwinfo.cache.res", rec);
+
+  free_mem(rec);
+}
+
+
+hd_res_t *prop2hd_cache_res(char *rec)
+{
+  hd_res_t *res;
+
+  res = new_mem(sizeof *res);
+
+  if(!cache_get_fixed(&rec, res, sizeof *res)) return free_mem(res);
+
+  res->next = NULL;
+
+  switch(res->any.type) {
+    case res_init_strings:
+      res->init_strings.init1 = cache_get(&rec, NULL);
+      res->init_strings.init2 = cache_get(&rec, NULL);
+      break;
+
+    case res_pppd_option:
+      res->pppd_option.option = cache_get(&rec, NULL);
+      break;
+
+    case res_hwaddr:
+    case res_phwaddr:
+      res->hwaddr.addr = cache_get(&rec, NULL);
+      break;
+
+    case res_wlan:
+      res->wlan.channels = cache_get_list(&rec);
+      res->wlan.frequencies = cache_get_list(&rec);
+      res->wlan.bitrates = cache_get_list(&rec);
+      res->wlan.auth_modes = cache_get_list(&rec);
+      res->wlan.enc_modes = cache_get_list(&rec);
+      break;
+
+    case res_fc:
+      res->fc.controller_id = cache_get(&rec, NULL);
+      break;
+
+    default:
+      break;
+  }
+
+  return res;
+}
+
+
+/*
+ * Details; one record per monitor for monitor details.
+ *
+ * Details only used while scanning (pci, usb, isapnp, floppy, scsi,
+ * devtree) are not stored.
+ */
+void hd2prop_cache_detail(hal_prop_t **list, hd_detail_t *d)
+{
+  hd_detail_monitor_t *mdetail;
+  bios_info_t *bt;
+  cpu_info_t *ct;
+  sys_info_t *st;
+  cdrom_info_t *ci;
+  monitor_info_t *mi;
+  char *rec;
+
+  if(d->type == hd_detail_monitor) {
+    for(mdetail = &d->monitor; mdetail; mdetail = mdetail->next) {
+      if(!(mi = mdetail->data)) continue;
+      rec = NULL;
+      cache_put(&rec, &d->type, sizeof d->type);
+      cache_put(&rec, mi, sizeof *mi);
+      cache_put_str(&rec, mi->vendor);
+      cache_put_str(&rec, mi->name);
+      cache_put_str(&rec, mi->serial);
+      hd2prop_append_list(list, "hwinfo.cache.detail", rec);
+      free_mem(rec);
+    }
+
+    return;
+  }
+
+  rec = NULL;
+  cache_put(&rec, &d->type, sizeof d->type);
+
+  switch(d->type) {
+    case hd_detail_cdrom:
+      if(!(ci = d->cdrom.data)) break;
+      cache_put(&rec, ci, sizeof *ci);
+      cache_put_str(&rec, ci->name);
+      cache_put_str(&rec, ci->iso9660.volume);
+      cache_put_str(&rec, ci->iso9660.publisher);
+      cache_put_str(&rec, ci->iso9660.preparer);
+      cache_put_str(&rec, ci->iso9660.application);
+      cache_put_str(&rec, ci->iso9660.creation_date);
+      cache_put_str(&rec, ci->el_torito.id_string);
+      cache_put_str(&rec, ci->el_torito.label);
+      hd2prop_append_list(list, "hwinfo.cache.detail", rec);
+      break;
+
+    case hd_detail_bios:
+      if(!(bt = d->bios.data)) break;
+      cache_put(&rec, bt, sizeof *bt);
+      cache_put_str(&rec, bt->vbe.oem_name);
+      cache_put_str(&rec, bt->vbe.vendor_name);
+      cache_put_str(&rec, bt->vbe.product_name);
+      cache_put_str(&rec, bt->vbe.product_revision);
+      cache_put(&rec, bt->vbe.mode, bt->vbe.modes * sizeof *bt->vbe.mode);
+      cache_put_str(&rec, bt->lcd.vendor);
+      cache_put_str(&rec, bt->lcd.name);
+      cache_put_str(&rec, bt->mouse.vendor);
+      cache_put_str(&rec, bt->mouse.type);
+      hd2prop_append_list(list, "hwinfo.cache.detail", rec);
+      break;
+
+    case hd_detail_cpu:
+      if(!(ct = d->cpu.data)) break;
+      cache_put(&rec, ct, sizeof *ct);
+      cache_put_str(&rec, ct->vend_name);
+      cache_put_str(&rec, ct->model_name);
+      cache_put_str(&rec, ct->platform);
+      cache_put_list(&rec, ct->features);
+      hd2prop_append_list(list, "hwinfo.cache.detail", rec);
+      break;
+
+    case hd_detail_prom:
+      if(!d->prom.data) break;
+      cache_put(&rec, d->prom.data, sizeof *d->prom.data);
+      hd2prop_append_list(list, "hwinfo.cache.detail", rec);
+      break;
+
+    case hd_detail_sys:
+      if(!(st = d->sys.data)) break;
+      cache_put_str(&rec, st->system_type);
+      cache_put_str(&rec, st->generation);
+      cache_put_str(&rec, st->vendor);
+      cache_put_str(&rec, st->model);
+      cache_put_str(&rec, st->serial);
+      cache_put_str(&rec, st->lang);
+      cache_put_str(&rec, st->formfactor);
+      hd2prop_append_list(list, "hwinfo.cache.detail", rec);
+      break;
+
+    case hd_detail_ccw:
+      if(!d->ccw.data) break;
+      cache_put(&rec, d->ccw.data, sizeof *d->ccw.data);
+      hd2prop_append_list(list, "hwinfo.cache.detail", rec);
+      break;
+
+    case hd_detail_joystick:
+      if(!d->joystick.data) break;
+      cache_put(&rec, d->joystick.data, sizeof *d->joystick.data);
+      hd2prop_append_list(list, "hwinfo.cache.detail", rec);
+      break;
+
+    default:
+      break;
+  }
+
+  free_mem(rec);
+}
+
+
+void prop2hd_cache_detail(hd_t *hd, char *rec)
+{
+  hd_detail_type_t type;
+  hd_detail_monitor_t *mdetail;
+  bios_info_t *bt;
+  cpu_info_t *ct;
+  sys_info_t *st;
+  cdrom_info_t *ci;
+  monitor_info_t *mi;
+  prom_info_t *pt;
+  ccw_t *ccw;
+  joystick_t *jt;
+  unsigned u;
+  int ok = 0;
+
+  if(!cache_get_fixed(&rec, &type, sizeof type)) return;
+
+  if(type == hd_detail_monitor) {
+    mi = new_mem(sizeof *mi);
+    if(!cache_get_fixed(&rec, mi, sizeof *mi)) {
+      free_mem(mi);
+      return;
+    }
+    mi->vendor = cache_get(&rec, NULL);
+    mi->name = cache_get(&rec, NULL);
+    mi->serial = cache_get(&rec, NULL);
+
+    if(!hd->detail) {
+      hd->detail = new_mem(sizeof *hd->detail);
+      hd->detail->type = hd_detail_monitor;
+      hd->detail->monitor.data = mi;
+    }
+    else if(hd->detail->type == hd_detail_monitor) {
+      for(mdetail = &hd->detail->monitor; mdetail->next; mdetail = mdetail->next);
+      mdetail = mdetail->next = new_mem(sizeof *mdetail);
+      mdetail->type = hd_detail_monitor;
+      mdetail->data = mi;
+    }
+    else {
+      free_mem(mi->vendor);
+      free_mem(mi->name);
+      free_mem(mi->serial);
+      free_mem(mi);
+    }
+
+    return;
+  }
+
+  if(hd->detail) return;
+
+  hd->detail = new_mem(sizeof *hd->detail);
+  hd->detail->type = type;
+
+  switch(type) {
+    case hd_detail_cdrom:
+      ci = new_mem(sizeof *ci);
+      if(!cache_get_fixed(&rec, ci, sizeof *ci)) {
+        free_mem(ci);
+        break;
+      }
+      ci->next = NULL;
+      ci->name = cache_get(&rec, NULL);
+      ci->iso9660.volume = cache_get(&rec, NULL);
+      ci->iso9660.publisher = cache_get(&rec, NULL);
+      ci->iso9660.preparer = cache_get(&rec, NULL);
+      ci->iso9660.application = cache_get(&rec, NULL);
+      ci->iso9660.creation_date = cache_get(&rec, NULL);
+      ci->el_torito.id_string = cache_get(&rec, NULL);
+      ci->el_torito.label = cache_get(&rec, NULL);
+      hd->detail->cdrom.data = ci;
+      ok = 1;
+      break;
+
+    case hd_detail_bios:
+      bt = new_mem(sizeof *bt);
+      if(!cache_get_fixed(&rec, bt, sizeof *bt)) {
+        free_mem(bt);
+        break;
+      }
+      bt->vbe.oem_name = cache_get(&rec, NULL);
+      bt->vbe.vendor_name = cache_get(&rec, NULL);
+      bt->vbe.product_name = cache_get(&rec, NULL);
+      bt->vbe.product_revision = cache_get(&rec, NULL);
+      bt->vbe.mode = cache_get(&rec, &u);
+      bt->vbe.modes = u / sizeof *bt->vbe.mode;
+      bt->lcd.vendor = cache_get(&rec, NULL);
+      bt->lcd.name = cache_get(&rec, NULL);
+      bt->mouse.vendor = cache_get(&rec, NULL);
+      bt->mouse.type = cache_get(&rec, NULL);
+      hd->detail->bios.data = bt;
+      ok = 1;
+      break;
+
+    case hd_detail_cpu:
+      ct = new_mem(sizeof *ct);
+      if(!cache_get_fixed(&rec, ct, sizeof *ct)) {
+        free_mem(ct);
+        break;
+      }
+      ct->vend_name = cache_get(&rec, NULL);
+      ct->model_name = cache_get(&rec, NULL);
+      ct->platform = cache_get(&rec, NULL);
+      ct->features = cache_get_list(&rec);
+      hd->detail->cpu.data = ct;
+      ok = 1;
+      break;
+
+    case hd_detail_prom:
+      pt = new_mem(sizeof *pt);
+      if(!cache_get_fixed(&rec, pt, sizeof *pt)) {
+        free_mem(pt);
+        break;
+      }
+      hd->detail->prom.data = pt;
+      ok = 1;
+      break;
+
+    case hd_detail_sys:
+      st = new_mem(sizeof *st);
+      st->system_type = cache_get(&rec, NULL);
+      st->generation = cache_get(&rec, NULL);
+      st->vendor = cache_get(&rec, NULL);
+      st->model = cache_get(&rec, NULL);
+      st->serial = cache_get(&rec, NULL);
+      st->lang = cache_get(&rec, NULL);
+      st->formfactor = cache_get(&rec, NULL);
+      hd->detail->sys.data = st;
+      ok = 1;
+      break;
+
+    case hd_detail_ccw:
+      ccw = new_mem(sizeof *ccw);
+      if(!cache_get_fixed(&rec, ccw, sizeof *ccw)) {
+        free_mem(ccw);
+        break;
+      }
+      hd->detail->ccw.data = ccw;
+      ok = 1;
+      break;
+
+    case hd_detail_joystick:
+      jt = new_mem(sizeof *jt);
+      if(!cache_get_fixed(&rec, jt, sizeof *jt)) {
+        free_mem(jt);
+        break;
+      }
+      hd->detail->joystick.data = jt;
+      ok = 1;
+      break;
+
+    default:
+      break;
+  }
+
+  if(!ok) hd->detail = free_mem(hd->detail);
+}
+
+
+/*
+ * Driver info; stored rather than looked up again as the scan adjusts it
+ * (e.g. usb-storage info moves to the disk).
+ */
+void hd2prop_cache_driver_info(hal_prop_t **list, driver_info_t *di)
+{
+  isdn_parm_t *ip;
+  char *rec = NULL;
+  unsigned u;
+
+  cache_put(&rec, di, sizeof *di);
+  cache_put_list(&rec, di->any.hddb0);
+  cache_put_list(&rec, di->any.hddb1);
+
+  switch(di->any.type) {
+    case di_module:
+      cache_put_list(&rec, di->module.names);
+      cache_put_list(&rec, di->module.mod_args);
+      cache_put_str(&rec, di->module.conf);
+      break;
+
+    case di_mouse:
+      cache_put_str(&rec, di->mouse.xf86);
+      cache_put_str(&rec, di->mouse.gpm);
+      break;
+
+    case di_x11:
+      cache_put_str(&rec, di->x11.server);
+      cache_put_str(&rec, di->x11.xf86_ver);
+      cache_put_list(&rec, di->x11.extensions);
+      cache_put_list(&rec, di->x11.options);
+      cache_put_list(&rec, di->x11.raw);
+      cache_put_str(&rec, di->x11.script);
+      break;
+
+    case di_isdn:
+      cache_put_str(&rec, di->isdn.i4l_name);
+      for(u = 0, ip = di->isdn.params; ip; ip = ip->next) u++;
+      cache_put(&rec, &u, sizeof u);
+      for(ip = di->isdn.params; ip; ip = ip->next) {
+        cache_put(&rec, ip, sizeof *ip);
+        cache_put_str(&rec, ip->name);
+        cache_put(&rec, ip->alt_value, ip->alt_values > 0 ? ip->alt_values * sizeof *ip->alt_value : 0);
+      }
+      break;
+
+    case di_dsl:
+      cache_put_str(&rec, di->dsl.mode);
+      cache_put_str(&rec, di->dsl.name);
+      break;
+
+    case di_kbd:
+      cache_put_str(&rec, di->kbd.XkbRules);
+      cache_put_str(&rec, di->kbd.XkbModel);
+      cache_put_str(&rec, di->kbd.XkbLayout);
+      cache_put_str(&rec, di->kbd.keymap);
+      break;
+
+    default:
+      break;
+  }
+
+  hd2prop_append_list(list, "hwinfo.cache.driverinfo", rec);
+
+  free_mem(rec);
+}
+
+
+driver_info_t *prop2hd_cache_driver_info(char *rec)
+{
+  driver_info_t *di;
+  isdn_parm_t *ip, **ip_next;
+  unsigned u, len;
+
+  di = new_mem(sizeof *di);
+
+  if(!cache_get_fixed(&rec, di, sizeof *di)) return free_mem(di);
+
+  di->next = NULL;
+  di->any.hddb0 = cache_get_list(&rec);
+  di->any.hddb1 = cache_get_list(&rec);
+
+  switch(di->any.type) {
+    case di_module:
+      di->module.names = cache_get_list(&rec);
+      di->module.mod_args = cache_get_list(&rec);
+      di->module.conf = cache_get(&rec, NULL);
+      break;
+
+    case di_mouse:
+      di->mouse.xf86 = cache_get(&rec, NULL);
+      di->mouse.gpm = cache_get(&rec, NULL);
+      break;
+
+    case di_x11:
+      di->x11.server = cache_get(&rec, NULL);
+      di->x11.xf86_ver = cache_get(&rec, NULL);
+      di->x11.extensions = cache_get_list(&rec);
+      di->x11.options = cache_get_list(&rec);
+      di->x11.raw = cache_get_list(&rec);
+      di->x11.script = cache_get(&rec, NULL);
+      break;
+
+    case di_isdn:
+      di->isdn.i4l_name = cache_get(&rec, NULL);
+      di->isdn.params = NULL;
+      if(!cache_get_fixed(&rec, &u, sizeof u)) break;
+      for(ip_next = &di->isdn.params; u && *rec; u--) {
+        ip = new_mem(sizeof *ip);
+        if(!cache_get_fixed(&rec, ip, sizeof *ip)) {
+          free_mem(ip);
+          break;
+        }
+        ip->next = NULL;
+        ip->name = cache_get(&rec, NULL);
+        ip->alt_value = cache_get(&rec, &len);
+        ip->alt_values = len / sizeof *ip->alt_value;
+        ip_next = &(*ip_next = ip)->next;
+      }
+      break;
+
+    case di_dsl:
+      di->dsl.mode = cache_get(&rec, NULL);
+      di->dsl.name = cache_get(&rec, NULL);
+      break;
+
+    case di_kbd:
+      di->kbd.XkbRules = cache_get(&rec, NULL);
+      di->kbd.XkbModel = cache_get(&rec, NULL);
+      di->kbd.XkbLayout = cache_get(&rec, NULL);
+      di->kbd.keymap = cache_get(&rec, NULL);
+      break;
+
+    default:
+      break;
+  }
+
+  return di;
+}
+
+
+/*
+ * Add entry data to cache properties that hd2prop() doesn't store.
+ */
+void hd2prop_cache(hd_t *hd, hal_prop_t **list)
+{
+  static const char *res_keys[] = {
+    "hwinfo.res.memory", "hwinfo.res.physmemory", "hwinfo.res.io",
+    "hwinfo.res.interrupts", "hwinfo.res.dma", "hwinfo.res.size",
+    "hwinfo.res.baud", "hwinfo.res.cache", "hwinfo.res.diskgeometry",
+    "hwinfo.res.monitor", "hwinfo.res.framebuffer"
+  };
+  hd_res_t *res;
+  driver_info_t *di;
+  hal_prop_t *prop;
+  char *s = NULL;
+  unsigned u;
+
+  hd2prop_add_int32(list, "hwinfo.idx", hd->idx);
+  hd2prop_add_int32(list, "hwinfo.attachedto", hd->attached_to);
+  hd2prop_add_int32(list, "hwinfo.module", hd->module);
+  hd2prop_add_int32(list, "hwinfo.line", hd->line);
+  hd2prop_add_int32(list, "hwinfo.count", hd->count);
+  hd2prop_add_str(list, "hwinfo.driver", hd->driver);
+  hd2prop_add_str(list, "hwinfo.drivermodule", hd->driver_module);
+  hd2prop_add_str(list, "hwinfo.modalias", hd->modalias);
+  hd2prop_add_str(list, "hwinfo.label", hd->label);
+  hd2prop_add_str(list, "hwinfo.parentudi", hd->parent_udi);
+  hd2prop_add_str(list, "hwinfo.uniqueid1", hd->unique_id1);
+  hd2prop_add_str(list, "hwinfo.olduniqueid", hd->old_unique_id);
+  hd2prop_add_int32(list, "hwinfo.hotplugslot", hd->hotplug_slot);
+  hd2prop_add_list(list, "hwinfo.uniqueids", hd->unique_ids);
+  hd2prop_add_list(list, "hwinfo.drivermodules", hd->driver_modules);
+  hd2prop_add_list(list, "hwinfo.requires", hd->requires);
+  hd2prop_add_list(list, "hwinfo.extrainfo", hd->extra_info);
+
+  if(hd->unix_dev_num.type) {
+    str_printf(&s, 0,
+      "%d,%u,%u,%u",
+      hd->unix_dev_num.type, hd->unix_dev_num.major, hd->unix_dev_num.minor, hd->unix_dev_num.range
+    );
+    hd2prop_add_str(list, "hwinfo.unixdevicenumber", s);
+  }
+
+  if(hd->unix_dev_num2.type) {
+    str_printf(&s, 0,
+      "%d,%u,%u,%u",
+      hd->unix_dev_num2.type, hd->unix_dev_num2.major, hd->unix_dev_num2.minor, hd->unix_dev_num2.range
+    );
+    hd2prop_add_str(list, "hwinfo.unixdevicenumber2", s);
+  }
+
+  s = free_mem(s);
+
+  /* all flags, not just the hd2prop() features */
+  cache_put(&s, &hd->is, sizeof hd->is);
+  cache_put(&s, &hd->tag, sizeof hd->tag);
+  cache_put(&s, &hd->status, sizeof hd->status);
+  hd2prop_add_str(list, "hwinfo.cache.flags", s);
+  s = free_mem(s);
+
+  /* resources are stored in list order instead */
+  for(u = 0; u < sizeof res_keys / sizeof *res_keys; u++) {
+    hal_invalidate_all(*list, res_keys[u]);
+  }
+
+  for(res = hd->res; res; res = res->next) {
+    hd2prop_cache_res(list, res);
+  }
+
+  if(hd->detail) hd2prop_cache_detail(list, hd->detail);
+
+  for(di = hd->driver_info; di; di = di->next) {
+    hd2prop_cache_driver_info(list, di);
+  }
+
+  for(prop = hd->hal_prop; prop; prop = prop->next) {
+    cache_put_str(&s, hd_hal_print_prop(prop));
+    hd2prop_append_list(list, "hwinfo.cache.hal", s);
+    s = free_mem(s);
+  }
+}
+
+
+/*
+ * Counterpart to hd2prop_cache().
+ *
+ * Runs after prop2hd() and replaces what prop2hd() guessed.
+ */
+void prop2hd_cache(hd_t *hd, hal_prop_t *list)
+{
+  hal_prop_t *prop, **prop_next;
+  hd_res_t *res;
+  driver_info_t *di, **di_next;
+  str_list_t *sl;
+  unsigned u, u0, u1, u2;
+  int i;
+  char *s, *t;
+
+  if((u = prop2hd_int32(list, "hwinfo.idx"))) hd->idx = u;
+  hd->attached_to = prop2hd_int32(list, "hwinfo.attachedto");
+  hd->module = prop2hd_int32(list, "hwinfo.module");
+  hd->line = prop2hd_int32(list, "hwinfo.line");
+  hd->count = prop2hd_int32(list, "hwinfo.count");
+  hd->driver = prop2hd_str(list, "hwinfo.driver");
+  hd->driver_module = prop2hd_str(list, "hwinfo.drivermodule");
+  hd->modalias = prop2hd_str(list, "hwinfo.modalias");
+  hd->label = prop2hd_str(list, "hwinfo.label");
+  hd->parent_udi = prop2hd_str(list, "hwinfo.parentudi");
+  hd->unique_id1 = prop2hd_str(list, "hwinfo.uniqueid1");
+  hd->old_unique_id = prop2hd_str(list, "hwinfo.olduniqueid");
+  hd->hotplug_slot = prop2hd_int32(list, "hwinfo.hotplugslot");
+  hd->unique_ids = prop2hd_list(list, "hwinfo.uniqueids");
+  hd->driver_modules = prop2hd_list(list, "hwinfo.drivermodules");
+  hd->extra_info = prop2hd_list(list, "hwinfo.extrainfo");
+
+  free_str_list(hd->requires);
+  hd->requires = prop2hd_list(list, "hwinfo.requires");
+
+  if(
+    (s = hal_get_useful_str(list, "hwinfo.unixdevicenumber")) &&
+    sscanf(s, "%d,%u,%u,%u", &i, &u0, &u1, &u2) == 4
+  ) {
+    hd->unix_dev_num.type = i;
+    hd->unix_dev_num.major = u0;
+    hd->unix_dev_num.minor = u1;
+    hd->unix_dev_num.range = u2;
+  }
+
+  if(
+    (s = hal_get_useful_str(list, "hwinfo.unixdevicenumber2")) &&
+    sscanf(s, "%d,%u,%u,%u", &i, &u0, &u1, &u2) == 4
+  ) {
+    hd->unix_dev_num2.type = i;
+    hd->unix_dev_num2.major = u0;
+    hd->unix_dev_num2.minor = u1;
+    hd->unix_dev_num2.range = u2;
+  }
+
+  if((s = hal_get_useful_str(list, "hwinfo.cache.flags"))) {
+    cache_get_fixed(&s, &hd->is, sizeof hd->is);
+    cache_get_fixed(&s, &hd->tag, sizeof hd->tag);
+    cache_get_fixed(&s, &hd->status, sizeof hd->status);
+    hd->tag.remove = hd->tag.freeit = hd->tag.reported = 0;
+  }
+
+  if((prop = hal_get_list(list, "hwinfo.cache.res"))) {
+    for(sl = prop->val.list; sl; sl = sl->next) {
+      if((res = prop2hd_cache_res(sl->str))) add_res_entry(&hd->res, res);
+    }
+  }
+
+  if((prop = hal_get_list(list, "hwinfo.cache.detail"))) {
+    for(sl = prop->val.list; sl; sl = sl->next) {
+      prop2hd_cache_detail(hd, sl->str);
+    }
+  }
+
+  /* replace the data base lookup from prop2hd() */
+  hd->driver_info = free_driver_info(hd->driver_info);
+  if((prop = hal_get_list(list, "hwinfo.cache.driverinfo"))) {
+    for(di_next = &hd->driver_info, sl = prop->val.list; sl; sl = sl->next) {
+      if((di = prop2hd_cache_driver_info(sl->str))) di_next = &(*di_next = di)->next;
+    }
+  }
+
+  if((prop = hal_get_list(list, "hwinfo.cache.hal"))) {
+    for(prop_next = &hd->hal_prop, sl = prop->val.list; sl; sl = sl->next) {
+      s = sl->str;
+      if(!(t = cache_get(&s, NULL))) continue;
+      *prop_next = new_mem(sizeof **prop_next);
+      parse_property(*prop_next, t);
+      if((*prop_next)->type == p_invalid) {
+        (*prop_next)->key = free_mem((*prop_next)->key);
+        *prop_next = free_mem(*prop_next);
+      }
+      else {
+        prop_next = &(*prop_next)->next;
+      }
+      free_mem(t);
+    }
+  }
+}
+
+
+/*
+ * Cache properties of hd_data, not tied to any entry.
+ */
+void hd2prop_cache_global(hd_data_t *hd_data, hal_prop_t **list)
+{
+  hd_smbios_t *sm;
+  char *rec;
+
+  hd2prop_add_int32(list, "hwinfo.display", hd_data->display);
+
+  for(sm = hd_data->smbios; sm; sm = sm->next) {
+    rec = NULL;
+    cache_put(&rec, &sm->any.type, sizeof sm->any.type);
+    cache_put(&rec, &sm->any.handle, sizeof sm->any.handle);
+    cache_put(&rec, sm->any.data, sm->any.data_len);
+    cache_put_list(&rec, sm->any.strings);
+    hd2prop_append_list(list, "hwinfo.cache.smbios", rec);
+    free_mem(rec);
+  }
+}
+
+
+/*
+ * Counterpart to hd2prop_cache_global().
+ */
+void prop2hd_cache_global(hd_data_t *hd_data, hal_prop_t *list)
+{
+  hal_prop_t *prop;
+  hd_smbios_t *sm, **sm_next;
+  str_list_t *sl;
+  unsigned len;
+  char *s;
+
+  hd_data->display = prop2hd_int32(list, "hwinfo.display");
+
+  if((prop = hal_get_list(list, "hwinfo.cache.smbios"))) {
+    hd_data->smbios = smbios_free(hd_data->smbios);
+    for(sm_next = &hd_data->smbios, sl = prop->val.list; sl; sl = sl->next) {
+      s = sl->str;
+      sm = new_mem(sizeof *sm);
+      if(
+        !cache_get_fixed(&s, &sm->any.type, sizeof sm->any.type) ||
+        !cache_get_fixed(&s, &sm->any.handle, sizeof sm->any.handle)
+      ) {
+        free_mem(sm);
+        continue;
+      }
+      sm->any.data = cache_get(&s, &len);
+      sm->any.data_len = len;
+      sm->any.strings = cache_get_list(&s);
+      sm_next = &(*sm_next = sm)->next;
+    }
+    smbios_parse(hd_data);
+  }
+}
+
+
+/*
+ * Read hardware list from scan cache (default: HD_CACHE_FILE).
+ *
+ * The hardware list must be empty. The cached scan must have used at least
+ * the probing features currently set.
+ *
+ * Returns 0 if the list was read; if the cache is missing or outdated,
+ * returns != 0 and a regular scan is needed.
+ */
+API_SYM int hd_cache_load(hd_data_t *hd_data, const char *file)
+{
+  hd_cache_header_t *head;
+  hd_cache_index_t *index;
+  hal_prop_t *list;
+  hd_t *hd;
+  struct stat sbuf;
+  size_t size;
+  char *map, *s;
+  unsigned u;
+  int fd;
+
+  if(!file) file = HD_CACHE_FILE;
+
+  if(hd_data->hd) return 1;
+
+  if((fd = open(file, O_RDONLY)) == -1) return 2;
+
+  if(fstat(fd, &sbuf) || sbuf.st_size < sizeof *head) {
+    close(fd);
+    return 3;
+  }
+
+  size = sbuf.st_size;
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if(map == MAP_FAILED) return 2;
+
+  head = (hd_cache_header_t *) map;
+  index = (hd_cache_index_t *) (map + head->index_ofs);
+
+  if(
+    memcmp(head->magic, HD_CACHE_MAGIC, sizeof head->magic) ||
+    head->version != HD_CACHE_VERSION ||
+    head->probe_len != sizeof head->probe ||
+    head->index_ofs % sizeof (uint32_t) ||
+    head->index_ofs + (uint64_t) head->entries * sizeof *index > size ||
+    head->strings_ofs + (uint64_t) head->strings_len > size ||
+    head->global_len > head->strings_len
+  ) {
+    ADD2LOG("cache: %s: invalid\n", file);
+    munmap(map, size);
+    return 3;
+  }
+
+  for(u = 0; u < head->entries; u++) {
+    if((uint64_t) index[u].ofs + index[u].len > head->strings_len) break;
+  }
+
+  if(u != head->entries) {
+    ADD2LOG("cache: %s: invalid\n", file);
+    munmap(map, size);
+    return 3;
+  }
+
+  for(u = 0; u < sizeof hd_data->probe; u++) {
+    if(hd_data->probe[u] & ~head->probe[u]) break;
+  }
+
+  if(u != sizeof hd_data->probe || head->key != cache_key(hd_data)) {
+    ADD2LOG("cache: %s: outdated\n", file);
+    munmap(map, size);
+    return 4;
+  }
+
+  /* prop2hd() makes db lookups */
+  if(!hd_data->hddb2[1]) hddb_init(hd_data);
+
+  s = map + head->strings_ofs;
+  list = parse_properties(s, s + head->global_len);
+  prop2hd_cache_global(hd_data, list);
+  hd_free_hal_properties(list);
+
+  for(u = 0; u < head->entries; u++) {
+    s = map + head->strings_ofs + index[u].ofs;
+    list = parse_properties(s, s + index[u].len);
+
+    hd = add_hd_entry(hd_data, __LINE__, 0);
+    hd->persistent_prop = list;
+    prop2hd(hd_data, hd, 0);
+    prop2hd_cache(hd, list);
+    if(hd->idx > hd_data->last_idx) hd_data->last_idx = hd->idx;
+    hd->persistent_prop = hd_free_hal_properties(hd->persistent_prop);
+  }
+
+  hd_index_reset(hd_data);
+
+  ADD2LOG("cache: %s: %u entries\n", file, head->entries);
+
+  munmap(map, size);
+
+  return 0;
+}
+
+
+/*
+ * Write current hardware list to scan cache (default: HD_CACHE_FILE).
+ *
+ * The file is replaced atomically.
+ *
+ * Returns 0 on success.
+ */
+API_SYM int hd_cache_save(hd_data_t *hd_data, const char *file)
+{
+  hd_cache_header_t head = {};
+  hd_cache_index_t *index;
+  hal_prop_t *list, *prop;
+  hd_t *hd;
+  FILE *f;
+  char *tmp = NULL, *s;
+  unsigned u;
+  int fd, err;
+
+  if(!file) file = HD_CACHE_FILE;
+
+  if(!(head.key = cache_key(hd_data))) return 1;
+
+  for(hd = hd_data->hd; hd; hd = hd->next) head.entries++;
+
+  /* create the directory, if necessary */
+  tmp = new_str(file);
+  if((s = strrchr(tmp, '/')) && s != tmp) {
+    *s = 0;
+    mkdir(tmp, 0755);
+  }
+
+  str_printf(&tmp, 0, "%s.XXXXXX", file);
+
+  if((fd = mkstemp(tmp)) == -1 || !(f = fdopen(fd, "w"))) {
+    if(fd != -1) {
+      close(fd);
+      unlink(tmp);
+    }
+    ADD2LOG("cache: %s: can't write\n", file);
+    free_mem(tmp);
+    return 2;
+  }
+
+  fchmod(fd, 0644);
+
+  memcpy(head.magic, HD_CACHE_MAGIC, sizeof head.magic);
+  head.version = HD_CACHE_VERSION;
+  head.probe_len = sizeof head.probe;
+  memcpy(head.probe, hd_data->probe, sizeof head.probe);
+  head.index_ofs = sizeof head;
+  head.strings_ofs = head.index_ofs + head.entries * sizeof *index;
+
+  index = new_mem(head.entries * sizeof *index);
+
+  fseek(f, head.strings_ofs, SEEK_SET);
+
+  list = NULL;
+  hd2prop_cache_global(hd_data, &list);
+  for(prop = list; prop; prop = prop->next) {
+    if((s = hd_hal_print_prop(prop))) fprintf(f, "%s\n", s);
+  }
+  hd_free_hal_properties(list);
+  head.global_len = ftell(f) - head.strings_ofs;
+
+  for(u = 0, hd = hd_data->hd; hd; hd = hd->next, u++) {
+    /* don't touch the entry's own properties */
+    list = hd->persistent_prop;
+    hd->persistent_prop = NULL;
+    hd2prop(hd_data, hd);
+    prop = hd->persistent_prop;
+    hd->persistent_prop = list;
+    list = prop;
+
+    hd2prop_cache(hd, &list);
+
+    index[u].ofs = ftell(f) - head.strings_ofs;
+    for(prop = list; prop; prop = prop->next) {
+      if(prop->type == p_invalid) continue;
+      if((s = hd_hal_print_prop(prop))) fprintf(f, "%s\n", s);
+    }
+    index[u].len = ftell(f) - head.strings_ofs - index[u].ofs;
+
+    hd_free_hal_properties(list);
+  }
+
+  head.strings_len = ftell(f) - head.strings_ofs;
+
+  fseek(f, 0, SEEK_SET);
+  fwrite(&head, sizeof head, 1, f);
+  fwrite(index, sizeof *index, head.entries, f);
+
+  err = ferror(f);
+  if(fclose(f)) err = 1;
+
+  if(err || rename(tmp, file)) {
+    unlink(tmp);
+    ADD2LOG("cache: %s: can't write\n", file);
+    err = 2;
+  }
+  else {
+    ADD2LOG("cache: %s: %u entries written\n", file, head.entries);
+  }
+
+  free_mem(index);
+  free_mem(tmp);
+
+  return err;
+}
+
+
+/* FNV-1a */
+uint32_t config_hash(const char *key)
+{
+  uint32_t h = 2166136261u;
+
+  while(*key) h = (h ^ (unsigned char) *key++) * 16777619u;
+
+  return h;
+}
+
+
+/*
+ * Check record at ofs; return key and properties.
+ */
+char *config_db_record(struct hd_config_db_s *db, uint32_t ofs, char **props)
+{
+  uint32_t len;
+  char *key;
+
+  if(ofs < HD_CONFIG_HEADER_V1 || ofs % sizeof len || ofs + (uint64_t) sizeof len > db->size) return NULL;
+
+  len = *(uint32_t *) (db->map + ofs);
+
+  if(
+    len < 2 * sizeof len ||
+    len % sizeof len ||
+    ofs + (uint64_t) len > db->size ||
+    db->map[ofs + len - 1]
+  ) return NULL;
+
+  key = db->map + ofs + sizeof len;
+  *props = key + strlen(key) + 1;
+
+  return *props < db->map + ofs + len ? key : NULL;
+}
+
+
+/*
+ * Find last tail record with given key; return 1-based tail entry or 0.
+ */
+unsigned config_db_tail_find(struct hd_config_db_s *db, const char *key, uint32_t hash, unsigned **slot)
+{
+  unsigned u, n;
+  char *k, *props;
+
+  if(!db->tail_size) return 0;
+
+  for(u = hash & (db->tail_size - 1); (n = db->tail_index[u]); u = (u + 1) & (db->tail_size - 1)) {
+    if(
+      db->tail[n - 1].hash == hash &&
+      (k = config_db_record(db, db->tail[n - 1].ofs, &props)) &&
+      !strcmp(k, key)
+    ) break;
+  }
+
+  if(slot) *slot = db->tail_index + u;
+
+  return n;
+}
+
+
+void config_db_unmap(struct hd_config_db_s *db)
+{
+  if(db->map) munmap(db->map, db->size);
+  free_mem(db->tail);
+  free_mem(db->tail_index);
+  memset(db, 0, sizeof *db);
+}
+
+
+struct hd_config_db_s *config_db_free(struct hd_config_db_s *db)
+{
+  if(db) config_db_unmap(db);
+
+  return free_mem(db);
+}
+
+
+/*
+ * Map store, unless the current mapping is still up to date.
+ *
+ * Returns NULL if there's no (valid) store.
+ */
+struct hd_config_db_s *config_db_open(hd_data_t *hd_data, struct hd_config_db_s *db)
+{
+  struct stat sbuf;
+  hd_config_header_t *head;
+  hd_config_slot_t *tail;
+  uint64_t ofs, end;
+  uint32_t len, head_size;
+  unsigned u, *slot;
+  char *key, *props;
+  int fd;
+
+  if((fd = open(hd_get_hddb_path(HD_CONFIG_DB), O_RDONLY | O_CLOEXEC)) == -1) {
+    config_db_unmap(db);
+    return NULL;
+  }
+
+  if(
+    fstat(fd, &sbuf) ||
+    (
+      db->map && sbuf.st_ino == db->ino && sbuf.st_dev == db->dev && sbuf.st_size == db->size &&
+      (!db->head || db->head->version == 1 || db->head->end == db->end)
+    )
+  ) {
+    close(fd);
+    return db->head ? db : NULL;
+  }
+
+  config_db_unmap(db);
+
+  db->dev = sbuf.st_dev;
+  db->ino = sbuf.st_ino;
+
+  if(sbuf.st_size < HD_CONFIG_HEADER_V1) {
+    close(fd);
+    ADD2LOG("config: %s: invalid\n", HD_CONFIG_DB);
+    return NULL;
+  }
+
+  db->size = sbuf.st_size;
+  db->map = mmap(NULL, db->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if(db->map == MAP_FAILED) {
+    db->map = NULL;
+    return NULL;
+  }
+
+  head = (hd_config_header_t *) db->map;
+
+  head_size = sizeof *head;
+  end = db->size;
+  if(head->version == HD_CONFIG_VERSION && db->size >= sizeof *head) {
+    end = head->end;
+  }
+  else if(head->version == 1) {
+    head_size = HD_CONFIG_HEADER_V1;
+  }
+
+  if(
+    memcmp(head->magic, HD_CONFIG_MAGIC, sizeof head->magic) ||
+    (head->version != HD_CONFIG_VERSION && head->version != 1) ||
+    db->size < head_size ||
+    head->index_ofs < head_size ||
+    head->index_ofs % sizeof (uint32_t) ||
+    (head->index_size & (head->index_size - 1)) ||
+    head->index_ofs + (uint64_t) head->index_size * sizeof *db->index > end ||
+    end > db->size
+  ) {
+    ADD2LOG("config: %s: invalid\n", HD_CONFIG_DB);
+    return NULL;
+  }
+
+  db->head = head;
+  db->index = (hd_config_slot_t *) (db->map + head->index_ofs);
+
+  ofs = head->index_ofs + (uint64_t) head->index_size * sizeof *db->index;
+  for(; ofs < end && (key = config_db_record(db, ofs, &props)); ofs += len) {
+    if(ofs + (len = *(uint32_t *) (db->map + ofs)) > end) break;
+    if(!(db->tail_cnt & 63)) db->tail = resize_mem(db->tail, (db->tail_cnt + 64) * sizeof *db->tail);
+    tail = db->tail + db->tail_cnt++;
+    tail->hash = config_hash(key);
+    tail->ofs = ofs;
+  }
+  db->end = ofs;
+
+  if(db->tail_cnt) {
+    for(db->tail_size = 16; db->tail_size < 2 * db->tail_cnt; db->tail_size <<= 1);
+    db->tail_index = new_mem(db->tail_size * sizeof *db->tail_index);
+    for(u = 0; u < db->tail_cnt; u++) {
+      key = config_db_record(db, db->tail[u].ofs, &props);
+      config_db_tail_find(db, key, db->tail[u].hash, &slot);
+      *slot = u + 1;
+    }
+  }
+
+  return db;
+}
+
+
+/*
+ * Find current record for key; return its properties or NULL.
+ */
+char *config_db_find(struct hd_config_db_s *db, const char *key)
+{
+  uint32_t hash = config_hash(key);
+  hd_config_slot_t *slot;
+  unsigned u, n;
+  char *k, *props;
+
+  if((n = config_db_tail_find(db, key, hash, NULL))) {
+    config_db_record(db, db->tail[n - 1].ofs, &props);
+    return props;
+  }
+
+  if(!db->head->index_size) return NULL;
+
+  for(u = hash & (db->head->index_size - 1); (slot = db->index + u)->ofs; u = (u + 1) & (db->head->index_size - 1)) {
+    if(
+      slot->hash == hash &&
+      (k = config_db_record(db, slot->ofs, &props)) &&
+      !strcmp(k, key)
+    ) return props;
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Iterate over all current records, starting with *pos = 0.
+ *
+ * Returns the key and sets *ofs to the record offset; NULL at the end.
+ */
+char *config_db_next(struct hd_config_db_s *db, unsigned *pos, uint32_t *ofs)
+{
+  hd_config_slot_t *slot;
+  char *key, *props;
+
+  for(; *pos < db->head->index_size + db->tail_cnt; (*pos)++) {
+    if(*pos < db->head->index_size) {
+      slot = db->index + *pos;
+      if(!slot->ofs || !(key = config_db_record(db, slot->ofs, &props))) continue;
+      /* superseded */
+      if(config_db_tail_find(db, key, slot->hash, NULL)) continue;
+    }
+    else {
+      slot = db->tail + *pos - db->head->index_size;
+      key = config_db_record(db, slot->ofs, &props);
+      if(config_db_tail_find(db, key, slot->hash, NULL) != *pos - db->head->index_size + 1) continue;
+    }
+
+    (*pos)++;
+    *ofs = slot->ofs;
+
+    return key;
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Add a record to buffer.
+ */
+void config_db_add(char **buf, unsigned *len, const char *key, hal_prop_t *prop)
+{
+  char *props = NULL, *s;
+  uint32_t rec_len;
+
+  for(; prop; prop = prop->next) {
+    if(prop->type == p_invalid) continue;
+    if((s = hd_hal_print_prop(prop))) str_printf(&props, -1, "%s\n", s);
+  }
+  if(!props) props = new_str("");
+
+  rec_len = sizeof rec_len + strlen(key) + 1 + strlen(props) + 1;
+  rec_len = (rec_len + sizeof rec_len - 1) & ~(sizeof rec_len - 1);
+
+  *buf = resize_mem(*buf, *len + rec_len);
+  memset(*buf + *len, 0, rec_len);
+  memcpy(*buf + *len, &rec_len, sizeof rec_len);
+  strcpy(*buf + *len + sizeof rec_len, key);
+  strcpy(*buf + *len + sizeof rec_len + strlen(key) + 1, props);
+  *len += rec_len;
+
+  free_mem(props);
+}
+
+
+/*
+ * Rewrite store: all current records plus a new index, followed by the
+ * records in buf (if any) as tail. This also converts older store versions.
+ *
+ * Must be called with the store locked.
+ */
+int config_db_compact(hd_data_t *hd_data, struct hd_config_db_s *db, const char *file, char *buf, unsigned len)
+{
+  hd_config_header_t head = {};
+  hd_config_slot_t *index;
+  unsigned pos, u;
+  uint32_t ofs, rec_len, hash;
+  char *tmp = NULL, *key;
+  FILE *f;
+  int fd, err;
+
+  for(pos = 0; config_db_next(db, &pos, &ofs); head.records++);
+
+  for(head.index_size = 16; head.index_size < 2 * head.records; head.index_size <<= 1);
+  index = new_mem(head.index_size * sizeof *index);
+
+  str_printf(&tmp, 0, "%s.XXXXXX", file);
+
+  if((fd = mkstemp(tmp)) == -1 || !(f = fdopen(fd, "w"))) {
+    if(fd != -1) {
+      close(fd);
+      unlink(tmp);
+    }
+    ADD2LOG("config: %s: can't write\n", file);
+    free_mem(index);
+    free_mem(tmp);
+    return 2;
+  }
+
+  fchmod(fd, 0644);
+
+  fseek(f, sizeof head, SEEK_SET);
+
+  for(pos = 0; (key = config_db_next(db, &pos, &ofs));) {
+    rec_len = *(uint32_t *) (db->map + ofs);
+    hash = config_hash(key);
+    for(u = hash & (head.index_size - 1); index[u].ofs; u = (u + 1) & (head.index_size - 1));
+    index[u].hash = hash;
+    index[u].ofs = ftell(f);
+    fwrite(db->map + ofs, rec_len, 1, f);
+  }
+
+  memcpy(head.magic, HD_CONFIG_MAGIC, sizeof head.magic);
+  head.version = HD_CONFIG_VERSION;
+  head.index_ofs = ftell(f);
+  fwrite(index, sizeof *index, head.index_size, f);
+  if(len) fwrite(buf, len, 1, f);
+  head.end = ftell(f);
+
+  fseek(f, 0, SEEK_SET);
+  fwrite(&head, sizeof head, 1, f);
+
+  err = ferror(f) || fflush(f) || fsync(fd);
+  if(fclose(f)) err = 1;
+
+  if(err || rename(tmp, file)) {
+    unlink(tmp);
+    ADD2LOG("config: %s: can't write\n", file);
+    err = 2;
+  }
+  else {
+    ADD2LOG("config: %s: %u records\n", file, head.records);
+  }
+
+  free_mem(index);
+  free_mem(tmp);
+
+  return err;
+}
+
+
+/*
+ * Append records in buf to store as one transaction; compact it if
+ * necessary or if 'compact' is set.
+ *
+ * Returns 0 on success, -1 if there's no store, and > 0 if the store
+ * exists but couldn't be updated.
+ */
+int config_db_append(hd_data_t *hd_data, char *buf, unsigned len, unsigned records, int compact)
+{
+  struct hd_config_db_s tmp_db = {}, *db;
+  struct stat sbuf, sbuf2;
+  uint32_t end;
+  char *file;
+  int i, fd = -1, locked = 0, err = 0;
+
+  db = hd_data ? hd_data->config_db ?: (hd_data->config_db = new_mem(sizeof *db)) : &tmp_db;
+
+  file = new_str(hd_get_hddb_path(HD_CONFIG_DB));
+
+  /* the store might get replaced by a compaction while we wait for the lock */
+  for(i = 0; i < 3; i++) {
+    if((fd = open(file, O_RDWR | O_CLOEXEC)) == -1) {
+      /* no store: use udi/ & unique-keys/ */
+      if(errno == ENOENT) err = -1;
+      break;
+    }
+    if(flock(fd, LOCK_EX) || fstat(fd, &sbuf)) break;
+    if(
+      !stat(file, &sbuf2) &&
+      sbuf.st_ino == sbuf2.st_ino &&
+      sbuf.st_dev == sbuf2.st_dev
+    ) {
+      locked = 1;
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+
+  if(!locked || !config_db_open(hd_data, db)) {
+    if(fd != -1) close(fd);
+    if(!err) {
+      ADD2LOG("config: %s: can't %s\n", file, locked ? "read" : "lock");
+      err = 2;
+    }
+    free_mem(file);
+    if(!hd_data) config_db_unmap(db);
+    return err;
+  }
+
+  end = db->end + len;
+
+  /* older version: rewrite it, including the new records */
+  if(db->head->version != HD_CONFIG_VERSION) {
+    ADD2LOG("config: %s: converting version %u store\n", file, db->head->version);
+    err = config_db_compact(hd_data, db, file, buf, len);
+  }
+  /* drop anything not committed */
+  else if(
+    (db->end < db->size && ftruncate(fd, db->end)) ||
+    pwrite(fd, buf, len, db->end) != len ||
+    fdatasync(fd) ||
+    pwrite(fd, &end, sizeof end, offsetof(hd_config_header_t, end)) != sizeof end ||
+    fdatasync(fd)
+  ) {
+    ADD2LOG("config: %s: can't write\n", file);
+    err = 1;
+  }
+  /* compact when the tail has grown to a quarter of the store */
+  else if(
+    (
+      compact ||
+      ((db->tail_cnt + records) * 4 > db->head->records && db->tail_cnt + records > 64)
+    ) &&
+    config_db_open(hd_data, db)
+  ) {
+    err = config_db_compact(hd_data, db, file, NULL, 0);
+  }
+
+  close(fd);
+
+  free_mem(file);
+
+  if(!hd_data) config_db_unmap(db);
+
+  return err;
+}
+
+
+/*
+ * Read properties from store.
+ *
+ * Returns 0 if there's no store (use udi/ & unique-keys/), else 1; *prop is
+ * NULL if there's no record.
+ */
+int config_db_read(hd_data_t *hd_data, const char *key, hal_prop_t **prop)
+{
+  struct hd_config_db_s tmp_db = {}, *db;
+  char *props;
+
+  *prop = NULL;
+
+  db = hd_data ? hd_data->config_db ?: (hd_data->config_db = new_mem(sizeof *db)) : &tmp_db;
+
+  if(!config_db_open(hd_data, db)) return 0;
+
+  while(*key == '/') key++;
+
+  if((props = config_db_find(db, key))) {
+    props = new_str(props);
+    *prop = parse_properties(props, props + strlen(props));
+    free_mem(props);
+  }
+
+  if(!hd_data) config_db_unmap(db);
+
+  return 1;
+}
+
+
+/*
+ * Write properties to store.
+ *
+ * Returns -1 if there's no store (use udi/ & unique-keys/), else 0 on
+ * success.
+ */
+int config_db_write(hd_data_t *hd_data, const char *key, hal_prop_t *prop)
+{
+  char *buf = NULL;
+  unsigned len = 0;
+  int err;
+
+  while(*key == '/') key++;
+
+  config_db_add(&buf, &len, key, prop);
+  err = config_db_append(hd_data, buf, len, 1, 0);
+  free_mem(buf);
+
+  return err;
+}
+
+
+/*
+ * Write records in buf to the journal (HD_CONFIG_JOURNAL).
+ *
+ * Returns 0 on success.
+ */
+int config_journal_write(hd_data_t *hd_data, char *buf, unsigned len)
+{
+  char *file, *tmp = NULL;
+  int fd, err;
+
+  file = new_str(hd_get_hddb_path(HD_CONFIG_JOURNAL));
+  str_printf(&tmp, 0, "%s.XXXXXX", file);
+
+  if((fd = mkstemp(tmp)) == -1) {
+    ADD2LOG("config: %s: can't write\n", file);
+    free_mem(tmp);
+    free_mem(file);
+    return 2;
+  }
+
+  fchmod(fd, 0644);
+
+  err = write(fd, buf, len) != len || fsync(fd);
+  if(close(fd)) err = 1;
+
+  if(err || rename(tmp, file)) {
+    unlink(tmp);
+    ADD2LOG("config: %s: can't write\n", file);
+    err = 2;
+  }
+  else {
+    sync_parent_dir(file);
+  }
+
+  free_mem(tmp);
+  free_mem(file);
+
+  return err;
+}
+
+
+/*
+ * Apply a journal left by hd_write_config_list() to udi/ and remove it.
+ *
+ * hd_data may be NULL.
+ *
+ * Returns 0 on success or if there's no journal.
+ */
+int config_journal_replay(hd_data_t *hd_data)
+{
+  struct stat sbuf;
+  hal_prop_t *prop;
+  char *file, *buf = NULL, *key, *props;
+  uint32_t ofs, rec_len;
+  int fd, err = 0, invalid = 0;
+
+  file = new_str(hd_get_hddb_path(HD_CONFIG_JOURNAL));
+
+  if((fd = open(file, O_RDONLY | O_CLOEXEC)) == -1) {
+    free_mem(file);
+    return 0;
+  }
+
+  if(!fstat(fd, &sbuf) && sbuf.st_size < UINT32_MAX) {
+    buf = new_mem(sbuf.st_size + 1);
+    if(read(fd, buf, sbuf.st_size) != sbuf.st_size) err = 1;
+  }
+  else {
+    err = 1;
+  }
+
+  close(fd);
+
+  for(ofs = 0; !err && ofs < sbuf.st_size; ofs += rec_len) {
+    if(sbuf.st_size - ofs < sizeof rec_len) {
+      invalid = 1;
+      break;
+    }
+    memcpy(&rec_len, buf + ofs, sizeof rec_len);
+    key = buf + ofs + sizeof rec_len;
+    if(
+      rec_len < sizeof rec_len + 2 ||
+      rec_len % sizeof rec_len ||
+      rec_len > sbuf.st_size - ofs ||
+      buf[ofs + rec_len - 1] ||
+      (props = key + strlen(key) + 1) >= buf + ofs + rec_len
+    ) {
+      invalid = 1;
+      break;
+    }
+    prop = parse_properties(props, props + strlen(props));
+    err = write_properties_file(key, prop);
+    hd_free_hal_properties(prop);
+  }
+
+  /* can't be a committed journal: drop it */
+  if(invalid) ADD2LOG("config: %s: invalid\n", file);
+
+  if(!err && unlink(file)) err = 1;
+
+  if(err) ADD2LOG("config: %s: can't replay\n", file);
+
+  free_mem(buf);
+  free_mem(file);
+
+  return err;
+}
+
+
+/*
+ * Create config store (HD_CONFIG_DB) from the udi/ and unique-keys/
+ * directories; from then on libhd uses only the store.
+ *
+ * If the store exists already, records missing there are added.
+ *
+ * Returns 0 on success.
+ */
+API_SYM int hd_config_import(hd_data_t *hd_data)
+{
+  hd_config_header_t head = {};
+  struct hd_config_db_s *db;
+  struct stat sbuf;
+  DIR *dir;
+  struct dirent *de;
+  hal_prop_t *prop;
+  char *udi_dir[] = { "/org/freedesktop/Hal/devices", "", "" };
+  char *file, *buf = NULL, *s = NULL;
+  unsigned len = 0, records = 0;
+  int i, j, fd, err;
+
+  file = new_str(hd_get_hddb_path(HD_CONFIG_DB));
+
+  if((fd = open(file, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) != -1) {
+    memcpy(head.magic, HD_CONFIG_MAGIC, sizeof head.magic);
+    head.version = HD_CONFIG_VERSION;
+    head.index_ofs = head.end = sizeof head;
+    err = write(fd, &head, sizeof head) != sizeof head;
+    if(close(fd)) err = 1;
+    if(err) {
+      unlink(file);
+      ADD2LOG("config: %s: can't write\n", file);
+      free_mem(file);
+      return 2;
+    }
+  }
+
+  db = hd_data->config_db ?: (hd_data->config_db = new_mem(sizeof *db));
+
+  if(!config_db_open(hd_data, db)) {
+    free_mem(file);
+    return 3;
+  }
+
+  for(j = 0; j < sizeof udi_dir / sizeof *udi_dir; j++) {
+    str_printf(&s, 0, "%s%s", j == 2 ? "unique-keys" : "udi", udi_dir[j]);
+    if(!(dir = opendir(hd_get_hddb_path(s)))) continue;
+    i = 0;
+    while((de = readdir(dir))) {
+      if(*de->d_name == '.') continue;
+      PROGRESS(1, ++i, "import");
+      str_printf(&s, 0, "%s%s%s", udi_dir[j] + (*udi_dir[j] ? 1 : 0), *udi_dir[j] ? "/" : "", de->d_name);
+      if(config_db_find(db, s)) continue;
+      if(j == 2) {
+        /* udi/<id> has precedence */
+        str_printf(&s, 0, "udi/%s", de->d_name);
+        if(!stat(hd_get_hddb_path(s), &sbuf)) continue;
+        prop = hd_manual_read_entry_old(de->d_name);
+        str_printf(&s, 0, "%s", de->d_name);
+      }
+      else {
+        prop = read_properties_file(s);
+      }
+      if(prop) {
+        config_db_add(&buf, &len, s, prop);
+        records++;
+      }
+      hd_free_hal_properties(prop);
+    }
+    closedir(dir);
+  }
+
+  /* an older store version gets converted, too */
+  err = records || db->head->version != HD_CONFIG_VERSION ? config_db_append(hd_data, buf, len, records, 1) : 0;
+
+  ADD2LOG("config: %s: %u records imported\n", file, records);
+
+  free_mem(buf);
+  free_mem(s);
+  free_mem(file);
+
+  return err ? 4 : 0;
+}
+
+
 #endif	/* LIBHD_TINY */
 
 /** @} */
@@ -154,7 +154,7 @@ void get_serial_modem(hd_data_t *hd_data)
   int i, j, fd;
   unsigned modem_info, baud;
   char *command;
-  ser_device_t *sm;
+  ser_device_t *sm, **sm_next = &hd_data->ser_modem;
   int chk_usb = hd_probe_feature(hd_data, pr_modem_usb);
 
   /* serial modems & usb modems */
@@ -177,7 +177,8 @@ void get_serial_modem(hd_data_t *hd_data)
     ) {
       if(dev_name_duplicate(hd_data, hd->unix_dev_name)) continue;
       if((fd = open(hd->unix_dev_name, O_RDWR | O_NONBLOCK)) >= 0) {
-        sm = add_ser_modem_entry(&hd_data->ser_modem, new_mem(sizeof *sm));
+        sm = add_ser_modem_entry(sm_next, new_mem(sizeof *sm));
+        sm_next = &sm->next;
         sm->dev_name = new_str(hd->unix_dev_name);
         sm->fd = fd;
         sm->hd_idx = hd->idx;
@@ -422,7 +423,7 @@ void get_serial_modem(hd_data_t *hd_data)
 
     /* reset serial lines */
     tcflush(sm->fd, TCIOFLUSH);
-    tcsetattr(sm->fd, TCSAFLUSH, &sm->tio);
+    tcsetattr(sm->fd, hd_watched(hd_data) ? TCSANOW : TCSAFLUSH, &sm->tio);
     close(sm->fd);
   }
 }
@@ -688,7 +689,7 @@ void at_cmd(hd_data_t *hd_data, char *at, int raw, int log_it)
     }
   }
 
-  if(modems == 0) return;
+  if(modems == 0 || hd_timed_out(hd_data)) return;
 
   PROGRESS(9, u, "write at cmd");
   write_modem(hd_data, at);
@@ -734,7 +735,7 @@ void write_modem(hd_data_t *hd_data, char *msg)
 
   for(sm = hd_data->ser_modem; sm; sm = sm->next) {
     if(sm->do_io) {
-      i = write(sm->fd, msg, len);
+      i = hd_write_timeout(hd_data, sm->fd, msg, len, 1000);
       if(i != len) {
         ADD2LOG("%s write oops: %d/%d (\"%s\")\n", sm->dev_name, i, len, msg);
       }
@@ -762,6 +763,7 @@ void read_modem(hd_data_t *hd_data)
   if(!i) return;	/* nothing selected */
 
   for(;;) {
+    if(hd_timed_out(hd_data)) break;
     to.tv_sec = 0; to.tv_usec = 1000000;
     set = set0;
     if((sel = select(fd_max + 1, &set, NULL, NULL, &to)) > 0) {
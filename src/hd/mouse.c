@@ -433,6 +433,7 @@ void get_serial_mouse(hd_data_t *hd_data)
 
   set0 = set;
   for(;;) {
+    if(hd_timed_out(hd_data)) break;
    to.tv_sec = 0; to.tv_usec = 300000;
     set = set0;
     if((sel = select(fd_max + 1, &set, NULL, NULL, &to)) > 0) {
@@ -453,7 +454,7 @@ void get_serial_mouse(hd_data_t *hd_data)
     chk4id(sm);
     /* reset serial lines */
     tcflush(sm->fd, TCIOFLUSH);
-    tcsetattr(sm->fd, TCSAFLUSH, &sm->tio);
+    tcsetattr(sm->fd, hd_watched(hd_data) ? TCSANOW : TCSAFLUSH, &sm->tio);
     close(sm->fd);
   }
 }
@@ -41,7 +41,10 @@ static hd_res_t *get_phwaddr(hd_data_t *hd_data, hd_t *hd);
 static void add_xpnet(hd_data_t *hdata);
 static void add_uml(hd_data_t *hdata);
 static void add_kma(hd_data_t *hdata);
-static void add_if_name(hd_t *hd_card, hd_t *hd);
+static void add_if_name(hd_data_t *hd_data, hd_t *hd_card, hd_t *hd);
+static hd_t *find_card(hd_data_t *hd_data, hd_t *hd);
+static void update_card(hd_data_t *hd_data, hd_t *hd, hd_t *hd_card, int if_type);
+static void update_card_link(hd_data_t *hd_data, hd_t *hd);
 
 /*
  * This is independent of the other scans.
@@ -52,8 +55,8 @@ void hd_scan_net(hd_data_t *hd_data)
   unsigned u;
   int if_type, if_carrier;
   hd_t *hd, *hd_card;
-  char *s, *t, *hw_addr;
-  hd_res_t *res, *res_hw, *res_phw, *res_lnk;
+  char *s, *hw_addr;
+  hd_res_t *res, *res_hw;
   uint64_t ul0;
   str_list_t *sf_class, *sf_class_e;
   char *sf_cdev = NULL, *sf_dev = NULL;
@@ -78,6 +81,8 @@ void hd_scan_net(hd_data_t *hd_data)
   }
 
   for(sf_class_e = sf_class; sf_class_e; sf_class_e = sf_class_e->next) {
+    if(!hd_sysfs_in_scope(hd_data, hd_read_sysfs_link("/sys/class/net", sf_class_e->str))) continue;
+
     str_printf(&sf_cdev, 0, "/sys/class/net/%s", sf_class_e->str);
 
     hd_card = NULL;
@@ -138,7 +143,7 @@ void hd_scan_net(hd_data_t *hd_data)
       add_res_entry(&hd->res, res_hw);
     }
 
-    res_phw = get_phwaddr(hd_data, hd);
+    get_phwaddr(hd_data, hd);
 
     if(if_carrier >= 0) {
       res = new_mem(sizeof *res);
@@ -249,84 +254,15 @@ void hd_scan_net(hd_data_t *hd_data)
     hd_card = NULL;
 
     if(sf_dev) {
-      s = new_str(hd_sysfs_id(sf_dev));
-
-      hd->sysfs_device_link = new_str(s);
-
-      hd_card = hd_find_sysfs_id(hd_data, s);
+      hd->sysfs_device_link = new_str(hd_sysfs_id(sf_dev));
 
-      // try one above, if not found
-      if(!hd_card) {
-        t = strrchr(s, '/');
-        if(t) {
-          *t = 0;
-          hd_card = hd_find_sysfs_id(hd_data, s);
-        }
-      }
-
-      /* if one card has several interfaces (as with PS3), check interface names, too */
-      if(
-        hd_card &&
-        hd_card->unix_dev_name &&
-        hd->unix_dev_name &&
-        strcmp(hd->unix_dev_name, hd_card->unix_dev_name)
-      ) {
-        hd_card = hd_find_sysfs_id_devname(hd_data, s, hd->unix_dev_name);
-      }
-
-      s = free_mem(s);
+      hd_card = find_card(hd_data, hd);
 
       if(hd_card) {
         hd->attached_to = hd_card->idx;
 
-        /* for cards with strange pci classes */
-        hd_set_hw_class(hd_card, hw_network_ctrl);
-
-        /* add hw addr to network card */
-        if(res_hw) {
-          u = 0;
-          for(res = hd_card->res; res; res = res->next) {
-            if(
-              res->any.type == res_hwaddr &&
-              !strcmp(res->hwaddr.addr, res_hw->hwaddr.addr)
-            ) {
-              u = 1;
-              break;
-            }
-          }
-          if(!u) {
-            res = new_mem(sizeof *res);
-            res->hwaddr.type = res_hwaddr;
-            res->hwaddr.addr = new_str(res_hw->hwaddr.addr);
-            add_res_entry(&hd_card->res, res);
-          }
-        }
-
-        /* add permanent hw addr to network card */
-        if(res_phw) {
-          u = 0;
-          for(res = hd_card->res; res; res = res->next) {
-            if(
-              res->any.type == res_phwaddr &&
-              !strcmp(res->hwaddr.addr, res_phw->hwaddr.addr)
-            ) {
-              u = 1;
-              break;
-            }
-          }
-          if(!u) {
-            res = new_mem(sizeof *res);
-            res->hwaddr.type = res_phwaddr;
-            res->hwaddr.addr = new_str(res_phw->hwaddr.addr);
-            add_res_entry(&hd_card->res, res);
-          }
-        }
-
-        /*
-         * add interface names...
-         * but not wmasterX (bnc #441778)
-         */
-        if(if_type != 801) add_if_name(hd_card, hd);
+        /* this changes the card entry; in a probing thread, see hd_scan_net_link() */
+        if(!hd_data->flags.worker) update_card(hd_data, hd, hd_card, if_type);
       }
     }
 
@@ -353,26 +289,6 @@ void hd_scan_net(hd_data_t *hd_data)
 
     hw_addr = free_mem(hw_addr);
 
-    /* fix card type */
-    if(hd_card) {
-      if(
-        (hd_card->base_class.id == 0 && hd_card->sub_class.id == 0) ||
-        (hd_card->base_class.id == bc_network && hd_card->sub_class.id == 0x80)
-      ) {
-        switch(hd->sub_class.id) {
-          case sc_nif_ethernet:
-            hd_card->base_class.id = bc_network;
-            hd_card->sub_class.id = 0;
-            break;
-
-          case sc_nif_usb:
-            hd_card->base_class.id = bc_network;
-            hd_card->sub_class.id = 0x91;
-            break;
-        }
-      }
-    }
-
     sf_dev = free_mem(sf_dev);
   }
 
@@ -413,32 +329,213 @@ void hd_scan_net(hd_data_t *hd_data)
 
       if(!res) get_linkstate(hd_data, hd);
 
-      if(!(hd_card = hd_get_device_by_idx(hd_data, hd->attached_to))) continue;
+      /* in a probing thread, see hd_scan_net_link() */
+      if(!hd_data->flags.worker) update_card_link(hd_data, hd);
+    }
+  }
+}
 
-      for(res = hd->res; res; res = res->next) {
-        if(res->any.type == res_link) break;
+
+/*
+ * The part of hd_scan_net() that changes the network card entries; run
+ * in the main thread after the probing thread has finished (cf.
+ * probe_steps[]).
+ */
+void hd_scan_net_link(hd_data_t *hd_data)
+{
+  hd_t *hd, *hd_card, *hd1;
+  char *s = NULL;
+  int if_type;
+  uint64_t ul0;
+
+  if(!hd_probe_feature(hd_data, pr_net)) return;
+
+  hd_data->module = mod_net;
+
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(
+      hd->module != hd_data->module ||
+      hd->base_class.id != bc_network_interface ||
+      !hd->sysfs_device_link ||
+      !(hd_card = find_card(hd_data, hd))
+    ) continue;
+
+    /* don't undo add_xpnet(), add_uml(), add_kma() */
+    hd1 = hd_get_device_by_idx(hd_data, hd->attached_to);
+    if(hd1 && hd1 != hd_card && hd1->module == hd_data->module) continue;
+
+    hd->attached_to = hd_card->idx;
+
+    str_printf(&s, 0, "/sys%s", hd->sysfs_id);
+    if_type = hd_attr_uint(get_sysfs_attr_by_path(s, "type"), &ul0, 0) ? (int) ul0 : -1;
+
+    update_card(hd_data, hd, hd_card, if_type);
+  }
+
+  s = free_mem(s);
+
+  for(hd = hd_data->hd; hd; hd = hd->next) {
+    if(
+      hd->module == hd_data->module &&
+      hd->base_class.id == bc_network_interface
+    ) {
+      update_card_link(hd_data, hd);
+    }
+  }
+}
+
+
+/*
+ * Find the network card of interface hd.
+ */
+hd_t *find_card(hd_data_t *hd_data, hd_t *hd)
+{
+  hd_t *hd_card;
+  char *s, *t;
+
+  s = new_str(hd->sysfs_device_link);
+
+  hd_card = hd_find_sysfs_id(hd_data, s);
+
+  // try one above, if not found
+  if(!hd_card) {
+    t = strrchr(s, '/');
+    if(t) {
+      *t = 0;
+      hd_card = hd_find_sysfs_id(hd_data, s);
+    }
+  }
+
+  /* if one card has several interfaces (as with PS3), check interface names, too */
+  if(
+    hd_card &&
+    hd_card->unix_dev_name &&
+    hd->unix_dev_name &&
+    strcmp(hd->unix_dev_name, hd_card->unix_dev_name)
+  ) {
+    hd_card = hd_find_sysfs_id_devname(hd_data, s, hd->unix_dev_name);
+  }
+
+  free_mem(s);
+
+  return hd_card;
+}
+
+
+/*
+ * Add interface hd's data to its network card hd_card.
+ */
+void update_card(hd_data_t *hd_data, hd_t *hd, hd_t *hd_card, int if_type)
+{
+  hd_res_t *res, *res_hw = NULL, *res_phw = NULL;
+  unsigned u;
+
+  for(res = hd->res; res; res = res->next) {
+    if(res->any.type == res_hwaddr && !res_hw) res_hw = res;
+    if(res->any.type == res_phwaddr && !res_phw) res_phw = res;
+  }
+
+  /* for cards with strange pci classes */
+  hd_set_hw_class(hd_card, hw_network_ctrl);
+
+  /* add hw addr to network card */
+  if(res_hw) {
+    u = 0;
+    for(res = hd_card->res; res; res = res->next) {
+      if(
+        res->any.type == res_hwaddr &&
+        !strcmp(res->hwaddr.addr, res_hw->hwaddr.addr)
+      ) {
+        u = 1;
+        break;
       }
+    }
+    if(!u) {
+      res = new_mem(sizeof *res);
+      res->hwaddr.type = res_hwaddr;
+      res->hwaddr.addr = new_str(res_hw->hwaddr.addr);
+      add_res_entry(&hd_card->res, res);
+    }
+  }
 
-      if(res) {
-        for(res_lnk = hd_card->res; res_lnk; res_lnk = res_lnk->next) {
-          if(res_lnk->any.type == res_link) break;
-        }
-        if(res && !res_lnk) {
-          res_lnk = new_mem(sizeof *res_lnk);
-          res_lnk->link.type = res_link;
-          res_lnk->link.state = res->link.state;
-          add_res_entry(&hd_card->res, res_lnk);
-        }
+  /* add permanent hw addr to network card */
+  if(res_phw) {
+    u = 0;
+    for(res = hd_card->res; res; res = res->next) {
+      if(
+        res->any.type == res_phwaddr &&
+        !strcmp(res->hwaddr.addr, res_phw->hwaddr.addr)
+      ) {
+        u = 1;
+        break;
       }
+    }
+    if(!u) {
+      res = new_mem(sizeof *res);
+      res->hwaddr.type = res_phwaddr;
+      res->hwaddr.addr = new_str(res_phw->hwaddr.addr);
+      add_res_entry(&hd_card->res, res);
+    }
+  }
 
-      hd_card->is.fcoe_offload = hd->is.fcoe_offload;
-      hd_card->is.iscsi_offload = hd->is.iscsi_offload;
-      hd_card->is.storage_only = hd->is.storage_only;
+  /*
+   * add interface names...
+   * but not wmasterX (bnc #441778)
+   */
+  if(if_type != 801) add_if_name(hd_data, hd_card, hd);
+
+  /* fix card type */
+  if(
+    (hd_card->base_class.id == 0 && hd_card->sub_class.id == 0) ||
+    (hd_card->base_class.id == bc_network && hd_card->sub_class.id == 0x80)
+  ) {
+    switch(hd->sub_class.id) {
+      case sc_nif_ethernet:
+        hd_card->base_class.id = bc_network;
+        hd_card->sub_class.id = 0;
+        break;
+
+      case sc_nif_usb:
+        hd_card->base_class.id = bc_network;
+        hd_card->sub_class.id = 0x91;
+        break;
     }
   }
 }
 
 
+/*
+ * Add interface hd's link state & offload flags to its network card.
+ */
+void update_card_link(hd_data_t *hd_data, hd_t *hd)
+{
+  hd_t *hd_card;
+  hd_res_t *res, *res_lnk;
+
+  if(!(hd_card = hd_get_device_by_idx(hd_data, hd->attached_to))) return;
+
+  for(res = hd->res; res; res = res->next) {
+    if(res->any.type == res_link) break;
+  }
+
+  if(res) {
+    for(res_lnk = hd_card->res; res_lnk; res_lnk = res_lnk->next) {
+      if(res_lnk->any.type == res_link) break;
+    }
+    if(res && !res_lnk) {
+      res_lnk = new_mem(sizeof *res_lnk);
+      res_lnk->link.type = res_link;
+      res_lnk->link.state = res->link.state;
+      add_res_entry(&hd_card->res, res_lnk);
+    }
+  }
+
+  hd_card->is.fcoe_offload = hd->is.fcoe_offload;
+  hd_card->is.iscsi_offload = hd->is.iscsi_offload;
+  hd_card->is.storage_only = hd->is.storage_only;
+}
+
+
 /*
  * Get private flags via ethtool.
  */
@@ -678,7 +775,7 @@ void add_xpnet(hd_data_t *hd_data)
         add_res_entry(&hd_card->res, res2);
       }
 
-      add_if_name(hd_card, hd);
+      add_if_name(hd_data, hd_card, hd);
 
       break;
     }
@@ -726,7 +823,7 @@ void add_uml(hd_data_t *hd_data)
         add_res_entry(&hd_card->res, res2);
       }
 
-      add_if_name(hd_card, hd);
+      add_if_name(hd_data, hd_card, hd);
     }
   }
 }
@@ -768,7 +865,7 @@ void add_kma(hd_data_t *hd_data)
         add_res_entry(&hd_card->res, res2);
       }
 
-      add_if_name(hd_card, hd);
+      add_if_name(hd_data, hd_card, hd);
     }
   }
 }
@@ -777,7 +874,7 @@ void add_kma(hd_data_t *hd_data)
 /*
  * add interface name to card
  */
-void add_if_name(hd_t *hd_card, hd_t *hd)
+void add_if_name(hd_data_t *hd_data, hd_t *hd_card, hd_t *hd)
 {
   str_list_t *sl0;
 
@@ -796,6 +893,7 @@ void add_if_name(hd_t *hd_card, hd_t *hd)
       }
       free_mem(hd_card->unix_dev_name);
       hd_card->unix_dev_name = new_str(hd_card->unix_dev_names->str);
+      hd_index_changed(hd_data, hd_card);
     }
   }
 }
@@ -1 +1,2 @@
 void hd_scan_net(hd_data_t *hd_data);
+void hd_scan_net_link(hd_data_t *hd_data);
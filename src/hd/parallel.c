@@ -121,12 +121,10 @@ void do_lp(hd_data_t *hd_data)
 //    fprintf(stderr, "vendor <%s>\n", vendor);
 //    fprintf(stderr, "cmds <%s>\n", cmd_set);
 
-    for(hd = hd_data->hd; hd; hd = hd->next) {
+    for(hd = NULL; (hd = hd_find_unix_dev_name(hd_data, unix_dev, hd));) {
       if(
         hd->base_class.id == bc_comm &&
-        hd->sub_class.id == sc_com_par &&
-        hd->unix_dev_name &&
-        !strcmp(hd->unix_dev_name, unix_dev)
+        hd->sub_class.id == sc_com_par
       ) break;
     }
 
@@ -243,12 +241,10 @@ void do_zip(hd_data_t *hd_data)
 
     hd = NULL;
     if(unix_dev) {
-      for(hd = hd_data->hd; hd; hd = hd->next) {
+      for(hd = NULL; (hd = hd_find_unix_dev_name(hd_data, unix_dev, hd));) {
         if(
           hd->base_class.id == bc_comm &&
-          hd->sub_class.id == sc_com_par &&
-          hd->unix_dev_name &&
-          !strcmp(hd->unix_dev_name, unix_dev)
+          hd->sub_class.id == sc_com_par
         ) break;
       }
 
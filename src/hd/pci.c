@@ -44,7 +44,7 @@
 
 static void add_pci_data(hd_data_t *hd_data);
 // static void add_driver_info(hd_data_t *hd_data);
-static pci_t *add_pci_entry(hd_data_t *hd_data, pci_t *new_pci);
+static pci_t *add_pci_entry(pci_t **pci, pci_t *new_pci);
 static unsigned char pci_cfg_byte(pci_t *pci, int fd, unsigned idx);
 static void dump_pci_data(hd_data_t *hd_data);
 static void hd_read_macio(hd_data_t *hd_data);
@@ -148,7 +148,7 @@ void hd_pci_read_data(hd_data_t *hd_data)
   unsigned char nxt;
   str_list_t *sl;
   char *s;
-  pci_t *pci;
+  pci_t *pci, **pci_next = &hd_data->pci;
   int fd;
   str_list_t *sf_bus, *sf_bus_e, *sf_drm_dirs, *sf_drm_dir, *sf_drm_subdirs,
     *sf_drm_subdir;
@@ -164,6 +164,11 @@ void hd_pci_read_data(hd_data_t *hd_data)
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
     sf_dev = new_str(hd_read_sysfs_link("/sys/bus/pci/devices", sf_bus_e->str));
 
+    if(!hd_sysfs_in_scope(hd_data, sf_dev)) {
+      free_mem(sf_dev);
+      continue;
+    }
+
     ADD2LOG(
       "  pci device: name = %s\n    path = %s\n",
       sf_bus_e->str,
@@ -172,7 +177,8 @@ void hd_pci_read_data(hd_data_t *hd_data)
 
     if(sscanf(sf_bus_e->str, "%x:%x:%x.%x", &u0, &u1, &u2, &u3) != 4) continue;
 
-    pci = add_pci_entry(hd_data, new_mem(sizeof *pci));
+    pci = add_pci_entry(pci_next, new_mem(sizeof *pci));
+    pci_next = &pci->next;
 
     pci->sysfs_id = new_str(sf_dev);
     pci->sysfs_bus_id = new_str(sf_bus_e->str);
@@ -595,34 +601,18 @@ void add_driver_info(hd_data_t *hd_data)
 #endif
 
 
-#if 1
 /*
  * Store a raw PCI entry; just for convenience.
+ *
+ * pci may point anywhere into the list, the new entry is appended.
  */
-pci_t *add_pci_entry(hd_data_t *hd_data, pci_t *new_pci)
+pci_t *add_pci_entry(pci_t **pci, pci_t *new_pci)
 {
-  pci_t **pci = &hd_data->pci;
-
   while(*pci) pci = &(*pci)->next;
 
   return *pci = new_pci;
 }
 
-#else
-
-/*
- * Store a raw PCI entry; just for convenience.
- *
- * Reverse order.
- */
-pci_t *add_pci_entry(hd_data_t *hd_data, pci_t *new_pci)
-{
-  new_pci->next = hd_data->pci;
-
-  return hd_data->pci = new_pci;
-}
-#endif
-
 
 /*
  * get a byte from pci config space
@@ -169,7 +169,7 @@ void get_serial_info(hd_data_t *hd_data)
 #endif
   int i;
   str_list_t *sl, *sl0, **sll;
-  serial_t *ser;
+  serial_t *ser, **ser_next = &hd_data->serial;
 
 #if !defined(__PPC__)
   /*
@@ -195,7 +195,8 @@ void get_serial_info(hd_data_t *hd_data)
         /*
          * The 'baud' or 'tx' entries are only present for real interfaces.
          */
-        ser = add_serial_entry(&hd_data->serial, new_mem(sizeof *ser));
+        ser = add_serial_entry(ser_next, new_mem(sizeof *ser));
+        ser_next = &ser->next;
         ser->line = u0;
         if(u1 >= 0x100) ser->port = u1;		// Agere modem does not use real port numbers
         ser->irq = u2;
@@ -223,7 +224,8 @@ void get_serial_info(hd_data_t *hd_data)
       if(
         (i = sscanf(sl->str, "%u: port:%x irq:%u con:%63[^\n]", &u0, &u1, &u2, buf)) >= 3
       ) {
-        ser = add_serial_entry(&hd_data->serial, new_mem(sizeof *ser));
+        ser = add_serial_entry(ser_next, new_mem(sizeof *ser));
+        ser_next = &ser->next;
         ser->line = u0;
         ser->port = u1;
         ser->irq = u2;
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <pthread.h>
 #include <ctype.h>
 
 #include <sys/types.h>
@@ -198,7 +199,7 @@ int vmware_mouse(int set_iopl)
     _exit(res == 0x564d5868 && version != -1 ? 66 : 77);
   }
   else {
-    if(waitpid(child, &status, 0) == child) {
+    if(hd_waitpid(child, &status) == child) {
       status = WEXITSTATUS(status);
       if(status == 66) vm_ok = 1;
       if(status == 77) vm_ok = 0;
@@ -213,6 +214,10 @@ void chk_vmware(hd_data_t *hd_data, sys_info_t *st)
 {
   int vm_1, vm_2;
   static int is_vmware = -1, has_vmware_mouse = -1;	/* check only once */
+  static pthread_mutex_t vm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+  /* probing modules may run in parallel, cf. hd_scan_threaded() */
+  pthread_mutex_lock(&vm_lock);
 
   if(is_vmware < 0) {
     if(chk_hypervisor(hd_data)) {
@@ -230,6 +235,8 @@ void chk_vmware(hd_data_t *hd_data, sys_info_t *st)
     ADD2LOG("  is_vmware = %d, has_vmware_mouse = %d\n", is_vmware, has_vmware_mouse);
   }
 
+  pthread_mutex_unlock(&vm_lock);
+
   if(is_vmware == 1) {
     st->model = new_str("VMware");
   }
@@ -66,8 +66,11 @@ void hd_scan_sysfs_usb(hd_data_t *hd_data)
   PROGRESS(3, 2, "evdev mod");
   load_module(hd_data, "evdev");
 
-  PROGRESS(3, 3, "input");
-  get_input_devs(hd_data);
+  /* this may change other entries; in a probing thread, see hd_scan_sysfs_usb_link() */
+  if(!hd_data->flags.worker) {
+    PROGRESS(3, 3, "input");
+    get_input_devs(hd_data);
+  }
 
   PROGRESS(3, 4, "lp");
   get_printer_devs(hd_data);
@@ -78,6 +81,21 @@ void hd_scan_sysfs_usb(hd_data_t *hd_data)
 }
 
 
+/*
+ * The part of hd_scan_sysfs_usb() that is run in the main thread after
+ * the probing thread has finished (cf. probe_steps[]).
+ */
+void hd_scan_sysfs_usb_link(hd_data_t *hd_data)
+{
+  if(!hd_probe_feature(hd_data, pr_usb)) return;
+
+  hd_data->module = mod_usb;
+
+  PROGRESS(3, 3, "input");
+  get_input_devs(hd_data);
+}
+
+
 void get_usb_devs(hd_data_t *hd_data)
 {
   uint64_t ul0;
@@ -110,6 +128,11 @@ void get_usb_devs(hd_data_t *hd_data)
   for(sf_bus_e = sf_bus; sf_bus_e; sf_bus_e = sf_bus_e->next) {
     sf_dev = new_str(hd_read_sysfs_link("/sys/bus/usb/devices", sf_bus_e->str));
 
+    if(!hd_sysfs_in_scope(hd_data, sf_dev)) {
+      free_mem(sf_dev);
+      continue;
+    }
+
     ADD2LOG(
       "  usb device: name = %s\n    path = %s\n",
       sf_bus_e->str,
@@ -270,6 +293,7 @@ void get_usb_devs(hd_data_t *hd_data)
       // ###### FIXME
       if(hd->base_class.id == bc_modem) {
         hd->unix_dev_name = new_str("/dev/ttyACM0");
+        hd_index_changed(hd_data, hd);
       }
     }
 
@@ -591,6 +615,7 @@ void add_input_dev(hd_data_t *hd_data, char *name)
         if(!hd->unix_dev_name) {
           hd->unix_dev_name = t;
           hd->unix_dev_num = dev_num;
+          hd_index_changed(hd_data, hd);
         }
       }
       else {
@@ -604,6 +629,7 @@ void add_input_dev(hd_data_t *hd_data, char *name)
         dev_num.minor = 63;
         hd->unix_dev_name = new_str(DEV_MICE);
         hd->unix_dev_num = dev_num;
+        hd_index_changed(hd_data, hd);
 
         // make it a mouse, #216091
         if(hd->base_class.id == bc_none) {
@@ -742,6 +768,7 @@ void get_printer_devs(hd_data_t *hd_data)
 
           hd->unix_dev_name = t;
           hd->unix_dev_num = dev_num;
+          hd_index_changed(hd_data, hd);
 
           read_usb_lp(hd_data, hd);
         }
@@ -910,6 +937,7 @@ void get_serial_devs(hd_data_t *hd_data)
 
           hd->unix_dev_name = t;
           hd->unix_dev_num = dev_num;
+          hd_index_changed(hd_data, hd);
 
           hd->base_class.id = bc_comm;
           hd->sub_class.id = sc_com_ser;
@@ -1 +1,2 @@
 void hd_scan_sysfs_usb(hd_data_t *hd_data);
+void hd_scan_sysfs_usb_link(hd_data_t *hd_data);
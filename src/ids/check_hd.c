@@ -7,6 +7,7 @@
 #include <unistd.h>
 #include <time.h>
 #include <getopt.h>
+#include <sys/stat.h>
 
 #include "../hd/hddb_int.h"
 
@@ -198,6 +199,7 @@ void join_items_by_key(list_t *hd);
 void remove_unimportant_items(list_t *hd);
 
 void write_cfile(FILE *f, list_t *hd);
+int write_bfile(char *file, list_t *hd, char **sources);
 
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
@@ -218,6 +220,7 @@ struct option options[] = {
   { "join-keys-first", 0, NULL, 14},
   { "combine", 0, NULL, 15},
   { "no-range", 0, NULL, 16},
+  { "bfile", 1, NULL, 17},
   { }
 };
 
@@ -242,6 +245,7 @@ struct {
   char *logfile;
   char *outfile;
   char *cfile;
+  char *bfile;
 } opt = {
   logfile: "hd.log",
   outfile: "hd.ids"
@@ -259,6 +263,7 @@ int main(int argc, char **argv)
   int i, close_log = 0, close_cfile = 0;
   item_t *item;
   FILE *cfile;
+  char **sources;
 
   for(opterr = 0; (i = getopt_long(argc, argv, "", options, NULL)) != -1; ) {
     switch(i) {
@@ -328,6 +333,11 @@ int main(int argc, char **argv)
         opt.no_range = 1;
         break;
 
+      case 17:
+        opt.bfile = optarg;
+        if(!*opt.bfile) opt.bfile = NULL;
+        break;
+
       default:
         fprintf(stderr,
           "Usage: check_hd [options] files\n"
@@ -342,6 +352,8 @@ int main(int argc, char **argv)
           "  \t\t\tcommon keys first (default is common values first)\n"
           "  --cfile file\t\tcreate C file to be included in libhd\n"
           "  --no-compact\t\tdon't try to make C version as small as possible\n"
+          "  --bfile file\t\tcreate binary data base to be used by libhd instead\n"
+          "  \t\t\tof the source files (as long as they are unchanged)\n"
           "  --out file\t\twrite results to file, default is \"hd.ids\"\n"
           "  --log file\t\twrite log info to file, default is \"hd.log\"\n\n"
           "  Note: check_hd works with libhd/hwinfo internal format only;\n"
@@ -363,7 +375,7 @@ int main(int argc, char **argv)
     logfh = stdout;
   }
 
-  for(argv += optind; *argv; argv++) {
+  for(sources = argv += optind; *argv; argv++) {
     read_items(*argv);
   }
 
@@ -442,6 +454,12 @@ int main(int argc, char **argv)
     if(close_cfile) fclose(cfile);
   }
 
+  if(opt.bfile) {
+    split_items(&hd);
+
+    if(write_bfile(opt.bfile, &hd, sources)) return 3;
+  }
+
   fprintf(logfh, "- statistics\n");
   write_stats(logfh);
   if(logfh != stdout) {
@@ -2909,3 +2927,79 @@ void write_cfile(FILE *f, list_t *hd)
 }
 
 
+/*
+ * Write binary data base (cf. hddb_bin_header_t).
+ *
+ * The list of source files is stored as a fingerprint. libhd uses the
+ * binary data base only if the text files in its data base directory match
+ * it. So to replace hd.ids & ids/, build it from exactly these files, in
+ * the order libhd reads them: the files in ids/ (sorted), then hd.ids.
+ *
+ * The file is written to a temporary file first and then renamed.
+ */
+int write_bfile(char *file, list_t *hd, char **sources)
+{
+  hddb_data_t hddb = {};
+  hddb_bin_header_t head = {};
+  uint64_t id;
+  FILE *f;
+  char *tmp = NULL;
+  int err = 0;
+
+  fprintf(logfh, "- building binary version\n");
+  fflush(logfh);
+
+  memcpy(head.magic, HDDB_BIN_MAGIC, sizeof head.magic);
+  head.version = HDDB_BIN_VERSION;
+  head.list_entry_size = sizeof *hddb.list;
+
+  for(; *sources; sources++) {
+    if(!hddb_bin_file_id(*sources, &id)) {
+      fprintf(stderr, "%s: not a readable file\n", *sources);
+      return 1;
+    }
+    head.sources++;
+    head.sources_id += id;
+  }
+
+  hddb_init(&hddb, hd);
+
+  head.list_len = hddb.list_len;
+  head.ids_len = hddb.ids_len;
+  head.strings_len = hddb.strings_len;
+  head.list_ofs = sizeof head;
+  head.ids_ofs = head.list_ofs + hddb.list_len * sizeof *hddb.list;
+  head.strings_ofs = head.ids_ofs + hddb.ids_len * sizeof *hddb.ids;
+
+  fprintf(logfh, "  db size: %u bytes\n", head.strings_ofs + head.strings_len);
+
+  asprintf(&tmp, "%s.tmp", file);
+
+  if(!(f = fopen(tmp, "w"))) {
+    perror(tmp);
+    err = 1;
+  }
+  else {
+    if(
+      fwrite(&head, sizeof head, 1, f) != 1 ||
+      fwrite(hddb.list, sizeof *hddb.list, hddb.list_len, f) != hddb.list_len ||
+      fwrite(hddb.ids, sizeof *hddb.ids, hddb.ids_len, f) != hddb.ids_len ||
+      fwrite(hddb.strings, 1, hddb.strings_len, f) != hddb.strings_len
+    ) err = 1;
+    if(fclose(f)) err = 1;
+    if(err) perror(tmp);
+    if(!err && rename(tmp, file)) {
+      perror(file);
+      err = 1;
+    }
+    if(err) unlink(tmp);
+  }
+
+  free(tmp);
+
+  free_mem(hddb.list);
+  free_mem(hddb.ids);
+  free_mem(hddb.strings);
+
+  return err;
+}